@@ -10,10 +10,14 @@
 
 #include <stdexcept>
 #include <ostream>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#include <utility>
 #include "sequence.h"
 
 template <typename T>
-class ArraySeq : public Sequence<T>
+class ArraySeq final : public Sequence<T>
 {
 public:
   // Default constructor
@@ -53,11 +57,50 @@ public:
   // greater than or equal to size()).
   const T &operator[](int index) const;
 
+  // Returns a reference to the element at the index without checking
+  // the index. The caller must guarantee 0 <= index < size().
+  T &unchecked(int index) { return array[index]; }
+  const T &unchecked(int index) const { return array[index]; }
+
+  // Returns a pointer to the underlying array (nullptr if nothing has
+  // been allocated yet). Valid until the next operation that grows
+  // the sequence.
+  T *data() { return array; }
+  const T *data() const { return array; }
+
   // Extends the sequence by inserting the element at the given index.
   // Throws out_of_range if the index is invalid (less than 0 or
   // greater than size()).
   void insert(const T &elem, int index);
 
+  // Inserts the n elements starting at elems at the given index,
+  // shifting the existing elements only once. Throws out_of_range if
+  // the index is invalid (less than 0 or greater than size()).
+  void insert(const T *elems, int n, int index);
+
+  // Adds the element to the end of the sequence.
+  void push_back(const T &elem);
+
+  // Constructs an element from the given arguments at the end of the
+  // sequence.
+  template <typename... Args>
+  void emplace_back(Args &&...args);
+
+  // Adds the n elements starting at elems to the end of the sequence.
+  void append(const T *elems, int n);
+
+  // Adds all of the elements of rhs to the end of the sequence.
+  void append(const ArraySeq &rhs);
+
+  // Makes sure the sequence can hold at least n elements without
+  // reallocating.
+  void reserve(int n);
+
+  // Sets the size of the sequence to n, dropping elements past n or
+  // adding default-valued elements (so the new slots can be filled
+  // through data()).
+  void resize(int n);
+
   // Shrinks the sequence by removing the element at the index in the
   // sequence. Throws out_of_range if index is invalid.
   void erase(int index);
@@ -92,8 +135,13 @@ private:
   // max capacity of the array
   int capacity = 0;
 
-  // helper to double the capacity of the array
-  void resize();
+  // helper to double the capacity of the array until it can hold at
+  // least min_capacity elements
+  void grow(int min_capacity);
+
+  // helper to move n elements from src to dst (ranges may overlap),
+  // using memmove for trivially copyable types
+  static void move_elems(T *dst, T *src, int n);
 
   // sort function helpers
   void merge_sort(int start, int end);
@@ -144,9 +192,17 @@ ArraySeq<T> &ArraySeq<T>::operator=(const ArraySeq &rhs)
     count = rhs.count;
     capacity = rhs.capacity;
 
-    for (int i = 0; i < count; i++)
+    if (std::is_trivially_copyable<T>::value)
     {
-      array[i] = rhs[i];
+      if (count > 0)
+        std::memcpy(static_cast<void *>(array), static_cast<const void *>(rhs.array), count * sizeof(T));
+    }
+    else
+    {
+      for (int i = 0; i < count; i++)
+      {
+        array[i] = rhs.array[i];
+      }
     }
   }
   return *this;
@@ -235,17 +291,134 @@ void ArraySeq<T>::insert(const T &elem, int index)
   }
   else
   {
+    // elem may refer into the array, either to a part that is shifted
+    // (and moved from) below or into storage that grow frees
+    T copy = elem;
     if (size() == capacity)
     {
-      resize();
+      grow(count + 1);
     }
-    for (int i = size(); i > index; --i)
+    move_elems(array + index + 1, array + index, count - index);
+    array[index] = std::move(copy);
+    count++;
+  }
+}
+
+template <typename T>
+void ArraySeq<T>::insert(const T *elems, int n, int index)
+{
+  if (index < 0 or index > size())
+  {
+    throw std::out_of_range("Invalid Index");
+  }
+  if (n <= 0)
+  {
+    return;
+  }
+  if (count + n > capacity)
+  {
+    // elems may point into this sequence, so build into a new array
+    int new_capacity = capacity == 0 ? 1 : capacity;
+    while (new_capacity < count + n)
     {
-      array[i] = array[i - 1];
+      new_capacity = new_capacity * 2;
     }
-    array[index] = elem;
-    count++;
+    T *new_array = new T[new_capacity];
+    move_elems(new_array, array, index);
+    for (int i = 0; i < n; ++i)
+    {
+      new_array[index + i] = elems[i];
+    }
+    move_elems(new_array + index + n, array + index, count - index);
+    delete[] array;
+    array = new_array;
+    capacity = new_capacity;
+  }
+  else
+  {
+    // if elems points into this sequence, its elements at or after
+    // index are n places further on once the tail is shifted
+    bool inside = !std::less<const T *>()(elems, array) and
+                  std::less<const T *>()(elems, array + count);
+    move_elems(array + index + n, array + index, count - index);
+    for (int i = 0; i < n; ++i)
+    {
+      const T *src = elems + i;
+      if (inside and src >= array + index)
+      {
+        src += n;
+      }
+      array[index + i] = *src;
+    }
+  }
+  count += n;
+}
+
+template <typename T>
+void ArraySeq<T>::push_back(const T &elem)
+{
+  if (count == capacity)
+  {
+    // elem may refer into the array being reallocated
+    T copy = elem;
+    grow(count + 1);
+    array[count++] = std::move(copy);
+    return;
+  }
+  array[count++] = elem;
+}
+
+template <typename T>
+template <typename... Args>
+void ArraySeq<T>::emplace_back(Args &&...args)
+{
+  T elem(std::forward<Args>(args)...);
+  if (count == capacity)
+  {
+    grow(count + 1);
   }
+  array[count++] = std::move(elem);
+}
+
+template <typename T>
+void ArraySeq<T>::append(const T *elems, int n)
+{
+  insert(elems, n, count);
+}
+
+template <typename T>
+void ArraySeq<T>::append(const ArraySeq &rhs)
+{
+  insert(rhs.array, rhs.count, count);
+}
+
+template <typename T>
+void ArraySeq<T>::reserve(int n)
+{
+  if (n <= capacity)
+  {
+    return;
+  }
+  T *new_array = new T[n];
+  move_elems(new_array, array, count);
+  delete[] array;
+  array = new_array;
+  capacity = n;
+}
+
+template <typename T>
+void ArraySeq<T>::resize(int n)
+{
+  if (n < 0)
+  {
+    throw std::out_of_range("Invalid Size");
+  }
+  reserve(n);
+  for (int i = count; i < n; ++i)
+  {
+    array[i] = T();
+  }
+  count = n;
 }
 
 template <typename T>
@@ -257,10 +430,7 @@ void ArraySeq<T>::erase(int index)
   }
   else
   {
-    for (int i = index; i < count - 1; ++i)
-    {
-      array[i] = array[i + 1];
-    }
+    move_elems(array + index, array + index + 1, count - index - 1);
     count--;
   }
 }
@@ -279,26 +449,48 @@ bool ArraySeq<T>::contains(const T &elem) const
 }
 
 template <typename T>
-void ArraySeq<T>::resize()
+void ArraySeq<T>::grow(int min_capacity)
 {
-  if (capacity == 0)
+  int new_capacity = capacity;
+  while (new_capacity < min_capacity)
   {
-    capacity = capacity + 1;
+    if (new_capacity == 0)
+    {
+      new_capacity = new_capacity + 1;
+    }
+    else
+    {
+      new_capacity = new_capacity * 2;
+    }
   }
-  else
+  reserve(new_capacity);
+}
+
+template <typename T>
+void ArraySeq<T>::move_elems(T *dst, T *src, int n)
+{
+  if (n <= 0 or dst == src)
   {
-    capacity = capacity * 2;
+    return;
   }
-
-  T *new_array = nullptr;
-  new_array = new T[capacity];
-
-  for (int i = 0; i < count; ++i)
+  if (std::is_trivially_copyable<T>::value)
   {
-    new_array[i] = array[i];
+    std::memmove(static_cast<void *>(dst), static_cast<const void *>(src), n * sizeof(T));
+  }
+  else if (dst < src)
+  {
+    for (int i = 0; i < n; ++i)
+    {
+      dst[i] = std::move(src[i]);
+    }
+  }
+  else
+  {
+    for (int i = n - 1; i >= 0; --i)
+    {
+      dst[i] = std::move(src[i]);
+    }
   }
-  delete[] array;
-  array = new_array;
 }
 
 // (2) TODO: Implement the following sorting functions for your array
@@ -0,0 +1,221 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: bench_util.h
+// DATE: Spring 2022
+// DESC: Shared helpers for the benchmark programs: timing, allocation
+//       counting, and key stream generators (sequential, uniform
+//       random, Zipfian, and duplicate-heavy).
+//---------------------------------------------------------------------------
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include "../arrayseq.h"
+
+namespace bench
+{
+
+// Number of calls to the global operator new since program start.
+// Only counts when the program includes BENCH_COUNT_ALLOCATIONS (see
+// the bottom of this file) in exactly one translation unit.
+inline std::atomic<long long> &allocations()
+{
+  static std::atomic<long long> n{0};
+  return n;
+}
+
+// Keeps the optimizer from discarding a computed value
+template <typename T>
+inline void keep(const T &value)
+{
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Wall clock stopwatch
+class Timer
+{
+public:
+  Timer() : start(std::chrono::steady_clock::now()) {}
+  void reset() { start = std::chrono::steady_clock::now(); }
+  double ns() const
+  {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  }
+
+private:
+  std::chrono::steady_clock::time_point start;
+};
+
+// Zipfian generator over [0, n) using the method of Gray et al.
+// ("Quickly Generating Billion-Record Synthetic Databases"), O(n) setup
+// and O(1) per sample. Rank 0 is the most popular item.
+class Zipf
+{
+public:
+  Zipf(std::uint64_t n, double theta = 0.99, std::uint64_t seed = 42)
+      : n(n), theta(theta), rng(seed)
+  {
+    double zeta2 = zeta(2);
+    zetan = zeta(n);
+    alpha = 1.0 / (1.0 - theta);
+    eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+  }
+
+  std::uint64_t next()
+  {
+    double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    double uz = u * zetan;
+    if (uz < 1.0)
+      return 0;
+    if (uz < 1.0 + std::pow(0.5, theta))
+      return 1;
+    std::uint64_t r = static_cast<std::uint64_t>(n * std::pow(eta * u - eta + 1.0, alpha));
+    return r >= n ? n - 1 : r;
+  }
+
+private:
+  std::uint64_t n;
+  double theta, zetan, alpha, eta;
+  std::mt19937_64 rng;
+
+  double zeta(std::uint64_t count) const
+  {
+    double sum = 0;
+    for (std::uint64_t i = 1; i <= count; ++i)
+      sum += 1.0 / std::pow(static_cast<double>(i), theta);
+    return sum;
+  }
+};
+
+// Key distributions used by the benchmarks
+enum class Dist
+{
+  sequential,
+  random,
+  zipfian,
+  duplicates
+};
+
+inline const char *dist_name(Dist d)
+{
+  switch (d)
+  {
+  case Dist::sequential:
+    return "sequential";
+  case Dist::random:
+    return "random";
+  case Dist::zipfian:
+    return "zipfian";
+  case Dist::duplicates:
+    return "duplicates";
+  }
+  return "?";
+}
+
+inline bool parse_dist(const std::string &name, Dist &d)
+{
+  for (Dist x : {Dist::sequential, Dist::random, Dist::zipfian, Dist::duplicates})
+  {
+    if (name == dist_name(x))
+    {
+      d = x;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Generates a stream of n keys following the distribution. Sequential
+// and random streams contain no duplicates; Zipfian streams draw from
+// n distinct (scattered) keys with skewed popularity; duplicate-heavy
+// streams draw uniformly from n / 16 distinct keys.
+inline ArraySeq<std::int64_t> key_stream(Dist d, int n, std::uint64_t seed = 42)
+{
+  ArraySeq<std::int64_t> keys;
+  keys.reserve(n);
+  std::mt19937_64 rng(seed);
+  switch (d)
+  {
+  case Dist::sequential:
+    for (int i = 0; i < n; ++i)
+      keys.push_back(i);
+    break;
+  case Dist::random:
+  {
+    // a shuffled permutation of spread out keys
+    for (int i = 0; i < n; ++i)
+      keys.push_back(static_cast<std::int64_t>(i) * 7 + 3);
+    for (int i = n - 1; i > 0; --i)
+    {
+      int j = static_cast<int>(rng() % (i + 1));
+      std::swap(keys.unchecked(i), keys.unchecked(j));
+    }
+    break;
+  }
+  case Dist::zipfian:
+  {
+    Zipf zipf(n, 0.99, seed);
+    for (int i = 0; i < n; ++i)
+    {
+      // scatter ranks so popular keys are not clustered
+      std::uint64_t r = zipf.next();
+      keys.push_back(static_cast<std::int64_t>((r * 0x9E3779B97F4A7C15ULL) >> 1));
+    }
+    break;
+  }
+  case Dist::duplicates:
+  {
+    int distinct = n / 16 > 0 ? n / 16 : 1;
+    for (int i = 0; i < n; ++i)
+      keys.push_back(static_cast<std::int64_t>(rng() % distinct));
+    break;
+  }
+  }
+  return keys;
+}
+
+} // namespace bench
+
+// Replaces the global allocation functions with counting versions.
+// Define BENCH_COUNT_ALLOCATIONS before including this header in the
+// one translation unit that holds main().
+#ifdef BENCH_COUNT_ALLOCATIONS
+void *operator new(std::size_t size)
+{
+  bench::allocations().fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void *operator new[](std::size_t size)
+{
+  bench::allocations().fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+// every form of new above allocates with malloc, so free is the right
+// match for all of them; GCC cannot see that once these are inlined
+// into a delete[] and warns
+#if defined(__GNUC__) and !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+#if defined(__GNUC__) and !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+#endif
@@ -0,0 +1,527 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: btreemap_bench.cpp
+// DATE: Spring 2022
+// DESC: Microbenchmarks for BTreeMap and ArraySeq. Measures each map
+//       operation and each ArraySeq sort over several key
+//       distributions and sizes, reporting ns/op and allocations/op.
+//
+// BUILD: g++ -std=c++17 -O2 -DNDEBUG -pthread -o btreemap_bench btreemap_bench.cpp
+//
+// USAGE: btreemap_bench [--max N] [--sizes n1,n2,...]
+//                       [--dist d1,d2,...] [--ops op1,op2,...]
+//                       [--threads T]
+//        sizes default to 1K, 10K, 100K, 1M; --max N runs powers of
+//        ten from 1K up to N (e.g., --max 100000000).
+//        dists: sequential, random, zipfian, duplicates
+//        ops: insert, lookup, contains, batch_lookup, batch_contains,
+//             frozen (freeze, then lookup and find_keys on the frozen
+//             map), learned (learned index over the frozen map),
+//             packed (the same on a map with compressed keys),
+//             erase, find_keys, sorted_keys,
+//             next_key, prev_key, copy, sort, merge_sort, quick_sort,
+//             quick_sort_random, par_sorted_keys, par_find_keys,
+//             par_copy, par_clear
+//        --threads sets the pool size for the par_ ops (default: one
+//        per hardware thread).
+//---------------------------------------------------------------------------
+
+#define BENCH_COUNT_ALLOCATIONS
+#include "bench_util.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "../btreemap.h"
+#include "../frozenbtreemap.h"
+#include "../learnedindex.h"
+#include "../packedfrozenmap.h"
+#include "../hashedarrayseq.h"
+
+using bench::Dist;
+using Key = std::int64_t;
+
+namespace
+{
+
+// benchmark configuration from the command line
+struct Config
+{
+  ArraySeq<int> sizes;
+  ArraySeq<Dist> dists;
+  ArraySeq<std::string> ops;
+  int threads = ThreadPool::default_threads();
+};
+
+bool selected(const Config &cfg, const char *op)
+{
+  return cfg.ops.empty() or cfg.ops.contains(op);
+}
+
+// splits a comma separated argument
+ArraySeq<std::string> split_list(const std::string &arg)
+{
+  ArraySeq<std::string> items;
+  std::string item;
+  for (char c : arg)
+  {
+    if (c == ',')
+    {
+      if (!item.empty())
+        items.push_back(item);
+      item.clear();
+    }
+    else
+      item += c;
+  }
+  if (!item.empty())
+    items.push_back(item);
+  return items;
+}
+
+// times f(), which performs ops operations, and prints one result row
+template <typename F>
+void run(const char *op, Dist d, int n, long long ops, F f)
+{
+  long long allocs = bench::allocations().load();
+  bench::Timer timer;
+  f();
+  double ns = timer.ns();
+  allocs = bench::allocations().load() - allocs;
+  if (ops < 1)
+    ops = 1;
+  std::printf("%-18s %-11s %11d %12.1f %10.3f\n", op, bench::dist_name(d), n,
+              ns / ops, static_cast<double>(allocs) / ops);
+  std::fflush(stdout);
+}
+
+void skip(const char *op, Dist d, int n, const char *why)
+{
+  std::printf("%-18s %-11s %11d %12s %10s  (%s)\n", op, bench::dist_name(d), n, "-", "-", why);
+}
+
+void bench_map(const Config &cfg, Dist d, int n)
+{
+  ArraySeq<Key> stream = bench::key_stream(d, n);
+
+  // the map itself requires unique keys
+  HashedArraySeq<Key> unique;
+  for (int i = 0; i < stream.size(); ++i)
+    unique.insert_unique(stream.unchecked(i));
+  const ArraySeq<Key> &keys = unique.elements();
+  int m = keys.size();
+
+  BTreeMap<Key, Key> map;
+  run("insert", d, n, m, [&]()
+      {
+        for (int i = 0; i < m; ++i)
+          map.insert(keys.unchecked(i), keys.unchecked(i));
+      });
+
+  if (selected(cfg, "lookup"))
+  {
+    run("lookup", d, n, n, [&]()
+        {
+          Key sum = 0;
+          for (int i = 0; i < n; ++i)
+            sum += map[stream.unchecked(i)];
+          bench::keep(sum);
+        });
+    // the same lookups through the hot key cache
+    map.enable_cache();
+    run("cached_lookup", d, n, n, [&]()
+        {
+          Key sum = 0;
+          for (int i = 0; i < n; ++i)
+            sum += map[stream.unchecked(i)];
+          bench::keep(sum);
+        });
+    map.disable_cache();
+  }
+
+  if (selected(cfg, "contains"))
+  {
+    run("contains_hit", d, n, n, [&]()
+        {
+          int found = 0;
+          for (int i = 0; i < n; ++i)
+            found += map.contains(stream.unchecked(i));
+          bench::keep(found);
+        });
+    // all generated keys are non-negative, so negated keys miss
+    run("contains_miss", d, n, n, [&]()
+        {
+          int found = 0;
+          for (int i = 0; i < n; ++i)
+            found += map.contains(-stream.unchecked(i) - 1);
+          bench::keep(found);
+        });
+    // the same lookups answered by the Bloom filter
+    map.enable_filter();
+    run("filtered_hit", d, n, n, [&]()
+        {
+          int found = 0;
+          for (int i = 0; i < n; ++i)
+            found += map.contains(stream.unchecked(i));
+          bench::keep(found);
+        });
+    run("filtered_miss", d, n, n, [&]()
+        {
+          int found = 0;
+          for (int i = 0; i < n; ++i)
+            found += map.contains(-stream.unchecked(i) - 1);
+          bench::keep(found);
+        });
+    map.disable_filter();
+  }
+
+  // batches of 64 keys through the interleaved (prefetching) descents
+  const int batch = 64;
+  if (selected(cfg, "batch_lookup"))
+  {
+    run("batch_lookup", d, n, n, [&]()
+        {
+          Key *values[batch];
+          Key sum = 0;
+          for (int i = 0; i < n; i += batch)
+          {
+            int b = n - i < batch ? n - i : batch;
+            map.find(&stream.unchecked(i), b, values);
+            for (int j = 0; j < b; ++j)
+              sum += *values[j];
+          }
+          bench::keep(sum);
+        });
+  }
+
+  if (selected(cfg, "batch_contains"))
+  {
+    run("batch_contains", d, n, n, [&]()
+        {
+          bool found[batch];
+          int hits = 0;
+          for (int i = 0; i < n; i += batch)
+          {
+            int b = n - i < batch ? n - i : batch;
+            map.contains(&stream.unchecked(i), b, found);
+            for (int j = 0; j < b; ++j)
+              hits += found[j];
+          }
+          bench::keep(hits);
+        });
+  }
+
+  ArraySeq<Key> sorted;
+  if (selected(cfg, "sorted_keys"))
+  {
+    run("sorted_keys", d, n, m, [&]()
+        { sorted = map.sorted_keys(); });
+  }
+  else
+    sorted = map.sorted_keys();
+
+  if (selected(cfg, "find_keys"))
+  {
+    // ranges spanning about 100 keys starting at random keys
+    const int queries = 1000;
+    std::mt19937_64 rng(7);
+    long long found = 0;
+    run("find_keys(100)", d, n, queries, [&]()
+        {
+          for (int q = 0; q < queries; ++q)
+          {
+            int lo = static_cast<int>(rng() % m);
+            int hi = lo + 99 < m ? lo + 99 : m - 1;
+            found += map.find_keys(sorted.unchecked(lo), sorted.unchecked(hi)).size();
+          }
+        });
+    bench::keep(found);
+  }
+
+  if (selected(cfg, "frozen") or selected(cfg, "learned"))
+  {
+    FrozenBTreeMap<Key, Key> frozen;
+    run("freeze", d, n, m, [&]()
+        { frozen = map.freeze(); });
+    if (selected(cfg, "learned"))
+    {
+      // the plain tree and frozen lookups above and below are the
+      // baselines for these
+      for (int eps : {16, 64})
+      {
+        LearnedIndex<Key, Key> *learned = nullptr;
+        std::string build = "learn(" + std::to_string(eps) + ")";
+        run(build.c_str(), d, n, m, [&]()
+            { learned = new LearnedIndex<Key, Key>(frozen, eps); });
+        std::string lookup = "learned_lookup(" + std::to_string(eps) + ")";
+        run(lookup.c_str(), d, n, n, [&]()
+            {
+              Key sum = 0;
+              for (int i = 0; i < n; ++i)
+                sum += (*learned)[stream.unchecked(i)];
+              bench::keep(sum);
+            });
+        std::printf("%-18s %-11s %11d %12d segments (%.2f bytes/key)\n", "learned_size",
+                    bench::dist_name(d), n, learned->segments(),
+                    static_cast<double>(learned->bytes()) / m);
+        delete learned;
+      }
+    }
+    run("frozen_lookup", d, n, n, [&]()
+        {
+          Key sum = 0;
+          for (int i = 0; i < n; ++i)
+            sum += frozen[stream.unchecked(i)];
+          bench::keep(sum);
+        });
+    run("frozen_miss", d, n, n, [&]()
+        {
+          int found = 0;
+          for (int i = 0; i < n; ++i)
+            found += frozen.contains(-stream.unchecked(i) - 1);
+          bench::keep(found);
+        });
+    const int queries = 1000;
+    std::mt19937_64 rng(7);
+    long long found = 0;
+    run("frozen_find(100)", d, n, queries, [&]()
+        {
+          for (int q = 0; q < queries; ++q)
+          {
+            int lo = static_cast<int>(rng() % m);
+            int hi = lo + 99 < m ? lo + 99 : m - 1;
+            found += frozen.find_keys(sorted.unchecked(lo), sorted.unchecked(hi)).size();
+          }
+        });
+    bench::keep(found);
+    std::printf("%-18s %-11s %11d %12.1f bytes/key (tree: %.1f)\n", "frozen_size",
+                bench::dist_name(d), n, static_cast<double>(frozen.bytes()) / m,
+                static_cast<double>(map.stats().bytes) / m);
+  }
+
+  if (selected(cfg, "packed"))
+  {
+    // the frozen rows above are the baseline for these
+    PackedFrozenMap<Key, Key> packed;
+    run("pack", d, n, m, [&]()
+        { packed = PackedFrozenMap<Key, Key>(map); });
+    run("packed_lookup", d, n, n, [&]()
+        {
+          Key sum = 0;
+          for (int i = 0; i < n; ++i)
+            sum += packed[stream.unchecked(i)];
+          bench::keep(sum);
+        });
+    run("packed_miss", d, n, n, [&]()
+        {
+          int found = 0;
+          for (int i = 0; i < n; ++i)
+            found += packed.contains(-stream.unchecked(i) - 1);
+          bench::keep(found);
+        });
+    const int queries = 1000;
+    std::mt19937_64 rng(7);
+    long long found = 0;
+    run("packed_find(100)", d, n, queries, [&]()
+        {
+          for (int q = 0; q < queries; ++q)
+          {
+            int lo = static_cast<int>(rng() % m);
+            int hi = lo + 99 < m ? lo + 99 : m - 1;
+            found += packed.find_keys(sorted.unchecked(lo), sorted.unchecked(hi)).size();
+          }
+        });
+    bench::keep(found);
+    std::printf("%-18s %-11s %11d %12.1f bytes/key (keys: %.2f)\n", "packed_size",
+                bench::dist_name(d), n, static_cast<double>(packed.bytes()) / m,
+                static_cast<double>(packed.key_bytes()) / m);
+  }
+
+  if (selected(cfg, "next_key"))
+  {
+    run("next_key", d, n, n, [&]()
+        {
+          Key next = 0, sum = 0;
+          for (int i = 0; i < n; ++i)
+            if (map.next_key(stream.unchecked(i), next))
+              sum += next;
+          bench::keep(sum);
+        });
+  }
+
+  if (selected(cfg, "prev_key"))
+  {
+    run("prev_key", d, n, n, [&]()
+        {
+          Key prev = 0, sum = 0;
+          for (int i = 0; i < n; ++i)
+            if (map.prev_key(stream.unchecked(i), prev))
+              sum += prev;
+          bench::keep(sum);
+        });
+  }
+
+  if (selected(cfg, "copy"))
+  {
+    run("copy", d, n, m, [&]()
+        {
+          BTreeMap<Key, Key> copy(map);
+          bench::keep(copy.size());
+        });
+  }
+
+  if (selected(cfg, "par_sorted_keys") or selected(cfg, "par_find_keys") or
+      selected(cfg, "par_copy") or selected(cfg, "par_clear"))
+  {
+    ThreadPool pool(cfg.threads);
+    if (selected(cfg, "par_sorted_keys"))
+    {
+      run("par_sorted_keys", d, n, m, [&]()
+          { bench::keep(map.sorted_keys(pool).size()); });
+    }
+    if (selected(cfg, "par_find_keys"))
+    {
+      // a range covering the middle 20% of the keys
+      Key lo = sorted.unchecked(m * 2 / 5), hi = sorted.unchecked(m * 3 / 5);
+      run("par_find_keys(20%)", d, n, m / 5, [&]()
+          { bench::keep(map.find_keys(lo, hi, pool).size()); });
+    }
+    BTreeMap<Key, Key> copy;
+    if (selected(cfg, "par_copy"))
+    {
+      run("par_copy", d, n, m, [&]()
+          {
+            copy.assign(map, pool);
+            bench::keep(copy.size());
+          });
+    }
+    if (selected(cfg, "par_clear"))
+    {
+      if (copy.empty())
+        copy = map;
+      run("par_clear", d, n, m, [&]()
+          { copy.clear(pool); });
+    }
+  }
+
+  if (selected(cfg, "erase"))
+  {
+    run("erase", d, n, m, [&]()
+        {
+          for (int i = 0; i < m; ++i)
+            map.erase(keys.unchecked(i));
+        });
+  }
+}
+
+void bench_sorts(const Config &cfg, Dist d, int n)
+{
+  ArraySeq<Key> stream = bench::key_stream(d, n);
+  const char *sorts[] = {"sort", "merge_sort", "quick_sort", "quick_sort_random"};
+  for (const char *name : sorts)
+  {
+    if (!selected(cfg, name))
+      continue;
+    // first element pivots degrade to quadratic time (and recursion
+    // depth) on already sorted and duplicate-heavy input
+    if (std::strcmp(name, "quick_sort") == 0 and n > 20000 and
+        (d == Dist::sequential or d == Dist::duplicates))
+    {
+      skip(name, d, n, "quadratic on this input");
+      continue;
+    }
+    ArraySeq<Key> seq = stream;
+    run(name, d, n, n, [&]()
+        {
+          if (std::strcmp(name, "sort") == 0)
+            seq.sort();
+          else if (std::strcmp(name, "merge_sort") == 0)
+            seq.merge_sort();
+          else if (std::strcmp(name, "quick_sort") == 0)
+            seq.quick_sort();
+          else
+            seq.quick_sort_random();
+        });
+  }
+}
+
+void usage()
+{
+  std::cerr << "usage: btreemap_bench [--max N] [--sizes n1,n2,...] "
+               "[--dist d1,...] [--ops op1,...] [--threads T]"
+            << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  Config cfg;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (i + 1 >= argc)
+    {
+      usage();
+      return 1;
+    }
+    std::string value = argv[++i];
+    if (arg == "--max")
+    {
+      long long max = std::atoll(value.c_str());
+      for (long long n = 1000; n <= max; n *= 10)
+        cfg.sizes.push_back(static_cast<int>(n));
+    }
+    else if (arg == "--sizes")
+    {
+      ArraySeq<std::string> items = split_list(value);
+      for (int j = 0; j < items.size(); ++j)
+        cfg.sizes.push_back(std::atoi(items[j].c_str()));
+    }
+    else if (arg == "--dist")
+    {
+      ArraySeq<std::string> items = split_list(value);
+      for (int j = 0; j < items.size(); ++j)
+      {
+        Dist d;
+        if (!bench::parse_dist(items[j], d))
+        {
+          std::cerr << "unknown distribution: " << items[j] << std::endl;
+          return 1;
+        }
+        cfg.dists.push_back(d);
+      }
+    }
+    else if (arg == "--ops")
+      cfg.ops = split_list(value);
+    else if (arg == "--threads")
+      cfg.threads = std::atoi(value.c_str());
+    else
+    {
+      usage();
+      return 1;
+    }
+  }
+  if (cfg.sizes.empty())
+  {
+    for (int n = 1000; n <= 1000000; n *= 10)
+      cfg.sizes.push_back(n);
+  }
+  if (cfg.dists.empty())
+  {
+    for (Dist d : {Dist::sequential, Dist::random, Dist::zipfian, Dist::duplicates})
+      cfg.dists.push_back(d);
+  }
+
+  std::printf("%-18s %-11s %11s %12s %10s\n", "op", "dist", "n", "ns/op", "allocs/op");
+  for (int i = 0; i < cfg.dists.size(); ++i)
+  {
+    for (int j = 0; j < cfg.sizes.size(); ++j)
+    {
+      bench_map(cfg, cfg.dists[i], cfg.sizes[j]);
+      bench_sorts(cfg, cfg.dists[i], cfg.sizes[j]);
+    }
+  }
+  return 0;
+}
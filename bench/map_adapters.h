@@ -0,0 +1,252 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: map_adapters.h
+// DATE: Spring 2022
+// DESC: Map<K,V> implementations backed by std::map, std::unordered_map
+//       and a sorted std::vector, so standard containers can be driven
+//       through the same interface as BTreeMap when comparing them.
+//---------------------------------------------------------------------------
+
+#ifndef MAP_ADAPTERS_H
+#define MAP_ADAPTERS_H
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "../map.h"
+
+// Map backed by std::map (red-black tree)
+template <typename K, typename V>
+class StdMapAdapter final : public Map<K, V>
+{
+public:
+  int size() const { return static_cast<int>(m.size()); }
+  bool empty() const { return m.empty(); }
+  V &operator[](const K &key)
+  {
+    auto it = m.find(key);
+    if (it == m.end())
+      throw std::out_of_range("Key is not in the collection");
+    return it->second;
+  }
+  const V &operator[](const K &key) const
+  {
+    auto it = m.find(key);
+    if (it == m.end())
+      throw std::out_of_range("Key is not in the collection");
+    return it->second;
+  }
+  void insert(const K &key, const V &value) { m.emplace(key, value); }
+  void erase(const K &key)
+  {
+    if (m.erase(key) == 0)
+      throw std::out_of_range("Key is not in the collection");
+  }
+  bool contains(const K &key) const { return m.find(key) != m.end(); }
+  ArraySeq<K> find_keys(const K &k1, const K &k2) const
+  {
+    ArraySeq<K> keys;
+    for (auto it = m.lower_bound(k1); it != m.end() and it->first <= k2; ++it)
+      keys.push_back(it->first);
+    return keys;
+  }
+  ArraySeq<K> sorted_keys() const
+  {
+    ArraySeq<K> keys;
+    keys.reserve(size());
+    for (const auto &kv : m)
+      keys.push_back(kv.first);
+    return keys;
+  }
+  bool next_key(const K &key, K &next_key) const
+  {
+    auto it = m.upper_bound(key);
+    if (it == m.end())
+      return false;
+    next_key = it->first;
+    return true;
+  }
+  bool prev_key(const K &key, K &next_key) const
+  {
+    auto it = m.lower_bound(key);
+    if (it == m.begin())
+      return false;
+    next_key = (--it)->first;
+    return true;
+  }
+  void clear() { m.clear(); }
+
+private:
+  std::map<K, V> m;
+};
+
+// Map backed by std::unordered_map. Ordered operations have to scan
+// the whole table.
+template <typename K, typename V>
+class UnorderedMapAdapter final : public Map<K, V>
+{
+public:
+  int size() const { return static_cast<int>(m.size()); }
+  bool empty() const { return m.empty(); }
+  V &operator[](const K &key)
+  {
+    auto it = m.find(key);
+    if (it == m.end())
+      throw std::out_of_range("Key is not in the collection");
+    return it->second;
+  }
+  const V &operator[](const K &key) const
+  {
+    auto it = m.find(key);
+    if (it == m.end())
+      throw std::out_of_range("Key is not in the collection");
+    return it->second;
+  }
+  void insert(const K &key, const V &value) { m.emplace(key, value); }
+  void erase(const K &key)
+  {
+    if (m.erase(key) == 0)
+      throw std::out_of_range("Key is not in the collection");
+  }
+  bool contains(const K &key) const { return m.find(key) != m.end(); }
+  ArraySeq<K> find_keys(const K &k1, const K &k2) const
+  {
+    std::vector<K> found;
+    for (const auto &kv : m)
+      if (kv.first >= k1 and kv.first <= k2)
+        found.push_back(kv.first);
+    std::sort(found.begin(), found.end());
+    ArraySeq<K> keys;
+    keys.append(found.data(), static_cast<int>(found.size()));
+    return keys;
+  }
+  ArraySeq<K> sorted_keys() const
+  {
+    std::vector<K> found;
+    found.reserve(m.size());
+    for (const auto &kv : m)
+      found.push_back(kv.first);
+    std::sort(found.begin(), found.end());
+    ArraySeq<K> keys;
+    keys.append(found.data(), static_cast<int>(found.size()));
+    return keys;
+  }
+  bool next_key(const K &key, K &next_key) const
+  {
+    bool found = false;
+    for (const auto &kv : m)
+      if (kv.first > key and (!found or kv.first < next_key))
+      {
+        next_key = kv.first;
+        found = true;
+      }
+    return found;
+  }
+  bool prev_key(const K &key, K &next_key) const
+  {
+    bool found = false;
+    for (const auto &kv : m)
+      if (kv.first < key and (!found or kv.first > next_key))
+      {
+        next_key = kv.first;
+        found = true;
+      }
+    return found;
+  }
+  void clear() { m.clear(); }
+
+private:
+  std::unordered_map<K, V> m;
+};
+
+// Map stored as a vector of key-value pairs kept in key order. Lookups
+// are binary searches; inserts and erases shift the tail.
+template <typename K, typename V>
+class SortedVectorMap final : public Map<K, V>
+{
+public:
+  int size() const { return static_cast<int>(v.size()); }
+  bool empty() const { return v.empty(); }
+  V &operator[](const K &key)
+  {
+    auto it = lower_bound(key);
+    if (it == v.end() or it->first != key)
+      throw std::out_of_range("Key is not in the collection");
+    return it->second;
+  }
+  const V &operator[](const K &key) const
+  {
+    auto it = lower_bound(key);
+    if (it == v.end() or it->first != key)
+      throw std::out_of_range("Key is not in the collection");
+    return it->second;
+  }
+  void insert(const K &key, const V &value) { v.insert(lower_bound(key), {key, value}); }
+  void erase(const K &key)
+  {
+    auto it = lower_bound(key);
+    if (it == v.end() or it->first != key)
+      throw std::out_of_range("Key is not in the collection");
+    v.erase(it);
+  }
+  bool contains(const K &key) const
+  {
+    auto it = lower_bound(key);
+    return it != v.end() and it->first == key;
+  }
+  ArraySeq<K> find_keys(const K &k1, const K &k2) const
+  {
+    ArraySeq<K> keys;
+    for (auto it = lower_bound(k1); it != v.end() and it->first <= k2; ++it)
+      keys.push_back(it->first);
+    return keys;
+  }
+  ArraySeq<K> sorted_keys() const
+  {
+    ArraySeq<K> keys;
+    keys.reserve(size());
+    for (const auto &kv : v)
+      keys.push_back(kv.first);
+    return keys;
+  }
+  bool next_key(const K &key, K &next_key) const
+  {
+    auto it = std::upper_bound(v.begin(), v.end(), key,
+                               [](const K &k, const std::pair<K, V> &kv)
+                               { return k < kv.first; });
+    if (it == v.end())
+      return false;
+    next_key = it->first;
+    return true;
+  }
+  bool prev_key(const K &key, K &next_key) const
+  {
+    auto it = lower_bound(key);
+    if (it == v.begin())
+      return false;
+    next_key = (--it)->first;
+    return true;
+  }
+  void clear() { v.clear(); }
+
+private:
+  std::vector<std::pair<K, V>> v;
+
+  typename std::vector<std::pair<K, V>>::iterator lower_bound(const K &key)
+  {
+    return std::lower_bound(v.begin(), v.end(), key,
+                            [](const std::pair<K, V> &kv, const K &k)
+                            { return kv.first < k; });
+  }
+  typename std::vector<std::pair<K, V>>::const_iterator lower_bound(const K &key) const
+  {
+    return std::lower_bound(v.begin(), v.end(), key,
+                            [](const std::pair<K, V> &kv, const K &k)
+                            { return kv.first < k; });
+  }
+};
+
+#endif
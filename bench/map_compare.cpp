@@ -0,0 +1,427 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: map_compare.cpp
+// DATE: Spring 2022
+// DESC: Runs one operation trace against BTreeMap, std::map,
+//       std::unordered_map and a sorted vector and reports
+//       throughput, per-operation latency percentiles and peak
+//       resident memory for each. Calls go straight to each map type
+//       unless --dispatch virtual routes them through the Map<K,V>
+//       interface (via MapAdapter) to measure the dispatch cost.
+//
+// BUILD: g++ -std=c++17 -O2 -DNDEBUG -o map_compare map_compare.cpp
+//
+// USAGE: map_compare [--impl btree,map,unordered,sorted_vector]
+//                    [--preload N] [--ops N] [--dist D]
+//                    [--mix insert,lookup,contains,erase,range,next]
+//                    [--trace FILE] [--record FILE]
+//                    [--dispatch static|virtual]
+//        --mix gives integer weights for each operation type
+//        (default 20,45,20,5,5,5). --trace replays a recorded trace
+//        instead of generating one; --record saves the generated
+//        trace. Trace files have one operation per line:
+//          i KEY | l KEY | c KEY | e KEY | r KEY1 KEY2 | n KEY
+//        A trace must only insert absent keys and erase present keys
+//        (the Map contract). Each implementation runs in its own
+//        child process so peak RSS is measured separately.
+//---------------------------------------------------------------------------
+
+#include "bench_util.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../btreemap.h"
+#include "../maptraits.h"
+#include "map_adapters.h"
+
+using bench::Dist;
+using Key = std::int64_t;
+
+namespace
+{
+
+// operation types, in the order used by --mix
+const char op_codes[] = {'i', 'l', 'c', 'e', 'r', 'n'};
+const char *op_names[] = {"insert", "lookup", "contains", "erase", "range", "next"};
+const int op_types = 6;
+
+struct Op
+{
+  int type = 0;
+  Key k1 = 0;
+  Key k2 = 0;
+};
+
+struct Trace
+{
+  ArraySeq<Key> preload;
+  std::vector<Op> ops;
+};
+
+// Generates a valid trace: inserts use fresh keys, erases and lookups
+// use live keys (chosen with the requested distribution), contains
+// probes are half hits and half misses.
+Trace generate(Dist d, int preload, int count, const int mix[op_types])
+{
+  Trace trace;
+  std::mt19937_64 rng(1234);
+
+  // key source: the distribution's stream, deduplicated, followed by
+  // fresh keys for inserts beyond it
+  ArraySeq<Key> stream = bench::key_stream(d, preload + count);
+  std::vector<Key> live;
+  std::unordered_map<Key, int> position;
+  int next_fresh = 0;
+  Key fresh_base = 0;
+  for (int i = 0; i < stream.size(); ++i)
+    fresh_base = std::max(fresh_base, stream[i] + 1);
+  auto fresh_key = [&]()
+  {
+    while (next_fresh < stream.size())
+    {
+      Key k = stream.unchecked(next_fresh++);
+      if (position.find(k) == position.end())
+        return k;
+    }
+    return fresh_base++;
+  };
+  auto add_live = [&](Key k)
+  {
+    position[k] = static_cast<int>(live.size());
+    live.push_back(k);
+  };
+  auto remove_live = [&](int idx)
+  {
+    Key k = live[idx];
+    live[idx] = live.back();
+    position[live[idx]] = idx;
+    live.pop_back();
+    position.erase(k);
+  };
+
+  for (int i = 0; i < preload; ++i)
+  {
+    Key k = fresh_key();
+    trace.preload.push_back(k);
+    add_live(k);
+  }
+
+  bench::Zipf zipf(preload > 0 ? preload : 1, 0.99, 99);
+  auto pick_live = [&]()
+  {
+    std::uint64_t r = d == Dist::zipfian ? zipf.next() : rng();
+    return static_cast<int>(r % live.size());
+  };
+
+  int total = 0;
+  for (int t = 0; t < op_types; ++t)
+    total += mix[t];
+  trace.ops.reserve(count);
+  for (int i = 0; i < count; ++i)
+  {
+    int r = static_cast<int>(rng() % total), type = 0;
+    while (r >= mix[type])
+      r -= mix[type++];
+    // everything but insert needs live keys
+    if (live.empty())
+      type = 0;
+    Op op;
+    op.type = type;
+    if (type == 0)
+    {
+      op.k1 = fresh_key();
+      add_live(op.k1);
+    }
+    else if (type == 2 and rng() % 2)
+      op.k1 = -static_cast<Key>(rng() % (1 << 30)) - 1;
+    else
+    {
+      int idx = pick_live();
+      op.k1 = live[idx];
+      if (type == 3)
+        remove_live(idx);
+      else if (type == 4)
+        op.k2 = op.k1 + 1000;
+    }
+    trace.ops.push_back(op);
+  }
+  return trace;
+}
+
+bool load(const std::string &path, Trace &trace)
+{
+  std::ifstream in(path);
+  if (!in)
+    return false;
+  char code;
+  while (in >> code)
+  {
+    Op op;
+    op.type = -1;
+    for (int t = 0; t < op_types; ++t)
+      if (op_codes[t] == code)
+        op.type = t;
+    if (op.type < 0 or !(in >> op.k1))
+      return false;
+    if (op.type == 4 and !(in >> op.k2))
+      return false;
+    trace.ops.push_back(op);
+  }
+  return true;
+}
+
+bool save(const std::string &path, const Trace &trace)
+{
+  std::ofstream out(path);
+  for (int i = 0; i < trace.preload.size(); ++i)
+    out << "i " << trace.preload[i] << "\n";
+  for (std::size_t i = 0; i < trace.ops.size(); ++i)
+  {
+    const Op &op = trace.ops[i];
+    out << op_codes[op.type] << " " << op.k1;
+    if (op.type == 4)
+      out << " " << op.k2;
+    out << "\n";
+  }
+  return static_cast<bool>(out);
+}
+
+// returns the p-th percentile (0-100) of sorted latencies
+double percentile(const std::vector<float> &sorted, double p)
+{
+  if (sorted.empty())
+    return 0;
+  std::size_t idx = static_cast<std::size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+  return sorted[idx];
+}
+
+// runs the trace against the map and prints the results
+template <typename M>
+void replay(const char *name, M &map, const Trace &trace)
+{
+  static_assert(is_map<M, Key, Key>::value, "replay needs a map type");
+  bench::Timer timer;
+  for (int i = 0; i < trace.preload.size(); ++i)
+    map.insert(trace.preload.unchecked(i), trace.preload.unchecked(i));
+  double preload_ns = timer.ns();
+
+  std::vector<float> latency[op_types];
+  Key sink = 0;
+  int errors = 0;
+  bench::Timer total;
+  for (std::size_t i = 0; i < trace.ops.size(); ++i)
+  {
+    const Op &op = trace.ops[i];
+    bench::Timer t;
+    try
+    {
+      switch (op.type)
+      {
+      case 0:
+        map.insert(op.k1, op.k1);
+        break;
+      case 1:
+        sink += map[op.k1];
+        break;
+      case 2:
+        sink += map.contains(op.k1);
+        break;
+      case 3:
+        map.erase(op.k1);
+        break;
+      case 4:
+        sink += map.find_keys(op.k1, op.k2).size();
+        break;
+      case 5:
+      {
+        Key next = 0;
+        if (map.next_key(op.k1, next))
+          sink += next;
+        break;
+      }
+      }
+    }
+    catch (const std::out_of_range &)
+    {
+      ++errors;
+    }
+    latency[op.type].push_back(static_cast<float>(t.ns()));
+  }
+  double total_ns = total.ns();
+  bench::keep(sink);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  std::printf("== %s: %zu ops in %.1f ms (%.0f ops/s), preload %d keys in %.1f ms, "
+              "peak RSS %.1f MB, errors %d\n",
+              name, trace.ops.size(), total_ns / 1e6,
+              trace.ops.size() / (total_ns / 1e9), trace.preload.size(),
+              preload_ns / 1e6, usage.ru_maxrss / 1024.0, errors);
+  std::printf("   %-9s %10s %10s %10s %10s %10s\n", "op", "count", "p50 ns", "p99 ns",
+              "p999 ns", "max ns");
+  for (int t = 0; t < op_types; ++t)
+  {
+    if (latency[t].empty())
+      continue;
+    std::sort(latency[t].begin(), latency[t].end());
+    std::printf("   %-9s %10zu %10.0f %10.0f %10.0f %10.0f\n", op_names[t], latency[t].size(),
+                percentile(latency[t], 50), percentile(latency[t], 99),
+                percentile(latency[t], 99.9), latency[t].back());
+  }
+  std::fflush(stdout);
+}
+
+// replays the trace either directly or through the virtual interface
+template <typename M>
+void replay(const char *name, M &map, const Trace &trace, bool virtual_calls)
+{
+  if (virtual_calls)
+  {
+    MapAdapter<M, Key, Key> adapter(map);
+    replay<Map<Key, Key>>(name, adapter, trace);
+  }
+  else
+    replay(name, map, trace);
+}
+
+// runs one implementation in a child process
+bool run_impl(const std::string &impl, const Trace &trace, bool virtual_calls)
+{
+  pid_t pid = fork();
+  if (pid < 0)
+    return false;
+  if (pid == 0)
+  {
+    if (impl == "btree")
+    {
+      BTreeMap<Key, Key> map;
+      replay("BTreeMap", map, trace, virtual_calls);
+    }
+    else if (impl == "map")
+    {
+      StdMapAdapter<Key, Key> map;
+      replay("std::map", map, trace, virtual_calls);
+    }
+    else if (impl == "unordered")
+    {
+      UnorderedMapAdapter<Key, Key> map;
+      replay("std::unordered_map", map, trace, virtual_calls);
+    }
+    else if (impl == "sorted_vector")
+    {
+      SortedVectorMap<Key, Key> map;
+      replay("sorted vector", map, trace, virtual_calls);
+    }
+    else
+    {
+      std::cerr << "unknown implementation: " << impl << std::endl;
+      _exit(1);
+    }
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) and WEXITSTATUS(status) == 0;
+}
+
+ArraySeq<std::string> split_list(const std::string &arg)
+{
+  ArraySeq<std::string> items;
+  std::string item;
+  for (char c : arg)
+  {
+    if (c == ',')
+    {
+      items.push_back(item);
+      item.clear();
+    }
+    else
+      item += c;
+  }
+  items.push_back(item);
+  return items;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  ArraySeq<std::string> impls = split_list("btree,map,unordered,sorted_vector");
+  int preload = 100000, count = 1000000;
+  Dist dist = Dist::random;
+  int mix[op_types] = {20, 45, 20, 5, 5, 5};
+  std::string trace_path, record_path;
+  bool virtual_calls = false;
+
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    std::string arg = argv[i], value = argv[i + 1];
+    if (arg == "--impl")
+      impls = split_list(value);
+    else if (arg == "--preload")
+      preload = std::atoi(value.c_str());
+    else if (arg == "--ops")
+      count = std::atoi(value.c_str());
+    else if (arg == "--dist")
+    {
+      if (!bench::parse_dist(value, dist))
+      {
+        std::cerr << "unknown distribution: " << value << std::endl;
+        return 1;
+      }
+    }
+    else if (arg == "--mix")
+    {
+      ArraySeq<std::string> weights = split_list(value);
+      if (weights.size() != op_types)
+      {
+        std::cerr << "--mix needs " << op_types << " weights" << std::endl;
+        return 1;
+      }
+      for (int t = 0; t < op_types; ++t)
+        mix[t] = std::atoi(weights[t].c_str());
+    }
+    else if (arg == "--trace")
+      trace_path = value;
+    else if (arg == "--record")
+      record_path = value;
+    else if (arg == "--dispatch" and (value == "static" or value == "virtual"))
+      virtual_calls = value == "virtual";
+    else
+    {
+      std::cerr << "unknown option: " << arg << std::endl;
+      return 1;
+    }
+  }
+
+  Trace trace;
+  if (!trace_path.empty())
+  {
+    if (!load(trace_path, trace))
+    {
+      std::cerr << "could not read trace " << trace_path << std::endl;
+      return 1;
+    }
+  }
+  else
+    trace = generate(dist, preload, count, mix);
+  if (!record_path.empty() and !save(record_path, trace))
+  {
+    std::cerr << "could not write trace " << record_path << std::endl;
+    return 1;
+  }
+
+  bool ok = true;
+  for (int i = 0; i < impls.size(); ++i)
+    ok = run_impl(impls[i], trace, virtual_calls) and ok;
+  return ok ? 0 : 1;
+}
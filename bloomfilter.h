@@ -0,0 +1,142 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: bloomfilter.h
+// DATE: Spring 2022
+// DESC: Blocked Bloom filter. Answers "might this key have been
+//       added?" with no false negatives and a small rate of false
+//       positives (about 1% at 10 bits per key). All of the bits for a
+//       key fall in one 64 byte block, so a test touches a single cache
+//       line. Keys can be added but not removed; a filter that has seen
+//       too many removed keys is rebuilt by its owner.
+//---------------------------------------------------------------------------
+
+#ifndef BLOOMFILTER_H
+#define BLOOMFILTER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// True if std::hash<K> is usable (only such keys can be filtered)
+template <typename K, typename = void>
+struct is_bloom_hashable : std::false_type
+{
+};
+
+template <typename K>
+struct is_bloom_hashable<
+    K, std::void_t<decltype(std::hash<K>{}(std::declval<const K &>()))>> : std::true_type
+{
+};
+
+template <typename K>
+class BloomFilter
+{
+public:
+  // Sizes the filter for about expected keys at bits_per_key bits each
+  // (more keys than that raise the false positive rate)
+  explicit BloomFilter(int expected = 0, int bits_per_key = 10);
+
+  // Adds the key to the filter
+  void add(const K &key);
+
+  // Returns false if the key was definitely never added
+  bool might_contain(const K &key) const;
+
+  // Removes every key
+  void clear();
+
+  // Number of keys the filter was sized for, and number added since it
+  // was built or cleared
+  int capacity() const { return expected; }
+  int added() const { return count; }
+
+  // Memory used by the bits
+  long long bytes() const { return static_cast<long long>(words.size()) * sizeof(std::uint64_t); }
+
+private:
+  // 512 bit blocks
+  static const int block_words = 8;
+
+  std::vector<std::uint64_t> words;
+  std::uint64_t blocks = 1;
+  int probes = 1;
+  int expected = 0;
+  int count = 0;
+
+  // first word of the key's block, and the hash its bits come from
+  std::size_t block(std::uint64_t h) const
+  {
+    return static_cast<std::size_t>(((h >> 32) * blocks) >> 32) * block_words;
+  }
+  static std::uint64_t hash(const K &key)
+  {
+    // std::hash is the identity for integers, so mix the bits
+    std::uint64_t h = std::hash<K>{}(key);
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    return h ^ (h >> 31);
+  }
+  // the next probe's bit within the block (0..511)
+  static int next_bit(std::uint64_t &g)
+  {
+    g = (g ^ (g >> 29)) * 0x9E3779B97F4A7C15ULL;
+    return static_cast<int>(g >> 55);
+  }
+};
+
+template <typename K>
+BloomFilter<K>::BloomFilter(int expected, int bits_per_key) : expected(expected)
+{
+  if (bits_per_key < 1)
+  {
+    bits_per_key = 1;
+  }
+  // k = bits_per_key * ln 2 probes minimizes the false positive rate
+  probes = (bits_per_key * 69 + 50) / 100;
+  probes = probes < 1 ? 1 : probes > 16 ? 16 : probes;
+  long long bits = static_cast<long long>(expected) * bits_per_key;
+  blocks = bits / (64 * block_words) + 1;
+  words.assign(blocks * block_words, 0);
+}
+
+template <typename K>
+void BloomFilter<K>::add(const K &key)
+{
+  std::uint64_t g = hash(key);
+  std::uint64_t *w = words.data() + block(g);
+  for (int i = 0; i < probes; ++i)
+  {
+    int bit = next_bit(g);
+    w[bit >> 6] |= std::uint64_t(1) << (bit & 63);
+  }
+  ++count;
+}
+
+template <typename K>
+bool BloomFilter<K>::might_contain(const K &key) const
+{
+  std::uint64_t g = hash(key);
+  const std::uint64_t *w = words.data() + block(g);
+  for (int i = 0; i < probes; ++i)
+  {
+    int bit = next_bit(g);
+    if (!(w[bit >> 6] & (std::uint64_t(1) << (bit & 63))))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename K>
+void BloomFilter<K>::clear()
+{
+  std::fill(words.begin(), words.end(), 0);
+  count = 0;
+}
+
+#endif
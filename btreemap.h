@@ -3,18 +3,138 @@
 // FILE: btreemap.h
 // DATE: Spring 2022
 // DESC: Map implementation using a 2-3-4 B-Tree
-// NOTE: ERASE DOES NOT WORK TO SCALE... unfortunately (there is a bug in case 3b)
 //---------------------------------------------------------------------------
 
 #ifndef BTreeMAP_H
 #define BTreeMAP_H
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include "map.h"
 #include "arrayseq.h"
+#include "bloomfilter.h"
+#include "smallarrayseq.h"
+#include "threadpool.h"
+
+// Shape of a tree as reported by BTreeMap::stats()
+struct BTreeStats
+{
+  // number of levels (0 for an empty tree)
+  int height = 0;
+
+  // number of nodes (and how many of them are leaves)
+  long long nodes = 0;
+  long long leaves = 0;
+
+  // number of key-value pairs
+  long long keys = 0;
+
+  // fill[i] == number of nodes holding i keys (i = 0..3)
+  long long fill[4] = {0, 0, 0, 0};
+
+  // average keys per node divided by the maximum (3)
+  double fill_factor = 0;
+
+  // memory used by the nodes, including any key or child arrays that
+  // spilled to the heap
+  long long bytes = 0;
+};
+
+// Operations tracked separately by the BTREEMAP_STATS counters
+enum class BTreeOp
+{
+  other,
+  insert,
+  erase,
+  lookup,
+  contains,
+  find_keys,
+  sorted_keys,
+  next_key,
+  prev_key,
+  copy,
+  clear,
+  bulk,
+  count_
+};
+
+// Work done by the calls of one operation type (BTREEMAP_STATS only)
+struct BTreeOpCounters
+{
+  long long calls = 0;
+  long long node_visits = 0;
+  long long comparisons = 0;
+  long long splits = 0;
+  long long merges = 0;
+  long long borrows = 0;
+  long long allocations = 0;
+  long long frees = 0;
+};
+
+inline const char *btree_op_name(BTreeOp op)
+{
+  static const char *names[] = {"other", "insert", "erase", "lookup", "contains",
+                                "find_keys", "sorted_keys", "next_key", "prev_key",
+                                "copy", "clear", "bulk"};
+  return names[static_cast<int>(op)];
+}
+
+// Compile with -DBTREEMAP_STATS to count the work done by each
+// operation. Without it the counting macros expand to nothing and the
+// counters do not exist.
+#ifdef BTREEMAP_STATS
+#define BTREE_OP(op) OpScope btree_op_scope_(this, BTreeOp::op)
+#define BTREE_COUNT(field) tally(&BTreeOpCounters::field)
+#else
+#define BTREE_OP(op) ((void)0)
+#define BTREE_COUNT(field) ((void)0)
+#endif
+
+// Asks the hardware to start loading the cache line at addr, which is
+// about to be read. Expands to nothing on compilers without
+// __builtin_prefetch, or with -DBTREEMAP_NO_PREFETCH (to measure what
+// prefetching buys).
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(BTREEMAP_NO_PREFETCH)
+#define BTREE_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define BTREE_PREFETCH(addr) ((void)0)
+#endif
+
+// Stored in the nodes in place of std::pair<K, V> when V is an empty
+// type (such as BTreeSet's value), so those nodes hold nothing but
+// keys. Converts to and from the pair; every entry shares the one
+// (stateless) value.
+template <typename K, typename V>
+struct BTreeKeyOnly
+{
+  K first;
+  static inline V second{};
+
+  BTreeKeyOnly() = default;
+  BTreeKeyOnly(const K &key, const V &) : first(key) {}
+  BTreeKeyOnly(const std::pair<K, V> &p) : first(p.first) {}
+  BTreeKeyOnly(std::pair<K, V> &&p) : first(std::move(p.first)) {}
+  operator std::pair<K, V>() const & { return {first, second}; }
+  operator std::pair<K, V>() && { return {std::move(first), second}; }
+};
+
+template <typename K, typename V>
+class FrozenBTreeMap;
 
 template <typename K, typename V>
-class BTreeMap : public Map<K, V>
+class BTreeMap final : public Map<K, V>
 {
+  struct Node;
+
 public:
   // default constructor
   BTreeMap();
@@ -48,10 +168,68 @@ public:
   // given key is not in the collection.
   const V &operator[](const K &key) const;
 
-  // Extends the collection by adding the given key-value pair.
-  // Expects key to not exist in map prior to insertion.
+  // Extends the collection by adding the given key-value pair. If key
+  // is already in the map its value is replaced instead (the same as
+  // insert_or_assign, without the result).
   void insert(const K &key, const V &value);
 
+  // Non-throwing lookups. find returns a pointer to the value for key,
+  // or nullptr if key is not in the collection; get_or returns a copy
+  // of the value, or fallback.
+  V *find(const K &key);
+  const V *find(const K &key) const;
+  V get_or(const K &key, const V &fallback) const;
+
+  // Inserts the pair, or assigns value if key is already present.
+  // Returns true if the pair was inserted. One descent either way.
+  bool insert_or_assign(const K &key, const V &value);
+
+  // Inserts (key, init) if key is not present, and otherwise calls
+  // update(value) on the existing value. Returns true if the pair was
+  // inserted. One descent either way.
+  template <typename F>
+  bool upsert(const K &key, const V &init, F update);
+
+  // Removes the key-value pair with the given key. Returns false
+  // (instead of throwing) if the key is not in the collection.
+  bool try_erase(const K &key);
+
+  // Position hint for inserts and lookups that land near each other.
+  // A cursor remembers the leaf its last operation reached and the
+  // range of keys that leaf covers; a hinted operation on a key in
+  // that range starts at the leaf instead of the root. Any change to
+  // the shape of the tree (a split, an erase, clear, ...) sends the
+  // next hinted operation back to the root. A cursor must not outlive
+  // its map. (Plain insert keeps its own cursor on the rightmost leaf,
+  // so appending ascending keys skips the descent too.)
+  class Cursor
+  {
+    friend class BTreeMap;
+    const BTreeMap *map = nullptr;
+    Node *leaf = nullptr;
+    K lo, hi;
+    bool has_lo = false, has_hi = false;
+    unsigned long long version = 0;
+  };
+
+  // Hinted versions of insert, contains and operator[] (at throws
+  // out_of_range if the key is not in the collection). Like plain
+  // insert, the hinted insert replaces the value of a key already in
+  // the map. Each one leaves the hint at the leaf it reached.
+  void insert(const K &key, const V &value, Cursor &hint);
+  bool contains(const K &key, Cursor &hint) const;
+  V &at(const K &key, Cursor &hint);
+
+  // Batched lookups of the n keys starting at keys: found[j] is set to
+  // whether keys[j] is in the collection, or values[j] to its value
+  // (nullptr if it is not). The descents of a group of keys advance
+  // one level at a time, each prefetching its next node, so the cache
+  // misses of the group overlap instead of being paid one after
+  // another. Much faster than n single lookups once the tree is
+  // larger than the cache.
+  void contains(const K *keys, int n, bool *found) const;
+  void find(const K *keys, int n, V **values);
+
   // Shrinks the collection by removing the key-value pair with the
   // given key. Does not modify the collection if the collection does
   // not contain the key. Throws out_of_range if the given key is not
@@ -80,35 +258,362 @@ public:
   // Removes all key-value pairs from the map.
   void clear();
 
-  // Returns the height of the binary search tree
+  // Parallel versions of copy assignment, clear() and sorted_keys().
+  // Subtrees of at least parallel_levels levels are handed to the
+  // pool's workers; smaller trees are handled on the calling thread.
+  // sorted_keys sizes the top subtrees first so each one writes its
+  // keys straight into its own slice of the result. With
+  // BTREEMAP_STATS defined these run sequentially so the counters stay
+  // exact.
+  void assign(const BTreeMap &rhs, ThreadPool &pool);
+  void clear(ThreadPool &pool);
+  ArraySeq<K> sorted_keys(ThreadPool &pool) const;
+
+  // Parallel find_keys. The range is split along the children of the
+  // top levels of the tree and the pieces are scanned concurrently.
+  // The first version returns the keys k1 <= k <= k2 in ascending
+  // order (each piece fills its own buffer and the buffers are joined
+  // in order). The second calls f(key) for each of those keys in no
+  // particular order, from several threads at once, so f must be
+  // thread safe.
+  ArraySeq<K> find_keys(const K &k1, const K &k2, ThreadPool &pool) const;
+  template <typename F>
+  void find_keys(const K &k1, const K &k2, ThreadPool &pool, F f) const;
+
+  // Returns the key-value pairs in ascending key order (all of them,
+  // or those with k1 <= key <= k2)
+  ArraySeq<std::pair<K, V>> sorted_pairs() const;
+  ArraySeq<std::pair<K, V>> find_pairs(const K &k1, const K &k2) const;
+
+  // Replaces the contents of the map with the n pairs starting at
+  // pairs, which must be in strictly ascending key order (throws
+  // invalid_argument otherwise). Builds the tree bottom up in O(n)
+  // instead of inserting the pairs one at a time.
+  void assign_sorted(const std::pair<K, V> *pairs, int n);
+
+  // Set algebra with another map. Each merges the sorted pairs of
+  // both maps and rebuilds the tree bottom up, O(m + n) in total; when
+  // rhs is much smaller than this map it falls back to a point lookup
+  // per key of rhs, O(m log n), instead.
+  //  - unite adds the pairs of rhs whose keys are not in this map; the
+  //    second version also calls combine(value, rhs_value) for every
+  //    key in both maps so the values can be merged
+  //  - intersect removes the keys that are not in rhs
+  //  - subtract removes the keys that are in rhs
+  void unite(const BTreeMap &rhs);
+  template <typename F>
+  void unite(const BTreeMap &rhs, F combine);
+  void intersect(const BTreeMap &rhs);
+  void subtract(const BTreeMap &rhs);
+
+  // Moves the pairs with keys >= key into a new map and returns it,
+  // leaving the smaller keys in this map. Cuts the tree along the
+  // search path for key and rejoins the pieces on each side, O(log n)
+  // node operations, then counts the keys of the smaller piece so both
+  // sizes stay exact: O(log n + m) in all, where m is the number of
+  // keys on the smaller side. This map keeps its filter (it still
+  // holds every remaining key); the new map starts without one.
+  BTreeMap split_at(const K &key);
+
+  // Moves every pair of other into this map and leaves other empty.
+  // All keys of other must be greater than all keys of this map, or
+  // all smaller; throws invalid_argument if the key ranges overlap.
+  // Takes O(log n) node operations. This map's filter has not seen
+  // the keys of other, so lookups skip it until the next insert or
+  // erase rebuilds it; other keeps its own filter and cache.
+  void join(BTreeMap &other);
+
+  // Optional Bloom filter in front of the lookups. With it enabled,
+  // contains, operator[], find and get_or report most missing keys
+  // without descending the tree (at 10 bits per key about 1% of the
+  // misses still descend). Every insert adds to the filter, which is
+  // regrown as the map grows and rebuilt from the tree after many
+  // erases (it cannot forget a key) and after the bulk operations
+  // (after join, by the next insert or erase; see join()).
+  // Copies and moves of the map carry the filter with them. Needs
+  // std::hash<K>.
+  void enable_filter(int bits_per_key = 10);
+  void disable_filter();
+  bool has_filter() const { return filter != nullptr; }
+
+  // Optional direct-mapped cache of recently found keys in front of
+  // the lookups (with a skewed key distribution most lookups hit the
+  // cache). A hit costs one hash and one probe: the slot remembers the
+  // node and position the key was found at, which is checked to still
+  // hold the key. Any erase, clear, split_at, join or bulk rebuild
+  // (anything that may free nodes) empties the cache. entries is
+  // rounded up to a power of two. The const lookups update the cache
+  // through atomic slots, so several threads may read the map at once
+  // (as with any map, not while another thread changes it). Needs
+  // std::hash<K>.
+  void enable_cache(int entries = 4096);
+  void disable_cache();
+  bool has_cache() const { return cache != nullptr; }
+
+  // Returns a read-only copy of the map in a compact pointer-free
+  // layout that is faster to search (include frozenbtreemap.h to use)
+  FrozenBTreeMap<K, V> freeze() const;
+
+  // Returns the height of the tree (number of levels). Tracked as the
+  // tree grows and shrinks at the root, so this is O(1).
   int height() const;
 
+  // Checks the structural invariants of the tree in one pass: keys in
+  // strictly ascending order, every node holding 1 to 3 keys (and
+  // keys + 1 children unless it is a leaf), all leaves at depth
+  // height(), and size() matching the number of keys. Throws
+  // logic_error describing the first violation found.
+  void validate() const;
+
   // for debugging the tree
   void print() const
   {
     print("  ", root, height());
   }
 
+  // Walks the tree and reports its shape and memory use
+  BTreeStats stats() const;
+
+#ifdef BTREEMAP_STATS
+  // Work counted for the given operation type since construction or
+  // the last reset_counters()
+  BTreeOpCounters counters(BTreeOp op) const
+  {
+    std::lock_guard<std::mutex> lock(op_counters_mutex);
+    return op_counters[static_cast<int>(op)];
+  }
+
+  // Zeroes all of the operation counters
+  void reset_counters()
+  {
+    std::lock_guard<std::mutex> lock(op_counters_mutex);
+    for (BTreeOpCounters &c : op_counters)
+      c = BTreeOpCounters();
+  }
+#endif
+
 private:
-  // node for 2-3-4 tree
+  // what a node stores per key: the pair, or only the key when the
+  // value type is empty
+  using Entry = typename std::conditional<std::is_empty<V>::value, BTreeKeyOnly<K, V>,
+                                          std::pair<K, V>>::type;
+
+  // node for 2-3-4 tree (keys and children are stored inline in the
+  // node, so building a node does not allocate beyond the node itself)
   struct Node
   {
-    ArraySeq<std::pair<K, V>> keyvals;
-    ArraySeq<Node *> children;
+    SmallArraySeq<Entry, 3> keyvals;
+    SmallArraySeq<Node *, 4> children;
     // helper functions
     bool full() const { return keyvals.size() == 3; }
     bool leaf() const { return children.empty(); }
-    K key(int i) const { return keyvals[i].first; }
-    V &val(int i) { return keyvals[i].second; }
-    Node *child(int i) const { return children[i]; }
+    const K &key(int i) const { return keyvals.unchecked(i).first; }
+    V &val(int i) { return keyvals.unchecked(i).second; }
+    Node *child(int i) const { return children.unchecked(i); }
   };
 
   // number of key-value pairs in map
   int count = 0;
 
+  // number of levels in the tree (0 when empty)
+  int tree_levels = 0;
+
   // root node
   Node *root = nullptr;
 
+  // changes whenever the shape of the tree does (invalidates cursors)
+  unsigned long long version = 0;
+
+  // cursor on the rightmost leaf used by plain insert
+  Cursor tail;
+
+  // optional Bloom filter over the keys, its bits per key, the
+  // number of keys erased since it was last rebuilt, and whether keys
+  // are missing from it (after join), which turns it off until the
+  // next insert or erase rebuilds it
+  std::unique_ptr<BloomFilter<K>> filter;
+  int filter_bits = 10;
+  int filter_erased = 0;
+  bool filter_stale = false;
+
+  // filter helpers: filtered_out is true if key is certainly not in
+  // the map; filter_insert and filter_erase record a change and
+  // rebuild the filter when it has grown too full or too stale;
+  // filter_rebuild refills it from the tree
+  bool filtered_out(const K &key) const
+  {
+    if constexpr (is_bloom_hashable<K>::value)
+      return filter != nullptr and !filter_stale and !filter->might_contain(key);
+    else
+      return false;
+  }
+  void filter_insert(const K &key);
+  void filter_erase();
+  void filter_joined();
+  void filter_rebuild();
+
+  // one slot of the lookup cache: where a key was found, valid while
+  // epoch == cache_epoch. The const lookups of several threads may
+  // fill the same slot, so the node, the index and the used bit are
+  // packed into one atomic word (nodes are 8-byte aligned and the
+  // index is at most 2, which leaves the low 3 bits free). entry is
+  // written before epoch is released, and read after epoch is
+  // acquired, so a slot of the current epoch never shows an entry of
+  // an earlier one.
+  struct CacheSlot
+  {
+    std::atomic<std::uintptr_t> entry{0};
+    std::atomic<unsigned long long> epoch{0};
+  };
+  static_assert(alignof(Node) >= 8, "cache entries need the low 3 bits of a Node pointer");
+
+  // cache helpers: pack and unpack a slot's entry
+  static std::uintptr_t cache_entry(Node *node, int index, bool used)
+  {
+    return reinterpret_cast<std::uintptr_t>(node) | static_cast<std::uintptr_t>(index) << 1 |
+           static_cast<std::uintptr_t>(used);
+  }
+  static Node *entry_node(std::uintptr_t entry)
+  {
+    return reinterpret_cast<Node *>(entry & ~static_cast<std::uintptr_t>(7));
+  }
+  static int entry_index(std::uintptr_t entry) { return static_cast<int>(entry >> 1 & 3); }
+  static bool entry_used(std::uintptr_t entry) { return entry & 1; }
+
+  // the lookup cache (1 << cache_bits slots) and its epoch, which is
+  // bumped whenever nodes may be freed so no stale slot is followed
+  mutable std::unique_ptr<CacheSlot[]> cache;
+  int cache_bits = 0;
+  unsigned long long cache_epoch = 1;
+
+  // cache helper: the slot key maps to
+  CacheSlot &cache_slot(const K &key) const
+  {
+    std::uint64_t h = std::hash<K>{}(key) * 0x9E3779B97F4A7C15ULL;
+    return cache[cache_bits == 0 ? 0 : h >> (64 - cache_bits)];
+  }
+
+  // lookup helper for the public lookups: the cache, then the filter,
+  // then a descent (whose result is cached)
+  Node *lookup(const K &key, int &i) const;
+
+  // cursor helpers: covers is true if the hint's leaf is current and
+  // holds the range key falls in; record points the hint at a leaf
+  // whose keys lie strictly between lo and hi (nullptr if unbounded)
+  bool covers(const Cursor &hint, const K &key) const
+  {
+    return hint.map == this and hint.version == version and hint.leaf != nullptr and
+           (!hint.has_lo or hint.lo < key) and (!hint.has_hi or key < hint.hi);
+  }
+  void record(Cursor &hint, Node *leaf, const K *lo, const K *hi) const;
+
+  // insert helpers: place starts at the hint's leaf when it covers key
+  // and has room (leaf_insert), and otherwise inserts from the root
+  // (insert_descent), splitting full nodes on the way down, and
+  // records the leaf reached in the hint
+  // (the tail cursor only records the rightmost leaf)
+  // All three return the value slot for key and set inserted to false,
+  // without touching the value, if key was already present.
+  V *place(const K &key, const V &value, Cursor &hint, bool &inserted);
+  V *leaf_insert(Node *leaf, const K &key, const V &value, bool &inserted);
+  V *insert_descent(const K &key, const V &value, Cursor *hint, bool &inserted);
+
+  // The search primitives every lookup goes through. search_node
+  // returns the first slot of the node whose key is > key (Upper) or
+  // >= key (!Upper); it is the only place keys are compared during a
+  // descent. descend walks down from st_root, calling step(node, slot)
+  // at each node on the search path (so the calls trace out the path)
+  // and following child(slot) until step returns false or a leaf has
+  // been visited.
+  template <bool Upper>
+  int search_node(const Node *node, const K &key) const;
+  template <bool Upper, typename Step>
+  void descend(Node *st_root, const K &key, Step &&step) const;
+
+  // Batched version of locate: calls hit(j, node, i) for each of the
+  // n keys found, descending for batch_group keys at a time
+  static const int batch_group = 8;
+  template <typename Hit>
+  void locate(const K *keys, int n, Hit &&hit) const;
+
+  // starts loading a node that is about to be visited (the key array
+  // comes first, so at most the first four cache lines are fetched)
+  static void prefetch(const Node *node)
+  {
+    const char *p = reinterpret_cast<const char *>(node);
+    for (std::size_t line = 0; line < sizeof(Node) and line < 256; line += 64)
+      BTREE_PREFETCH(p + line);
+  }
+
+  // lookup helper: returns the node holding key (and its index in i),
+  // or nullptr
+  Node *locate(const K &key, int &i) const;
+
+  // hinted lookup helper: returns the node holding key (and its index
+  // in i), or nullptr
+  Node *find_node(const K &key, Cursor &hint, int &i) const;
+
+#ifdef BTREEMAP_STATS
+  // per operation counters. Const calls may run on several threads at
+  // once, so each call counts into its own thread's counters and adds
+  // them here, under the mutex, when it returns.
+  mutable BTreeOpCounters op_counters[static_cast<int>(BTreeOp::count_)];
+  mutable std::mutex op_counters_mutex;
+
+  // the counters of this thread's outermost public call, or nullptr
+  // outside of one (nested calls, on this map or another, count
+  // towards the outer operation)
+  static inline thread_local BTreeOpCounters *current_op = nullptr;
+
+  // counts one unit of work; work done outside of a public call (by
+  // pool threads, say) counts as BTreeOp::other
+  void tally(long long BTreeOpCounters::*field) const
+  {
+    if (current_op)
+    {
+      ++(current_op->*field);
+      return;
+    }
+    std::lock_guard<std::mutex> lock(op_counters_mutex);
+    ++(op_counters[static_cast<int>(BTreeOp::other)].*field);
+  }
+
+  // points current_op at a call's counters for its duration, and adds
+  // them to the map's when the outermost call returns
+  struct OpScope
+  {
+    const BTreeMap *map;
+    BTreeOp op;
+    BTreeOpCounters work;
+    bool outer;
+    OpScope(const BTreeMap *map, BTreeOp op) : map(map), op(op), outer(current_op == nullptr)
+    {
+      if (outer)
+        current_op = &work;
+      current_op->calls++;
+    }
+    ~OpScope()
+    {
+      if (!outer)
+        return;
+      current_op = nullptr;
+      std::lock_guard<std::mutex> lock(map->op_counters_mutex);
+      BTreeOpCounters &c = map->op_counters[static_cast<int>(op)];
+      c.calls += work.calls;
+      c.node_visits += work.node_visits;
+      c.comparisons += work.comparisons;
+      c.splits += work.splits;
+      c.merges += work.merges;
+      c.borrows += work.borrows;
+      c.allocations += work.allocations;
+      c.frees += work.frees;
+    }
+  };
+#endif
+
+  // stats helper
+  void stats(const Node *st_root, int depth, BTreeStats &st) const;
+
   // print helper function
   void print(std::string indent, Node *st_root, int levels) const;
 
@@ -118,23 +623,89 @@ private:
   // helper function for copy assignment
   Node *copy(const Node *rhs_st_root) const;
 
+  // subtrees shorter than this are not split up any further by the
+  // parallel bulk operations (a subtree this tall holds at least 255
+  // keys, and usually thousands)
+  static const int parallel_levels = 8;
+
+  // parallel copy and clear helpers (levels == height of the subtree)
+  Node *copy(const Node *rhs_st_root, int levels, TaskGroup &tasks) const;
+  void clear(Node *st_root, int levels, TaskGroup &tasks);
+
+  // parallel sorted_keys helpers: the top of the tree is cut into
+  // subtrees below parallel_levels and the separator keys between
+  // them, in key order (index < 0 marks a whole subtree, otherwise the
+  // part is the node's index-th key)
+  struct Part
+  {
+    const Node *node;
+    int index;
+  };
+  void cut(const Node *st_root, int levels, std::vector<Part> &parts) const;
+  static int subtree_size(const Node *st_root);
+  static K *write_keys(const Node *st_root, K *out);
+
+  // bulk build helpers: the smallest height that can hold n keys, a
+  // subtree of the given height built from n pairs (moved from the
+  // array), and an in-order walk calling f(pair) for every pair
+  static int build_levels(int n);
+  Node *build(std::pair<K, V> *pairs, int n, int levels);
+  void rebuild(ArraySeq<std::pair<K, V>> &pairs);
+  template <typename N, typename F>
+  static void for_each_pair(N *st_root, F &f);
+
+  // split/join helpers. join3 joins l (of height hl), the pair and r
+  // (of height hr), where every key of l < pair < every key of r, and
+  // gives the height of the result in h. split_tree cuts a subtree of
+  // height h into the keys below key (l) and the rest (r).
+  // smaller_size walks two trees in step and returns the number of
+  // keys in whichever is smaller (a_smaller tells which), so it costs
+  // O(size of the smaller tree).
+  Node *join3(Node *l, int hl, Entry &kv, Node *r, int hr, int &h);
+  void split_tree(Node *st_root, int h, const K &key, Node *&l, int &hl, Node *&r, int &hr);
+  static int smaller_size(const Node *a, const Node *b, bool &a_smaller);
+
+  // true if operating on rhs key by key is cheaper than merging
+  bool point_ops(const BTreeMap &rhs) const
+  {
+    return static_cast<long long>(rhs.count) * (tree_levels + 1) < count;
+  }
+
+  // parallel find_keys helpers: cut_range lists the parts of the
+  // subtree that overlap [k1, k2], and scan_range calls visit(node, i)
+  // for each key of a subtree in [k1, k2], in order, skipping the
+  // children that lie outside the range (scan_keys calls emit(key))
+  void cut_range(const Node *st_root, int levels, const K &k1, const K &k2,
+                 std::vector<Part> &parts) const;
+  template <typename F>
+  static void scan_range(const Node *st_root, const K &k1, const K &k2, F &visit);
+  template <typename F>
+  static void scan_keys(const Node *st_root, const K &k1, const K &k2, F &emit)
+  {
+    auto visit = [&emit](const Node *node, int i) { emit(node->key(i)); };
+    scan_range(st_root, k1, k2, visit);
+  }
+
   // split the parent's i-th child
   void split(Node *parent, int i);
 
-  // erase helpers
-  void erase(Node *st_root, const K &key);
-  void remove_internal(Node *st_root, int key_idx);
-  void rebalance(Node *st_root, int key_idx, int &child_idx);
+  // merge the parent's i-th and (i+1)-th children around the i-th key
+  void merge(Node *parent, int i);
 
-  // find_keys helper
-  void find_keys(const K &k1, const K &k2, const Node *st_root,
-                 ArraySeq<K> &keys) const;
+  // erase helpers (rebalance returns the index of the child to descend
+  // into, which moves left if the child was merged into its left
+  // neighbor)
+  bool erase(Node *st_root, const K &key);
+  bool detach(const K &key);
+  void remove_internal(Node *st_root, int key_idx);
+  int rebalance(Node *st_root, int child_idx);
 
   // sorted_keys helper
   void sorted_keys(const Node *st_root, ArraySeq<K> &keys) const;
 
-  // height helper
-  int height(const Node *st_root) const;
+  // validate helper (lo/hi bound the keys allowed in the subtree)
+  void validate(const Node *st_root, int depth, const K *lo, const K *hi,
+                long long &keys) const;
 };
 
 template <typename K, typename V>
@@ -189,8 +760,17 @@ BTreeMap<K, V> &BTreeMap<K, V>::operator=(const BTreeMap &rhs)
   if (this != &rhs)
   {
     clear();
+    BTREE_OP(copy);
     root = copy(rhs.root);
     count = rhs.count;
+    tree_levels = rhs.tree_levels;
+    filter.reset(rhs.filter != nullptr ? new BloomFilter<K>(*rhs.filter) : nullptr);
+    filter_bits = rhs.filter_bits;
+    filter_erased = rhs.filter_erased;
+    filter_stale = rhs.filter_stale;
+    // an empty cache of the same size (rhs's slots point into rhs)
+    cache.reset(rhs.cache != nullptr ? new CacheSlot[std::size_t(1) << rhs.cache_bits] : nullptr);
+    cache_bits = rhs.cache_bits;
   }
   return *this;
 }
@@ -204,9 +784,23 @@ BTreeMap<K, V> &BTreeMap<K, V>::operator=(BTreeMap &&rhs)
     clear();
     root = rhs.root;
     count = rhs.count;
+    tree_levels = rhs.tree_levels;
+    filter = std::move(rhs.filter);
+    filter_bits = rhs.filter_bits;
+    filter_erased = rhs.filter_erased;
+    filter_stale = rhs.filter_stale;
+    // the moved slots count as stale under an epoch past both maps'
+    cache = std::move(rhs.cache);
+    cache_bits = rhs.cache_bits;
+    cache_epoch = (cache_epoch > rhs.cache_epoch ? cache_epoch : rhs.cache_epoch) + 1;
 
     rhs.root = nullptr;
     rhs.count = 0;
+    rhs.tree_levels = 0;
+    rhs.filter_erased = 0;
+    rhs.filter_stale = false;
+    rhs.version++;
+    rhs.cache_epoch++;
   }
   return *this;
 }
@@ -241,51 +835,14 @@ bool BTreeMap<K, V>::empty() const
 template <typename K, typename V>
 V &BTreeMap<K, V>::operator[](const K &key)
 {
-  Node *traverse = root;
-  Node *searchNext = nullptr;
-  int m = 0;
-  while (traverse != nullptr)
+  BTREE_OP(lookup);
+  int i = 0;
+  Node *node = lookup(key, i);
+  if (node == nullptr)
   {
-    // m == the # of keys in node
-    m = traverse->keyvals.size();
-
-    // search keys from 0 to m-1
-    for (int i = 0; i < m; ++i)
-    {
-      if (key < traverse->key(i))
-      {
-        if (traverse->leaf())
-        {
-          searchNext = nullptr;
-        }
-        else
-        {
-          searchNext = traverse->child(i);
-          break;
-        }
-      }
-      else if (key == traverse->key(i))
-      {
-        return traverse->val(i);
-      }
-    }
-
-    // search next child if necessary
-    if (key > traverse->key(m - 1))
-    {
-      if (traverse->leaf())
-      {
-        searchNext = nullptr;
-      }
-      else
-      {
-        searchNext = traverse->child(m);
-      }
-    }
-    traverse = searchNext;
+    throw std::out_of_range("Key is not in the collection");
   }
-
-  throw std::out_of_range("Key is not in the collection");
+  return node->val(i);
 }
 
 // Returns the value for a given key. Throws out_of_range if the
@@ -293,126 +850,113 @@ V &BTreeMap<K, V>::operator[](const K &key)
 template <typename K, typename V>
 const V &BTreeMap<K, V>::operator[](const K &key) const
 {
-  Node *traverse = root;
-  Node *searchNext = nullptr;
-  int m = 0;
-  while (traverse != nullptr)
+  BTREE_OP(lookup);
+  int i = 0;
+  Node *node = lookup(key, i);
+  if (node == nullptr)
   {
-    // m == the # of keys in node
-    m = traverse->keyvals.size();
+    throw std::out_of_range("Key is not in the collection");
+  }
+  return node->val(i);
+}
 
-    // search keys from 0 to m-1
-    for (int i = 0; i < m; ++i)
-    {
-      if (key < traverse->key(i))
-      {
-        if (traverse->leaf())
-        {
-          searchNext = nullptr;
-        }
-        else
-        {
-          searchNext = traverse->child(i);
-          break;
-        }
-      }
-      else if (key == traverse->key(i))
-      {
-        return traverse->val(i);
-      }
-    }
+// Extends the collection by adding the given key-value pair, or
+// replaces the value of a key already in the map
+template <typename K, typename V>
+void BTreeMap<K, V>::insert(const K &key, const V &value)
+{
+  BTREE_OP(insert);
+  // appends land in the rightmost leaf (tail) until it fills up
+  bool inserted = false;
+  V *slot = place(key, value, tail, inserted);
+  if (!inserted)
+    *slot = value;
+}
 
-    // search next child if necessary
-    if (key > traverse->key(m - 1))
-    {
-      if (traverse->leaf())
-      {
-        searchNext = nullptr;
-      }
-      else
-      {
-        searchNext = traverse->child(m);
-      }
-    }
-    traverse = searchNext;
-  }
+// Inserts the pair starting at the hint's leaf when it covers key
+template <typename K, typename V>
+void BTreeMap<K, V>::insert(const K &key, const V &value, Cursor &hint)
+{
+  BTREE_OP(insert);
+  bool inserted = false;
+  V *slot = place(key, value, hint, inserted);
+  if (!inserted)
+    *slot = value;
+}
 
-  throw std::out_of_range("Key is not in the collection");
+// Returns a pointer to the value for key, or nullptr
+template <typename K, typename V>
+V *BTreeMap<K, V>::find(const K &key)
+{
+  BTREE_OP(lookup);
+  int i = 0;
+  Node *node = lookup(key, i);
+  return node != nullptr ? &node->val(i) : nullptr;
 }
 
-// Extends the collection by adding the given key-value pair.
-// Expects key to not exist in map prior to insertion.
 template <typename K, typename V>
-void BTreeMap<K, V>::insert(const K &key, const V &value)
+const V *BTreeMap<K, V>::find(const K &key) const
 {
-  // empty tree
-  if (!root)
-  {
-    std::pair<K, V> p{key, value};
-    root = new Node;
-    root->keyvals.insert(p, 0);
-    count++;
-    return;
-  }
+  BTREE_OP(lookup);
+  int i = 0;
+  Node *node = lookup(key, i);
+  return node != nullptr ? &node->val(i) : nullptr;
+}
 
-  // root is full
-  if (root->full())
-  {
-    Node *left = root;
-    root = new Node;
-    root->children.insert(left, 0);
-    split(root, 0);
-  }
+// Returns a copy of the value for key, or fallback
+template <typename K, typename V>
+V BTreeMap<K, V>::get_or(const K &key, const V &fallback) const
+{
+  const V *value = find(key);
+  return value != nullptr ? *value : fallback;
+}
 
-  Node *prev = nullptr;
-  Node *curr = root;
-  int index = -1;
+// Inserts the pair or assigns the value of an existing key
+template <typename K, typename V>
+bool BTreeMap<K, V>::insert_or_assign(const K &key, const V &value)
+{
+  BTREE_OP(insert);
+  bool inserted = false;
+  V *slot = place(key, value, tail, inserted);
+  if (!inserted)
+    *slot = value;
+  return inserted;
+}
 
-  while (curr != nullptr)
-  {
-    // split node
-    if (curr->full())
-    {
-      curr = prev;
-      split(prev, index);
-    }
+// Inserts (key, init) or updates the existing value
+template <typename K, typename V>
+template <typename F>
+bool BTreeMap<K, V>::upsert(const K &key, const V &init, F update)
+{
+  BTREE_OP(insert);
+  bool inserted = false;
+  V *slot = place(key, init, tail, inserted);
+  if (!inserted)
+    update(*slot);
+  return inserted;
+}
 
-    prev = curr;
-    for (int j = 0; j < prev->keyvals.size(); ++j)
-    {
-      // if key is less than current key in current node
-      if (key < prev->key(j))
-      {
-        index = j;
-        if (prev->leaf())
-        {
-          curr = nullptr;
-        }
-        else
-        {
-          curr = prev->child(j);
-        }
-        break;
-      }
-      // if key is greater than current key in current node
-      else if (key > prev->key(j))
-      {
-        index = j + 1;
-        if (prev->leaf())
-        {
-          curr = nullptr;
-        }
-        else
-        {
-          curr = prev->child(j + 1);
-        }
-      }
-    }
+// Returns true if the key is in the collection, starting at the hint
+template <typename K, typename V>
+bool BTreeMap<K, V>::contains(const K &key, Cursor &hint) const
+{
+  BTREE_OP(contains);
+  int i = 0;
+  return find_node(key, hint, i) != nullptr;
+}
+
+// Returns the value for the key, starting at the hint
+template <typename K, typename V>
+V &BTreeMap<K, V>::at(const K &key, Cursor &hint)
+{
+  BTREE_OP(lookup);
+  int i = 0;
+  Node *node = find_node(key, hint, i);
+  if (node == nullptr)
+  {
+    throw std::out_of_range("Key is not in the collection");
   }
-  std::pair<K, V> p{key, value};
-  prev->keyvals.insert(p, index);
-  count++;
-  return;
+  return node->val(i);
 }
 
 // Shrinks the collection by removing the key-value pair with the
@@ -422,15 +966,40 @@ void BTreeMap<K, V>::insert(const K &key, const V &value)
 template <typename K, typename V>
 void BTreeMap<K, V>::erase(const K &key)
 {
-  if (empty())
+  if (!try_erase(key))
   {
     throw std::out_of_range("Key is not in the collection");
   }
-  else if (!contains(key))
+}
+
+// Removes the pair with the given key, if there is one. A miss is only
+// found at the bottom of the descent, so the nodes on the way may
+// already have been rebalanced; the tree stays valid either way.
+template <typename K, typename V>
+bool BTreeMap<K, V>::try_erase(const K &key)
+{
+  BTREE_OP(erase);
+  if (root == nullptr)
+  {
+    return false;
+  }
+  version++;
+  cache_epoch++;
+  bool found = detach(key);
+  if (found)
   {
-    throw std::out_of_range("Key is not in the collection");
+    --count;
+    filter_erase();
   }
-  erase(root, key);
+  return found;
+}
+
+// erase helper: removes key from the tree and collapses an emptied
+// root, leaving the count, filter and cache to the caller
+template <typename K, typename V>
+bool BTreeMap<K, V>::detach(const K &key)
+{
+  bool found = erase(root, key);
   if (root->keyvals.empty())
   {
     Node *left_child = nullptr;
@@ -438,72 +1007,57 @@ void BTreeMap<K, V>::erase(const K &key)
     if (root->children.size() > 0)
       left_child = root->child(0);
     delete root;
+    BTREE_COUNT(frees);
     root = left_child;
+    tree_levels--;
   }
-  --count;
+  return found;
 }
 
 // Returns true if the key is in the collection, and false otherwise.
 template <typename K, typename V>
 bool BTreeMap<K, V>::contains(const K &key) const
 {
-  Node *traverse = root;
-  Node *searchNext = nullptr;
-  int m = 0;
-  while (traverse != nullptr)
-  {
-    // m == the # of keys in node
-    m = traverse->keyvals.size();
-    searchNext = nullptr;
-    // search keys from 0 to m-1
-    for (int i = 0; i < m; ++i)
-    {
-      if (key < traverse->key(i))
-      {
-        if (traverse->leaf())
-        {
-          return false;
-        }
-        else
-        {
-          searchNext = traverse->child(i);
-          break;
-        }
-      }
-      else if (key == traverse->key(i))
-      {
-        return true;
-      }
-    }
+  BTREE_OP(contains);
+  int i = 0;
+  return lookup(key, i) != nullptr;
+}
 
-    // search next child if necessary
-    if (key > traverse->key(m - 1))
-    {
-      if (traverse->leaf())
-      {
-        return false;
-      }
-      else
-      {
-        searchNext = traverse->child(m);
-      }
-    }
+// Batched contains
+template <typename K, typename V>
+void BTreeMap<K, V>::contains(const K *keys, int n, bool *found) const
+{
+  BTREE_OP(contains);
+  for (int j = 0; j < n; ++j)
+  {
+    found[j] = false;
+  }
+  locate(keys, n, [found](int j, Node *, int) { found[j] = true; });
+}
 
-    traverse = searchNext;
+// Batched find
+template <typename K, typename V>
+void BTreeMap<K, V>::find(const K *keys, int n, V **values)
+{
+  BTREE_OP(lookup);
+  for (int j = 0; j < n; ++j)
+  {
+    values[j] = nullptr;
   }
-  return false;
+  locate(keys, n, [values](int j, Node *node, int i) { values[j] = &node->val(i); });
 }
 
 // Returns the keys k in the collection such that k1 <= k <= k2
 template <typename K, typename V>
 ArraySeq<K> BTreeMap<K, V>::find_keys(const K &k1, const K &k2) const
 {
+  BTREE_OP(find_keys);
   ArraySeq<K> keys;
-  if (!empty())
+  if (root != nullptr and !(k2 < k1))
   {
-    find_keys(k1, k2, root, keys);
+    auto append = [&keys](const K &key) { keys.push_back(key); };
+    scan_keys(root, k1, k2, append);
   }
-  // keys.sort();
   return keys;
 }
 
@@ -511,6 +1065,7 @@ ArraySeq<K> BTreeMap<K, V>::find_keys(const K &k1, const K &k2) const
 template <typename K, typename V>
 ArraySeq<K> BTreeMap<K, V>::sorted_keys() const
 {
+  BTREE_OP(sorted_keys);
   ArraySeq<K> keys;
   if (!empty())
   {
@@ -526,203 +1081,1517 @@ ArraySeq<K> BTreeMap<K, V>::sorted_keys() const
 template <typename K, typename V>
 bool BTreeMap<K, V>::next_key(const K &key, K &next_key) const
 {
-  Node *traverse = root;
-  Node *searchNext = nullptr;
-  K hold;
-  int m = 0;
-  int nextExists = 0;
-
-  if (empty())
+  BTREE_OP(next_key);
+  // the last key greater than key seen on the way down to a leaf (a
+  // match in an internal node sends the descent to the subtree right
+  // of it, whose smallest key is the successor)
+  const K *next = nullptr;
+  descend<true>(root, key, [&next](Node *node, int i) {
+    if (i < node->keyvals.size())
+      next = &node->key(i);
+    return true;
+  });
+  if (next == nullptr)
   {
     return false;
   }
+  next_key = *next;
+  return true;
+}
 
-  while (traverse != nullptr)
-  {
-    // m == the # of keys in node
-    m = traverse->keyvals.size();
-    searchNext = nullptr;
-    // search keys from 0 to m-1
-    for (int i = 0; i < m; ++i)
+// Gives the key (as an ouptput parameter) immediately before the
+// given key according to ascending sort order. Returns true if a
+// predecessor key exists, and false otherwise.
+template <typename K, typename V>
+bool BTreeMap<K, V>::prev_key(const K &key, K &next_key) const
+{
+  BTREE_OP(prev_key);
+  // the last key less than key seen on the way down to a leaf
+  const K *prev = nullptr;
+  descend<false>(root, key, [&prev](Node *node, int i) {
+    if (i > 0)
+      prev = &node->key(i - 1);
+    return true;
+  });
+  if (prev == nullptr)
+  {
+    return false;
+  }
+  next_key = *prev;
+  return true;
+}
+
+// Removes all key-value pairs from the map.
+template <typename K, typename V>
+void BTreeMap<K, V>::clear()
+{
+  BTREE_OP(clear);
+  clear(root);
+  root = nullptr;
+  count = 0;
+  tree_levels = 0;
+  version++;
+  cache_epoch++;
+  if (filter != nullptr)
+  {
+    filter->clear();
+    filter_erased = 0;
+    filter_stale = false;
+  }
+}
+
+// Copies rhs into this map using the pool
+template <typename K, typename V>
+void BTreeMap<K, V>::assign(const BTreeMap &rhs, ThreadPool &pool)
+{
+#ifdef BTREEMAP_STATS
+  (void)pool;
+  *this = rhs;
+#else
+  if (this == &rhs)
+  {
+    return;
+  }
+  clear(pool);
+  if (rhs.root != nullptr)
+  {
+    TaskGroup tasks(pool);
+    root = copy(rhs.root, rhs.tree_levels, tasks);
+    tasks.wait();
+  }
+  count = rhs.count;
+  tree_levels = rhs.tree_levels;
+  filter.reset(rhs.filter != nullptr ? new BloomFilter<K>(*rhs.filter) : nullptr);
+  filter_bits = rhs.filter_bits;
+  filter_erased = rhs.filter_erased;
+  filter_stale = rhs.filter_stale;
+  cache.reset(rhs.cache != nullptr ? new CacheSlot[std::size_t(1) << rhs.cache_bits] : nullptr);
+  cache_bits = rhs.cache_bits;
+#endif
+}
+
+// Removes all key-value pairs from the map using the pool
+template <typename K, typename V>
+void BTreeMap<K, V>::clear(ThreadPool &pool)
+{
+#ifdef BTREEMAP_STATS
+  (void)pool;
+  clear();
+#else
+  Node *old_root = root;
+  int old_levels = tree_levels;
+  root = nullptr;
+  count = 0;
+  tree_levels = 0;
+  version++;
+  cache_epoch++;
+  if (filter != nullptr)
+  {
+    filter->clear();
+    filter_erased = 0;
+    filter_stale = false;
+  }
+  if (old_root != nullptr)
+  {
+    TaskGroup tasks(pool);
+    clear(old_root, old_levels, tasks);
+    tasks.wait();
+  }
+#endif
+}
+
+// Returns the keys in ascending sorted order, filled in by the pool
+template <typename K, typename V>
+ArraySeq<K> BTreeMap<K, V>::sorted_keys(ThreadPool &pool) const
+{
+#ifdef BTREEMAP_STATS
+  (void)pool;
+  return sorted_keys();
+#else
+  if (tree_levels <= parallel_levels)
+  {
+    return sorted_keys();
+  }
+  std::vector<Part> parts;
+  cut(root, tree_levels, parts);
+
+  // size every subtree part, then lay the parts out one after another
+  std::vector<int> offsets(parts.size() + 1, 0);
+  {
+    TaskGroup tasks(pool);
+    for (std::size_t i = 0; i < parts.size(); ++i)
+    {
+      if (parts[i].index < 0)
+      {
+        const Node *node = parts[i].node;
+        int *size = &offsets[i + 1];
+        tasks.run([node, size] { *size = subtree_size(node); });
+      }
+      else
+      {
+        offsets[i + 1] = 1;
+      }
+    }
+    tasks.wait();
+  }
+  for (std::size_t i = 0; i < parts.size(); ++i)
+  {
+    offsets[i + 1] += offsets[i];
+  }
+
+  ArraySeq<K> keys;
+  keys.resize(offsets.back());
+  K *out = keys.data();
+  {
+    TaskGroup tasks(pool);
+    for (std::size_t i = 0; i < parts.size(); ++i)
+    {
+      const Node *node = parts[i].node;
+      K *slice = out + offsets[i];
+      if (parts[i].index < 0)
+      {
+        tasks.run([node, slice] { write_keys(node, slice); });
+      }
+      else
+      {
+        *slice = node->key(parts[i].index);
+      }
+    }
+    tasks.wait();
+  }
+  return keys;
+#endif
+}
+
+// Returns the keys k1 <= k <= k2 in order, scanned by the pool
+template <typename K, typename V>
+ArraySeq<K> BTreeMap<K, V>::find_keys(const K &k1, const K &k2, ThreadPool &pool) const
+{
+  ArraySeq<K> keys;
+  auto append = [&keys](const K &key) { keys.push_back(key); };
+#ifdef BTREEMAP_STATS
+  (void)pool;
+  if (root != nullptr and !(k2 < k1))
+    scan_keys(root, k1, k2, append);
+#else
+  if (root == nullptr or k2 < k1)
+  {
+    return keys;
+  }
+  if (tree_levels <= parallel_levels)
+  {
+    scan_keys(root, k1, k2, append);
+    return keys;
+  }
+  std::vector<Part> parts;
+  cut_range(root, tree_levels, k1, k2, parts);
+  std::vector<ArraySeq<K>> buffers(parts.size());
+  {
+    TaskGroup tasks(pool);
+    for (std::size_t i = 0; i < parts.size(); ++i)
+    {
+      if (parts[i].index < 0)
+      {
+        const Node *node = parts[i].node;
+        ArraySeq<K> *buffer = &buffers[i];
+        tasks.run([node, buffer, &k1, &k2] {
+          auto emit = [buffer](const K &key) { buffer->push_back(key); };
+          scan_keys(node, k1, k2, emit);
+        });
+      }
+    }
+    tasks.wait();
+  }
+  int total = 0;
+  for (std::size_t i = 0; i < parts.size(); ++i)
+  {
+    total += parts[i].index < 0 ? buffers[i].size() : 1;
+  }
+  keys.reserve(total);
+  for (std::size_t i = 0; i < parts.size(); ++i)
+  {
+    if (parts[i].index < 0)
+      keys.append(buffers[i]);
+    else
+      keys.push_back(parts[i].node->key(parts[i].index));
+  }
+#endif
+  return keys;
+}
+
+// Calls f(key) for the keys k1 <= k <= k2, concurrently and unordered
+template <typename K, typename V>
+template <typename F>
+void BTreeMap<K, V>::find_keys(const K &k1, const K &k2, ThreadPool &pool, F f) const
+{
+  if (root == nullptr or k2 < k1)
+  {
+    return;
+  }
+#ifdef BTREEMAP_STATS
+  (void)pool;
+  scan_keys(root, k1, k2, f);
+#else
+  if (tree_levels <= parallel_levels)
+  {
+    scan_keys(root, k1, k2, f);
+    return;
+  }
+  std::vector<Part> parts;
+  cut_range(root, tree_levels, k1, k2, parts);
+  TaskGroup tasks(pool);
+  for (const Part &part : parts)
+  {
+    if (part.index < 0)
+    {
+      const Node *node = part.node;
+      tasks.run([node, &k1, &k2, &f] { scan_keys(node, k1, k2, f); });
+    }
+    else
+    {
+      f(part.node->key(part.index));
+    }
+  }
+  tasks.wait();
+#endif
+}
+
+// Returns the key-value pairs in ascending key order
+template <typename K, typename V>
+ArraySeq<std::pair<K, V>> BTreeMap<K, V>::sorted_pairs() const
+{
+  BTREE_OP(sorted_keys);
+  ArraySeq<std::pair<K, V>> pairs;
+  if (root != nullptr)
+  {
+    pairs.reserve(count);
+    auto append = [&pairs](const std::pair<K, V> &p) { pairs.push_back(p); };
+    for_each_pair(static_cast<const Node *>(root), append);
+  }
+  return pairs;
+}
+
+// Returns the pairs with k1 <= key <= k2 in ascending key order
+template <typename K, typename V>
+ArraySeq<std::pair<K, V>> BTreeMap<K, V>::find_pairs(const K &k1, const K &k2) const
+{
+  BTREE_OP(find_keys);
+  ArraySeq<std::pair<K, V>> pairs;
+  if (root != nullptr and !(k2 < k1))
+  {
+    auto append = [&pairs](const Node *node, int i) {
+      pairs.push_back(node->keyvals.unchecked(i));
+    };
+    scan_range(root, k1, k2, append);
+  }
+  return pairs;
+}
+
+// Replaces the contents with sorted pairs, built bottom up
+template <typename K, typename V>
+void BTreeMap<K, V>::assign_sorted(const std::pair<K, V> *pairs, int n)
+{
+  for (int i = 1; i < n; ++i)
+  {
+    if (!(pairs[i - 1].first < pairs[i].first))
+    {
+      throw std::invalid_argument("pairs are not in strictly ascending key order");
+    }
+  }
+  ArraySeq<std::pair<K, V>> copy;
+  copy.append(pairs, n);
+  rebuild(copy);
+}
+
+// Adds the pairs of rhs whose keys are not in this map
+template <typename K, typename V>
+void BTreeMap<K, V>::unite(const BTreeMap &rhs)
+{
+  unite(rhs, [](V &, const V &) {});
+}
+
+// Adds the pairs of rhs, combining the values of keys in both maps
+template <typename K, typename V>
+template <typename F>
+void BTreeMap<K, V>::unite(const BTreeMap &rhs, F combine)
+{
+  if (this == &rhs)
+  {
+    // every key is in both maps, combined with itself
+    ArraySeq<std::pair<K, V>> pairs = sorted_pairs();
+    for (int i = 0; i < pairs.size(); ++i)
+    {
+      combine((*this)[pairs.unchecked(i).first], pairs.unchecked(i).second);
+    }
+    return;
+  }
+  if (point_ops(rhs))
+  {
+    auto add = [this, &combine](const std::pair<K, V> &p) {
+      if (V *value = find(p.first))
+        combine(*value, p.second);
+      else
+        insert(p.first, p.second);
+    };
+    if (rhs.root != nullptr)
+      for_each_pair(static_cast<const Node *>(rhs.root), add);
+    return;
+  }
+  BTREE_OP(bulk);
+  ArraySeq<std::pair<K, V>> mine, theirs = rhs.sorted_pairs(), merged;
+  if (root != nullptr)
+  {
+    mine.reserve(count);
+    auto take = [&mine](Entry &p) { mine.emplace_back(std::move(p)); };
+    for_each_pair(root, take);
+  }
+  merged.reserve(mine.size() + theirs.size());
+  int i = 0, j = 0;
+  while (i < mine.size() and j < theirs.size())
+  {
+    std::pair<K, V> &a = mine.unchecked(i);
+    const std::pair<K, V> &b = theirs.unchecked(j);
+    if (a.first < b.first)
+    {
+      merged.emplace_back(std::move(a));
+      ++i;
+    }
+    else if (b.first < a.first)
+    {
+      merged.push_back(b);
+      ++j;
+    }
+    else
+    {
+      combine(a.second, b.second);
+      merged.emplace_back(std::move(a));
+      ++i;
+      ++j;
+    }
+  }
+  for (; i < mine.size(); ++i)
+  {
+    merged.emplace_back(std::move(mine.unchecked(i)));
+  }
+  for (; j < theirs.size(); ++j)
+  {
+    merged.push_back(theirs.unchecked(j));
+  }
+  rebuild(merged);
+}
+
+// Removes the keys that are not in rhs
+template <typename K, typename V>
+void BTreeMap<K, V>::intersect(const BTreeMap &rhs)
+{
+  if (this == &rhs)
+  {
+    return;
+  }
+  BTREE_OP(bulk);
+  ArraySeq<std::pair<K, V>> kept;
+  if (point_ops(rhs))
+  {
+    // look up each key of rhs here (in order, so kept stays sorted)
+    auto keep = [this, &kept](const std::pair<K, V> &p) {
+      if (const V *value = find(p.first))
+        kept.push_back({p.first, *value});
+    };
+    if (rhs.root != nullptr)
+      for_each_pair(static_cast<const Node *>(rhs.root), keep);
+    rebuild(kept);
+    return;
+  }
+  ArraySeq<K> theirs = rhs.sorted_keys();
+  int j = 0;
+  auto keep = [&kept, &theirs, &j](Entry &p) {
+    while (j < theirs.size() and theirs.unchecked(j) < p.first)
+      ++j;
+    if (j < theirs.size() and !(p.first < theirs.unchecked(j)))
+      kept.emplace_back(std::move(p));
+  };
+  if (root != nullptr)
+    for_each_pair(root, keep);
+  rebuild(kept);
+}
+
+// Removes the keys that are in rhs
+template <typename K, typename V>
+void BTreeMap<K, V>::subtract(const BTreeMap &rhs)
+{
+  if (this == &rhs)
+  {
+    clear();
+    return;
+  }
+  if (point_ops(rhs))
+  {
+    auto remove = [this](const std::pair<K, V> &p) { try_erase(p.first); };
+    if (rhs.root != nullptr)
+      for_each_pair(static_cast<const Node *>(rhs.root), remove);
+    return;
+  }
+  BTREE_OP(bulk);
+  ArraySeq<K> theirs = rhs.sorted_keys();
+  ArraySeq<std::pair<K, V>> kept;
+  int j = 0;
+  auto keep = [&kept, &theirs, &j](Entry &p) {
+    while (j < theirs.size() and theirs.unchecked(j) < p.first)
+      ++j;
+    if (j == theirs.size() or p.first < theirs.unchecked(j))
+      kept.emplace_back(std::move(p));
+  };
+  if (root != nullptr)
+    for_each_pair(root, keep);
+  rebuild(kept);
+}
+
+// Moves the pairs with keys >= key into a new map
+template <typename K, typename V>
+BTreeMap<K, V> BTreeMap<K, V>::split_at(const K &key)
+{
+  BTREE_OP(bulk);
+  BTreeMap upper;
+  if (root == nullptr)
+  {
+    return upper;
+  }
+  Node *l = nullptr, *r = nullptr;
+  int hl = 0, hr = 0;
+  version++;
+  cache_epoch++;
+  split_tree(root, tree_levels, key, l, hl, r, hr);
+  root = l;
+  tree_levels = hl;
+  upper.root = r;
+  upper.tree_levels = hr;
+  bool lower_smaller = false;
+  int smaller = smaller_size(l, r, lower_smaller);
+  upper.count = lower_smaller ? count - smaller : smaller;
+  count -= upper.count;
+  // this map's filter still holds every remaining key; the moved ones
+  // count as erased, so later erases rebuild it sooner. upper starts
+  // without one
+  if (filter != nullptr)
+  {
+    filter_erased += upper.count;
+  }
+  return upper;
+}
+
+// Moves every pair of other into this map
+template <typename K, typename V>
+void BTreeMap<K, V>::join(BTreeMap &other)
+{
+  BTREE_OP(bulk);
+  if (this == &other or other.root == nullptr)
+  {
+    return;
+  }
+  if (root == nullptr)
+  {
+    // take the tree alone: as below, each map keeps its own filter
+    // and cache
+    version++;
+    other.version++;
+    cache_epoch++;
+    other.cache_epoch++;
+    root = other.root;
+    tree_levels = other.tree_levels;
+    count = other.count;
+    other.root = nullptr;
+    other.tree_levels = 0;
+    other.count = 0;
+    filter_joined();
+    return;
+  }
+
+  // compare the extreme keys of both trees
+  auto min_node = [](Node *n) {
+    while (!n->leaf())
+      n = n->child(0);
+    return n;
+  };
+  auto max_node = [](Node *n) {
+    while (!n->leaf())
+      n = n->child(n->children.size() - 1);
+    return n;
+  };
+  Node *this_max = max_node(root), *other_max = max_node(other.root);
+  const K &this_hi = this_max->key(this_max->keyvals.size() - 1);
+  const K &other_hi = other_max->key(other_max->keyvals.size() - 1);
+  bool other_above = this_hi < min_node(other.root)->key(0);
+  if (!other_above and !(other_hi < min_node(root)->key(0)))
+  {
+    throw std::invalid_argument("joined maps have overlapping keys");
+  }
+  BTreeMap &low = other_above ? *this : other;
+  BTreeMap &high = other_above ? other : *this;
+
+  // the smallest pair of the upper tree separates the two trees; it
+  // is detached along the upper tree's left spine, without the count
+  // and filter bookkeeping of erase (the pair stays in the map)
+  int total = count + other.count;
+  Entry kv = min_node(high.root)->keyvals.unchecked(0);
+  high.detach(kv.first);
+
+  int h = 0;
+  version++;
+  other.version++;
+  cache_epoch++;
+  other.cache_epoch++;
+  root = join3(low.root, low.tree_levels, kv, high.root, high.tree_levels, h);
+  tree_levels = h;
+  count = total;
+  other.root = nullptr;
+  other.tree_levels = 0;
+  other.count = 0;
+  filter_joined();
+}
+
+// Starts filtering lookups through a Bloom filter over the keys
+template <typename K, typename V>
+void BTreeMap<K, V>::enable_filter(int bits_per_key)
+{
+  static_assert(is_bloom_hashable<K>::value, "enable_filter needs std::hash<K>");
+  filter.reset(new BloomFilter<K>());
+  filter_bits = bits_per_key;
+  filter_rebuild();
+}
+
+// Drops the Bloom filter
+template <typename K, typename V>
+void BTreeMap<K, V>::disable_filter()
+{
+  filter.reset();
+  filter_erased = 0;
+  filter_stale = false;
+}
+
+// Starts caching the positions of looked up keys
+template <typename K, typename V>
+void BTreeMap<K, V>::enable_cache(int entries)
+{
+  static_assert(is_bloom_hashable<K>::value, "enable_cache needs std::hash<K>");
+  cache_bits = 0;
+  while (cache_bits < 30 and (1 << cache_bits) < entries)
+  {
+    ++cache_bits;
+  }
+  cache.reset(new CacheSlot[std::size_t(1) << cache_bits]);
+}
+
+// Drops the lookup cache
+template <typename K, typename V>
+void BTreeMap<K, V>::disable_cache()
+{
+  cache.reset();
+  cache_bits = 0;
+}
+
+// Returns the height of the binary search tree
+template <typename K, typename V>
+int BTreeMap<K, V>::height() const
+{
+  return tree_levels;
+}
+
+// Checks the structural invariants of the tree
+template <typename K, typename V>
+void BTreeMap<K, V>::validate() const
+{
+  long long keys = 0;
+  if (root == nullptr)
+  {
+    if (tree_levels != 0)
+    {
+      throw std::logic_error("empty tree with nonzero height");
+    }
+  }
+  else
+  {
+    validate(root, 1, nullptr, nullptr, keys);
+  }
+  if (keys != count)
+  {
+    throw std::logic_error("size is " + std::to_string(count) + " but tree holds " +
+                           std::to_string(keys) + " keys");
+  }
+}
+
+// Walks the tree and reports its shape and memory use
+template <typename K, typename V>
+BTreeStats BTreeMap<K, V>::stats() const
+{
+  BTreeStats st;
+  if (root != nullptr)
+  {
+    stats(root, 1, st);
+    st.fill_factor = static_cast<double>(st.keys) / (3.0 * st.nodes);
+  }
+  return st;
+}
+
+// clean up the tree memory
+template <typename K, typename V>
+void BTreeMap<K, V>::clear(Node *st_root)
+{
+  if (st_root == root)
+  {
+    count = 0;
+  }
+  if (st_root != nullptr)
+  {
+    st_root->keyvals.clear();
+    for (int i = 0; i < st_root->children.size(); ++i)
+    {
+      clear(st_root->child(i));
+    }
+    st_root->children.clear();
+  }
+  if (st_root != nullptr)
+  {
+    BTREE_COUNT(frees);
+  }
+  delete st_root;
+  return;
+}
+
+// helper function for copy assignment
+template <typename K, typename V>
+typename BTreeMap<K, V>::Node *BTreeMap<K, V>::copy(const Node *rhs_st_root) const
+{
+  Node *copy_root = nullptr;
+  if (rhs_st_root != nullptr)
+  {
+    copy_root = new Node;
+    BTREE_COUNT(allocations);
+    // use array copy assignment
+    copy_root->keyvals = rhs_st_root->keyvals;
+
+    // traverse each child node
+    copy_root->children.reserve(rhs_st_root->children.size());
+    for (int i = 0; i < rhs_st_root->children.size(); ++i)
+    {
+      copy_root->children.push_back(copy(rhs_st_root->child(i)));
+    }
+  }
+  return copy_root;
+}
+
+// parallel copy helper: the copies of large children are built by
+// tasks that fill in the new node's child slots
+template <typename K, typename V>
+typename BTreeMap<K, V>::Node *BTreeMap<K, V>::copy(const Node *rhs_st_root, int levels,
+                                                   TaskGroup &tasks) const
+{
+  if (levels <= parallel_levels)
+  {
+    return copy(rhs_st_root);
+  }
+  Node *copy_root = new Node;
+  copy_root->keyvals = rhs_st_root->keyvals;
+  int n = rhs_st_root->children.size();
+  copy_root->children.reserve(n);
+  for (int i = 0; i < n; ++i)
+  {
+    copy_root->children.push_back(nullptr);
+  }
+  for (int i = 0; i < n; ++i)
+  {
+    Node **slot = &copy_root->children.unchecked(i);
+    const Node *child = rhs_st_root->child(i);
+    tasks.run([this, slot, child, levels, &tasks] { *slot = copy(child, levels - 1, tasks); });
+  }
+  return copy_root;
+}
+
+// parallel clear helper: frees the node, then its large children in
+// separate tasks
+template <typename K, typename V>
+void BTreeMap<K, V>::clear(Node *st_root, int levels, TaskGroup &tasks)
+{
+  if (levels <= parallel_levels)
+  {
+    clear(st_root);
+    return;
+  }
+  SmallArraySeq<Node *, 4> children = std::move(st_root->children);
+  delete st_root;
+  for (int i = 0; i < children.size(); ++i)
+  {
+    Node *child = children.unchecked(i);
+    tasks.run([this, child, levels, &tasks] { clear(child, levels - 1, tasks); });
+  }
+}
+
+// parallel sorted_keys helper: lists the parts of the subtree in order
+template <typename K, typename V>
+void BTreeMap<K, V>::cut(const Node *st_root, int levels, std::vector<Part> &parts) const
+{
+  if (levels <= parallel_levels)
+  {
+    parts.push_back({st_root, -1});
+    return;
+  }
+  int m = st_root->keyvals.size();
+  for (int i = 0; i < m; ++i)
+  {
+    cut(st_root->child(i), levels - 1, parts);
+    parts.push_back({st_root, i});
+  }
+  cut(st_root->child(m), levels - 1, parts);
+}
+
+// parallel sorted_keys helper: number of keys in the subtree
+template <typename K, typename V>
+int BTreeMap<K, V>::subtree_size(const Node *st_root)
+{
+  int n = st_root->keyvals.size();
+  for (int i = 0; i < st_root->children.size(); ++i)
+  {
+    n += subtree_size(st_root->child(i));
+  }
+  return n;
+}
+
+// parallel sorted_keys helper: writes the subtree's keys in order
+// starting at out and returns the position after the last one
+template <typename K, typename V>
+K *BTreeMap<K, V>::write_keys(const Node *st_root, K *out)
+{
+  int m = st_root->keyvals.size();
+  if (st_root->leaf())
+  {
+    for (int i = 0; i < m; ++i)
     {
-      if (key < traverse->key(i))
-      {
-        nextExists = 1;
-        hold = traverse->key(i);
-        if (traverse->leaf())
-        {
-          searchNext = nullptr;
-        }
-        else
-        {
-          searchNext = traverse->child(i);
-        }
-        break;
-      }
-      else if (key == traverse->key(i))
-      {
-        if (traverse->leaf())
-        {
-          searchNext = nullptr;
-        }
-        else
-        {
-          searchNext = traverse->child(i + 1);
-        }
-      }
+      *out++ = st_root->key(i);
+    }
+    return out;
+  }
+  for (int i = 0; i < m; ++i)
+  {
+    // the next subtree loads while this one is written
+    prefetch(st_root->child(i + 1));
+    out = write_keys(st_root->child(i), out);
+    *out++ = st_root->key(i);
+  }
+  return write_keys(st_root->child(m), out);
+}
+
+// cursor helper: points the hint at the leaf
+template <typename K, typename V>
+void BTreeMap<K, V>::record(Cursor &hint, Node *leaf, const K *lo, const K *hi) const
+{
+  hint.map = this;
+  hint.leaf = leaf;
+  hint.version = version;
+  hint.has_lo = lo != nullptr;
+  hint.has_hi = hi != nullptr;
+  if (lo != nullptr)
+    hint.lo = *lo;
+  if (hi != nullptr)
+    hint.hi = *hi;
+}
+
+// insert helper: uses the hint's leaf when it covers key and has room
+template <typename K, typename V>
+V *BTreeMap<K, V>::place(const K &key, const V &value, Cursor &hint, bool &inserted)
+{
+  V *slot = covers(hint, key) and !hint.leaf->full()
+                ? leaf_insert(hint.leaf, key, value, inserted)
+                : insert_descent(key, value, &hint, inserted);
+  if (inserted and filter != nullptr)
+  {
+    filter_insert(key);
+  }
+  return slot;
+}
+
+// insert helper: adds the pair to a leaf with room
+template <typename K, typename V>
+V *BTreeMap<K, V>::leaf_insert(Node *leaf, const K &key, const V &value, bool &inserted)
+{
+  BTREE_COUNT(node_visits);
+  int m = leaf->keyvals.size();
+  int i = search_node<false>(leaf, key);
+  inserted = !(i < m and !(key < leaf->key(i)));
+  if (inserted)
+  {
+    Entry p{key, value};
+    leaf->keyvals.insert(p, i);
+    count++;
+  }
+  return &leaf->val(i);
+}
+
+// insert helper: top-down insert from the root. A full child is split
+// before the descent enters it, so the leaf always has room.
+template <typename K, typename V>
+V *BTreeMap<K, V>::insert_descent(const K &key, const V &value, Cursor *hint, bool &inserted)
+{
+  inserted = false;
+  // empty tree
+  if (!root)
+  {
+    Entry p{key, value};
+    root = new Node;
+    BTREE_COUNT(allocations);
+    root->keyvals.insert(p, 0);
+    tree_levels = 1;
+    count++;
+    inserted = true;
+    if (hint != nullptr)
+      record(*hint, root, nullptr, nullptr);
+    return &root->val(0);
+  }
+
+  // root is full
+  if (root->full())
+  {
+    Node *left = root;
+    root = new Node;
+    BTREE_COUNT(allocations);
+    root->children.insert(left, 0);
+    split(root, 0);
+    tree_levels++;
+  }
+
+  // keys of the ancestors bounding the current subtree
+  const K *lo = nullptr, *hi = nullptr;
+  Node *curr = root;
+  while (true)
+  {
+    BTREE_COUNT(node_visits);
+    int m = curr->keyvals.size();
+    int i = search_node<false>(curr, key);
+    if (i < m and !(key < curr->key(i)))
+    {
+      // already present
+      return &curr->val(i);
     }
-    // search next child if necessary
-    if (key > traverse->key(m - 1))
+    if (curr->leaf())
     {
-      if (traverse->leaf())
-      {
-        searchNext == nullptr;
-      }
-      else if (traverse->children.size() == m + 1)
+      Entry p{key, value};
+      curr->keyvals.insert(p, i);
+      count++;
+      inserted = true;
+      if (hint != nullptr and !(hint == &tail and hi != nullptr))
+        record(*hint, curr, lo, hi);
+      return &curr->val(i);
+    }
+    if (curr->child(i)->full())
+    {
+      split(curr, i);
+      BTREE_COUNT(comparisons);
+      if (curr->key(i) < key)
+        ++i;
+      else if (!(key < curr->key(i)))
       {
-        searchNext = traverse->child(m);
+        // the promoted key is the one being inserted
+        return &curr->val(i);
       }
     }
-    traverse = searchNext;
+    if (i > 0)
+      lo = &curr->key(i - 1);
+    if (i < curr->keyvals.size())
+      hi = &curr->key(i);
+    curr = curr->child(i);
   }
+}
 
-  if (nextExists == 1)
+// search primitive: first slot whose key is > key (Upper) or >= key
+template <typename K, typename V>
+template <bool Upper>
+int BTreeMap<K, V>::search_node(const Node *node, const K &key) const
+{
+  int m = node->keyvals.size();
+  int i = 0;
+  while (i < m and (Upper ? !(key < node->key(i)) : node->key(i) < key))
   {
-    next_key = hold;
-    return true;
+    BTREE_COUNT(comparisons);
+    ++i;
   }
-  return false;
+  return i;
 }
 
-// Gives the key (as an ouptput parameter) immediately before the
-// given key according to ascending sort order. Returns true if a
-// predecessor key exists, and false otherwise.
+// search primitive: the descent loop
 template <typename K, typename V>
-bool BTreeMap<K, V>::prev_key(const K &key, K &next_key) const
+template <bool Upper, typename Step>
+void BTreeMap<K, V>::descend(Node *st_root, const K &key, Step &&step) const
 {
-  Node *traverse = root;
-  Node *searchNext = nullptr;
-  K hold;
-  int m = 0;
-  int prevExists = 0;
-
-  if (empty())
+  Node *curr = st_root;
+  while (curr != nullptr)
   {
-    return false;
+    BTREE_COUNT(node_visits);
+    // the child arrives sooner if its load starts before the key
+    // search than if it starts after; with only four children it is
+    // cheaper to fetch all of them than to guess
+    for (int i = 0; i < curr->children.size(); ++i)
+      prefetch(curr->child(i));
+    int slot = search_node<Upper>(curr, key);
+    if (!step(curr, slot) or curr->leaf())
+    {
+      return;
+    }
+    curr = curr->child(slot);
   }
+}
 
-  while (traverse != nullptr)
+// search primitive: interleaved descents for a batch of keys
+template <typename K, typename V>
+template <typename Hit>
+void BTreeMap<K, V>::locate(const K *keys, int n, Hit &&hit) const
+{
+  for (int start = 0; start < n; start += batch_group)
   {
-    // m == the # of keys in node
-    m = traverse->keyvals.size();
-    searchNext = nullptr;
-    // search keys from 0 to m-1
-    for (int i = 0; i < m; ++i)
+    int g = n - start < batch_group ? n - start : batch_group;
+    // the node each descent of the group is at (nullptr once done)
+    const Node *curr[batch_group];
+    int active = root == nullptr ? 0 : g;
+    for (int j = 0; j < g; ++j)
+    {
+      curr[j] = root;
+    }
+    // every leaf is at the same depth, so the descents of the group
+    // all take about the same number of rounds
+    while (active > 0)
     {
-      if (key < traverse->key(i))
+      for (int j = 0; j < g; ++j)
       {
-        if (traverse->leaf())
+        const Node *node = curr[j];
+        if (node == nullptr)
+        {
+          continue;
+        }
+        BTREE_COUNT(node_visits);
+        const K &key = keys[start + j];
+        int i = search_node<false>(node, key);
+        if (i < node->keyvals.size() and !(key < node->key(i)))
+        {
+          hit(start + j, const_cast<Node *>(node), i);
+          curr[j] = nullptr;
+        }
+        else if (node->leaf())
         {
-          searchNext = nullptr;
+          curr[j] = nullptr;
         }
         else
         {
-          searchNext = traverse->child(i);
+          // loads while the other descents of the group take a step
+          curr[j] = node->child(i);
+          prefetch(curr[j]);
+          continue;
+        }
+        --active;
+      }
+    }
+  }
+}
+
+// lookup helper: cache, filter, descent
+template <typename K, typename V>
+typename BTreeMap<K, V>::Node *BTreeMap<K, V>::lookup(const K &key, int &i) const
+{
+  if constexpr (is_bloom_hashable<K>::value)
+  {
+    if (cache != nullptr)
+    {
+      // a slot of the current epoch points at a live node, but
+      // inserts may have shifted or split its keys since, so the key
+      // is checked
+      CacheSlot &slot = cache_slot(key);
+      bool live = slot.epoch.load(std::memory_order_acquire) == cache_epoch;
+      std::uintptr_t entry = live ? slot.entry.load(std::memory_order_relaxed) : 0;
+      if (live)
+      {
+        Node *cached = entry_node(entry);
+        int index = entry_index(entry);
+        if (index < cached->keyvals.size())
+        {
+          const K &found = cached->key(index);
+          if (!(found < key) and !(key < found))
+          {
+            if (!entry_used(entry))
+            {
+              slot.entry.store(entry | 1, std::memory_order_relaxed);
+            }
+            i = index;
+            return cached;
+          }
         }
-        break;
       }
-      else if (key == traverse->key(i))
+      Node *node = filtered_out(key) ? nullptr : locate(key, i);
+      // a key only takes over a live slot that has not been hit since
+      // the last miss on it (one chance, as in CLOCK), so a stream of
+      // cold keys cannot flush out a hot one
+      if (node != nullptr)
       {
-        if (traverse->leaf())
+        if (live and entry_used(entry))
         {
-          searchNext = nullptr;
+          slot.entry.store(entry & ~static_cast<std::uintptr_t>(1), std::memory_order_relaxed);
         }
         else
         {
-          searchNext = traverse->child(i);
+          slot.entry.store(cache_entry(node, i, false), std::memory_order_relaxed);
+          slot.epoch.store(cache_epoch, std::memory_order_release);
         }
-        break;
       }
-      else if (key > traverse->key(i))
+      return node;
+    }
+  }
+  return filtered_out(key) ? nullptr : locate(key, i);
+}
+
+// lookup helper: plain descent from the root
+template <typename K, typename V>
+typename BTreeMap<K, V>::Node *BTreeMap<K, V>::locate(const K &key, int &i) const
+{
+  Node *found = nullptr;
+  descend<false>(root, key, [&](Node *node, int slot) {
+    if (slot < node->keyvals.size() and !(key < node->key(slot)))
+    {
+      found = node;
+      i = slot;
+      return false;
+    }
+    return true;
+  });
+  return found;
+}
+
+// hinted lookup helper: starts at the hint's leaf when it covers key,
+// otherwise descends from the root and points the hint at the leaf
+template <typename K, typename V>
+typename BTreeMap<K, V>::Node *BTreeMap<K, V>::find_node(const K &key, Cursor &hint,
+                                                        int &i) const
+{
+  // keys of the ancestors bounding the current subtree
+  const K *lo = nullptr, *hi = nullptr;
+  bool from_hint = covers(hint, key);
+  Node *found = nullptr;
+  descend<false>(from_hint ? hint.leaf : root, key, [&](Node *node, int slot) {
+    bool match = slot < node->keyvals.size() and !(key < node->key(slot));
+    if (match)
+    {
+      found = node;
+      i = slot;
+    }
+    if (node->leaf())
+    {
+      if (!from_hint)
+        record(hint, node, lo, hi);
+      return false;
+    }
+    if (slot > 0)
+      lo = &node->key(slot - 1);
+    if (slot < node->keyvals.size())
+      hi = &node->key(slot);
+    return !match;
+  });
+  return found;
+}
+
+// split/join helper: hangs the shorter tree (and the pair) off the
+// facing spine of the taller one, at the level where its root belongs.
+// Full nodes on the way down are split first, as in insert, so the
+// node that takes the pair has room for it.
+template <typename K, typename V>
+typename BTreeMap<K, V>::Node *BTreeMap<K, V>::join3(Node *l, int hl, Entry &kv,
+                                                    Node *r, int hr, int &h)
+{
+  if (hl == hr)
+  {
+    Node *st_root = new Node;
+    BTREE_COUNT(allocations);
+    st_root->keyvals.emplace_back(std::move(kv));
+    if (l != nullptr)
+    {
+      st_root->children.push_back(l);
+      st_root->children.push_back(r);
+    }
+    h = hl + 1;
+    return st_root;
+  }
+  bool right = hl > hr;
+  Node *tall = right ? l : r;
+  Node *sub = right ? r : l;
+  int sub_levels = right ? hr : hl;
+  h = right ? hl : hr;
+  if (tall->full())
+  {
+    Node *top = new Node;
+    BTREE_COUNT(allocations);
+    top->children.push_back(tall);
+    split(top, 0);
+    tall = top;
+    h++;
+  }
+  Node *curr = tall;
+  for (int curr_levels = h; curr_levels > sub_levels + 1; --curr_levels)
+  {
+    BTREE_COUNT(node_visits);
+    int i = right ? curr->children.size() - 1 : 0;
+    if (curr->child(i)->full())
+    {
+      split(curr, i);
+      if (right)
+        ++i;
+    }
+    curr = curr->child(i);
+  }
+  if (right)
+  {
+    curr->keyvals.emplace_back(std::move(kv));
+    if (sub != nullptr)
+      curr->children.push_back(sub);
+  }
+  else
+  {
+    curr->keyvals.insert(kv, 0);
+    if (sub != nullptr)
+      curr->children.insert(sub, 0);
+  }
+  return tall;
+}
+
+// split/join helper: splits the child on key's search path, then
+// joins what is left of this node on each side onto its two halves
+template <typename K, typename V>
+void BTreeMap<K, V>::split_tree(Node *st_root, int h, const K &key, Node *&l, int &hl,
+                                Node *&r, int &hr)
+{
+  BTREE_COUNT(node_visits);
+  int m = st_root->keyvals.size();
+  int i = 0;
+  while (i < m and st_root->key(i) < key)
+  {
+    ++i;
+  }
+
+  if (st_root->leaf())
+  {
+    if (i == 0 or i == m)
+    {
+      l = i == 0 ? nullptr : st_root;
+      r = i == 0 ? st_root : nullptr;
+    }
+    else
+    {
+      l = st_root;
+      r = new Node;
+      BTREE_COUNT(allocations);
+      r->keyvals.append(st_root->keyvals.data() + i, m - i);
+      while (st_root->keyvals.size() > i)
+        st_root->keyvals.erase(st_root->keyvals.size() - 1);
+    }
+    hl = l != nullptr ? 1 : 0;
+    hr = r != nullptr ? 1 : 0;
+    return;
+  }
+
+  Node *cl = nullptr, *cr = nullptr;
+  int hcl = 0, hcr = 0;
+  split_tree(st_root->child(i), h - 1, key, cl, hcl, cr, hcr);
+
+  // left side: keys 0..i-1 and children 0..i-1, then cl
+  if (i == 0)
+  {
+    l = cl;
+    hl = hcl;
+  }
+  else
+  {
+    Node *a = st_root->child(0);
+    int ha = h - 1;
+    if (i > 1)
+    {
+      a = new Node;
+      BTREE_COUNT(allocations);
+      a->keyvals.append(st_root->keyvals.data(), i - 1);
+      a->children.append(st_root->children.data(), i);
+      ha = h;
+    }
+    l = join3(a, ha, st_root->keyvals.unchecked(i - 1), cl, hcl, hl);
+  }
+
+  // right side: cr, then keys i..m-1 and children i+1..m
+  if (i == m)
+  {
+    r = cr;
+    hr = hcr;
+  }
+  else
+  {
+    Node *b = st_root->child(m);
+    int hb = h - 1;
+    if (i < m - 1)
+    {
+      b = new Node;
+      BTREE_COUNT(allocations);
+      b->keyvals.append(st_root->keyvals.data() + i + 1, m - i - 1);
+      b->children.append(st_root->children.data() + i + 1, m - i);
+      hb = h;
+    }
+    r = join3(cr, hcr, st_root->keyvals.unchecked(i), b, hb, hr);
+  }
+
+  delete st_root;
+  BTREE_COUNT(frees);
+}
+
+// split helper: counts the keys of the smaller of two trees
+template <typename K, typename V>
+int BTreeMap<K, V>::smaller_size(const Node *a, const Node *b, bool &a_smaller)
+{
+  // one node from each tree per round, until one tree runs out
+  std::vector<const Node *> pending[2];
+  int keys[2] = {0, 0};
+  if (a != nullptr)
+    pending[0].push_back(a);
+  if (b != nullptr)
+    pending[1].push_back(b);
+  while (true)
+  {
+    for (int t = 0; t < 2; ++t)
+    {
+      if (pending[t].empty())
       {
-        prevExists = 1;
-        hold = traverse->key(i);
-        if (i == m - 1 && !traverse->leaf())
-        {
-          searchNext = traverse->child(i + 1);
-        }
+        a_smaller = t == 0;
+        return keys[t];
       }
+      const Node *node = pending[t].back();
+      pending[t].pop_back();
+      keys[t] += node->keyvals.size();
+      for (int i = 0; i < node->children.size(); ++i)
+        pending[t].push_back(node->child(i));
+    }
+  }
+}
+
+// bulk build helper: smallest height whose full tree holds n keys
+template <typename K, typename V>
+int BTreeMap<K, V>::build_levels(int n)
+{
+  int h = 0;
+  long long max_keys = 0;
+  while (max_keys < n)
+  {
+    max_keys = max_keys * 4 + 3;
+    ++h;
+  }
+  return h;
+}
+
+// bulk build helper: builds a subtree of exactly the given height from
+// n sorted pairs. The pairs are split as evenly as possible between
+// as few children as can hold them; each child then gets at least
+// the 2^(levels-1) - 1 keys a subtree of its height needs.
+template <typename K, typename V>
+typename BTreeMap<K, V>::Node *BTreeMap<K, V>::build(std::pair<K, V> *pairs, int n, int levels)
+{
+  Node *st_root = new Node;
+  BTREE_COUNT(allocations);
+  if (levels == 1)
+  {
+    for (int i = 0; i < n; ++i)
+    {
+      st_root->keyvals.emplace_back(std::move(pairs[i]));
+    }
+    return st_root;
+  }
+  long long child_max = 0;
+  for (int i = 1; i < levels; ++i)
+  {
+    child_max = child_max * 4 + 3;
+  }
+  int c = 2;
+  while (n - (c - 1) > c * child_max)
+  {
+    ++c;
+  }
+  int per_child = (n - (c - 1)) / c;
+  int extra = (n - (c - 1)) % c;
+  for (int i = 0; i < c; ++i)
+  {
+    int size = per_child + (i < extra ? 1 : 0);
+    st_root->children.push_back(build(pairs, size, levels - 1));
+    pairs += size;
+    if (i < c - 1)
+    {
+      st_root->keyvals.emplace_back(std::move(*pairs));
+      ++pairs;
     }
-    traverse = searchNext;
   }
-  if (prevExists == 1)
+  return st_root;
+}
+
+// filter helper: adds an inserted key, regrowing a full filter
+template <typename K, typename V>
+void BTreeMap<K, V>::filter_insert(const K &key)
+{
+  if constexpr (is_bloom_hashable<K>::value)
+  {
+    if (filter_stale)
+    {
+      // the key is already in the tree
+      filter_rebuild();
+      return;
+    }
+    filter->add(key);
+    if (filter->added() > filter->capacity())
+    {
+      filter_rebuild();
+    }
+  }
+}
+
+// filter helper: counts an erased key; once half of the keys in the
+// filter are gone it answers "maybe" too often, so it is rebuilt
+template <typename K, typename V>
+void BTreeMap<K, V>::filter_erase()
+{
+  if (filter != nullptr and (filter_stale or ++filter_erased > filter->added() / 2))
+  {
+    filter_rebuild();
+  }
+}
+
+// filter helper: join gave the map keys the filter has not seen, so
+// it is off until the next insert or erase rebuilds it
+template <typename K, typename V>
+void BTreeMap<K, V>::filter_joined()
+{
+  if (filter != nullptr)
   {
-    next_key = hold;
-    return true;
+    filter_stale = true;
   }
-  return false;
 }
 
-// Removes all key-value pairs from the map.
+// filter helper: refills the filter from the tree, sized for twice
+// the current number of keys so the next rebuild is far off
 template <typename K, typename V>
-void BTreeMap<K, V>::clear()
+void BTreeMap<K, V>::filter_rebuild()
 {
-  clear(root);
+  if constexpr (is_bloom_hashable<K>::value)
+  {
+    if (filter == nullptr)
+    {
+      return;
+    }
+    int n = count;
+    filter.reset(new BloomFilter<K>(n < 512 ? 1024 : 2 * n, filter_bits));
+    filter_erased = 0;
+    filter_stale = false;
+    if (root != nullptr)
+    {
+      BloomFilter<K> &f = *filter;
+      auto add = [&f](const std::pair<K, V> &p) { f.add(p.first); };
+      for_each_pair(static_cast<const Node *>(root), add);
+    }
+  }
 }
 
-// Returns the height of the binary search tree
+// bulk build helper: replaces the tree with one built from the pairs
 template <typename K, typename V>
-int BTreeMap<K, V>::height() const
+void BTreeMap<K, V>::rebuild(ArraySeq<std::pair<K, V>> &pairs)
 {
-  if (empty())
+  clear();
+  int n = pairs.size();
+  if (n == 0)
   {
-    return 0;
+    return;
   }
-  else
+  tree_levels = build_levels(n);
+  root = build(pairs.data(), n, tree_levels);
+  count = n;
+  filter_rebuild();
+}
+
+// bulk build helper: in-order walk over the pairs of a subtree
+template <typename K, typename V>
+template <typename N, typename F>
+void BTreeMap<K, V>::for_each_pair(N *st_root, F &f)
+{
+  int m = st_root->keyvals.size();
+  bool leaf = st_root->leaf();
+  for (int i = 0; i < m; ++i)
+  {
+    if (!leaf)
+    {
+      // the next subtree loads while this one is walked
+      prefetch(st_root->child(i + 1));
+      for_each_pair(static_cast<N *>(st_root->child(i)), f);
+    }
+    f(st_root->keyvals.unchecked(i));
+  }
+  if (!leaf)
   {
-    return height(root);
+    for_each_pair(static_cast<N *>(st_root->child(m)), f);
   }
 }
 
-// clean up the tree memory
+// parallel find_keys helper: lists the parts overlapping [k1, k2]
 template <typename K, typename V>
-void BTreeMap<K, V>::clear(Node *st_root)
+void BTreeMap<K, V>::cut_range(const Node *st_root, int levels, const K &k1, const K &k2,
+                               std::vector<Part> &parts) const
 {
-  if (st_root == root)
+  if (levels <= parallel_levels)
   {
-    count = 0;
+    parts.push_back({st_root, -1});
+    return;
   }
-  if (st_root != nullptr)
+  int m = st_root->keyvals.size();
+  for (int i = 0; i < m; ++i)
   {
-    st_root->keyvals.clear();
-    for (int i = 0; i < st_root->children.size(); ++i)
+    const K &key = st_root->key(i);
+    if (k1 < key)
     {
-      clear(st_root->child(i));
+      cut_range(st_root->child(i), levels - 1, k1, k2, parts);
+    }
+    if (k2 < key)
+    {
+      return;
+    }
+    if (!(key < k1))
+    {
+      parts.push_back({st_root, i});
     }
-    st_root->children.clear();
   }
-  delete st_root;
-  return;
+  cut_range(st_root->child(m), levels - 1, k1, k2, parts);
 }
 
-// helper function for copy assignment
+// parallel find_keys helper: in order scan of the keys in [k1, k2]
 template <typename K, typename V>
-typename BTreeMap<K, V>::Node *BTreeMap<K, V>::copy(const Node *rhs_st_root) const
+template <typename F>
+void BTreeMap<K, V>::scan_range(const Node *st_root, const K &k1, const K &k2, F &visit)
 {
-  Node *root = nullptr;
-  if (rhs_st_root != nullptr)
+  int m = st_root->keyvals.size();
+  bool leaf = st_root->leaf();
+  for (int i = 0; i < m; ++i)
   {
-    root = new Node;
-    // use array copy assignment
-    root->keyvals = rhs_st_root->keyvals;
-
-    // traverse each child node
-    for (int i = 0; i < rhs_st_root->children.size(); ++i)
+    const K &key = st_root->key(i);
+    // the i-th child holds the keys below the i-th key
+    if (!leaf and k1 < key)
+    {
+      // the next subtree loads while this one is scanned
+      if (!(k2 < key))
+        prefetch(st_root->child(i + 1));
+      scan_range(st_root->child(i), k1, k2, visit);
+    }
+    if (k2 < key)
     {
-      root->children.insert(copy(rhs_st_root->child(i)), i);
+      return;
+    }
+    if (!(key < k1))
+    {
+      visit(st_root, i);
     }
   }
-  return root;
+  if (!leaf)
+  {
+    scan_range(st_root->child(m), k1, k2, visit);
+  }
 }
 
 // split the parent's i-th child
@@ -730,12 +2599,15 @@ template <typename K, typename V>
 void BTreeMap<K, V>::split(Node *parent, int i)
 {
   // split node
+  BTREE_COUNT(splits);
+  version++;
   Node *split = parent->child(i);
-  std::pair<K, V> second{split->key(1), split->val(1)};
+  Entry second{split->key(1), split->val(1)};
 
   // build right "NEW" node (values and children)
   Node *right = new Node;
-  std::pair<K, V> third{split->key(2), split->val(2)};
+  BTREE_COUNT(allocations);
+  Entry third{split->key(2), split->val(2)};
   right->keyvals.insert(third, 0);
 
   if (!split->leaf())
@@ -757,177 +2629,86 @@ void BTreeMap<K, V>::split(Node *parent, int i)
 
 // erase helpers
 template <typename K, typename V>
-void BTreeMap<K, V>::erase(Node *st_root, const K &key)
+bool BTreeMap<K, V>::erase(Node *st_root, const K &key)
 {
-  int child_idx = -1, m = 0;
+  int i = 0, m = 0;
 
   while (st_root)
   {
-    // case 1: leaf case
-    if (st_root->leaf())
+    BTREE_COUNT(node_visits);
+    m = st_root->keyvals.size();
+
+    // find the first key >= key
+    i = search_node<false>(st_root, key);
+
+    if (i < m and !(key < st_root->key(i)))
     {
-      for (int i = 0; i < st_root->keyvals.size(); ++i)
+      // case 1: leaf case
+      if (st_root->leaf())
       {
-        if (key == st_root->key(i))
-        {
-          st_root->keyvals.erase(i);
-          return;
-        }
+        st_root->keyvals.erase(i);
       }
-      throw std ::out_of_range(" BTreeMap <K,V >:: erase ( const K&)");
-    }
-    else
-    {
-      m = st_root->keyvals.size();
-
-      for (int i = 0; i < st_root->keyvals.size(); i++)
+      // case 2: internal node
+      else
       {
-
-        if (key > st_root->key(i))
-        {
-
-          continue;
-        }
-        if (key == st_root->key(i))
-        {
-          // case 2
-          if (!st_root->leaf())
-          {
-
-            remove_internal(st_root, i);
-          }
-          // case 1
-          else
-          {
-
-            st_root->keyvals.erase(i);
-          }
-          return;
-        }
-        // case 3, key in left child
-        else if (key < st_root->key(i))
-        {
-
-          if (st_root->child(i)->keyvals.size() == 1)
-          {
-
-            rebalance(st_root, i, i);
-          }
-          erase(st_root->child(i), key);
-          return;
-        }
+        remove_internal(st_root, i);
       }
-      // case 3, key in right child
-      if (key > st_root->key(m - 1))
-      {
+      return true;
+    }
 
-        if (st_root->child(m)->keyvals.size() == 1)
-        {
-          rebalance(st_root, m - 1, m);
-        }
-        erase(st_root->child(m), key);
-        return;
-      }
+    if (st_root->leaf())
+    {
+      return false;
+    }
+
+    // case 3: make sure the child we descend into has at least 2 keys
+    if (st_root->child(i)->keyvals.size() == 1)
+    {
+      i = rebalance(st_root, i);
     }
+    st_root = st_root->child(i);
   }
-  throw std ::out_of_range(" BTreeMap <K,V >:: erase ( const K&)");
+  throw std::out_of_range("Key is not in the collection");
 }
 
 template <typename K, typename V>
 void BTreeMap<K, V>::remove_internal(Node *st_root, int key_idx)
 {
   Node *traverse = nullptr;
-  int nodeSize = 0;
-  K new_key, this_key;
-  V new_val;
-  // case 2a: left has 2 keys
+
+  // case 2a: left has 2 keys, replace with predecessor
   if (st_root->child(key_idx)->keyvals.size() > 1)
   {
     traverse = st_root->child(key_idx);
-    while (traverse)
+    while (!traverse->leaf())
     {
-      // Find Predecessor
-      nodeSize = traverse->keyvals.size();
-      if (traverse->leaf())
-      {
-        new_key = traverse->key(nodeSize - 1);
-        new_val = traverse->val(nodeSize - 1);
-
-        // Replace key to erase with predecessor
-        std::pair<K, V> p{new_key, new_val};
-        st_root->keyvals.erase(key_idx);
-        st_root->keyvals.insert(p, key_idx);
-
-        // erase P starting from left child
-        erase(st_root->child(key_idx), traverse->key(nodeSize - 1));
-
-        return;
-      }
-      else
-      {
-        traverse = traverse->child(nodeSize);
-      }
+      traverse = traverse->child(traverse->keyvals.size());
     }
+    Entry p = traverse->keyvals.unchecked(traverse->keyvals.size() - 1);
+    st_root->keyvals.unchecked(key_idx) = p;
+
+    // erase predecessor starting from left child
+    erase(st_root->child(key_idx), p.first);
   }
-  // case 2b: right has 2 keys
+  // case 2b: right has 2 keys, replace with successor
   else if (st_root->child(key_idx + 1)->keyvals.size() > 1)
   {
     traverse = st_root->child(key_idx + 1);
-    while (traverse)
+    while (!traverse->leaf())
     {
-      // Find Successor
-      if (traverse->leaf())
-      {
-        new_key = traverse->key(0);
-        new_val = traverse->val(0);
-
-        // Replace key to erase with Successor
-        std::pair<K, V> p{new_key, new_val};
-        st_root->keyvals.erase(key_idx);
-        st_root->keyvals.insert(p, key_idx);
-
-        // erase S starting from right child
-        erase(st_root->child(key_idx + 1), traverse->key(0));
-
-        return;
-      }
-      else
-      {
-        traverse = traverse->child(0);
-      }
+      traverse = traverse->child(0);
     }
+    Entry p = traverse->keyvals.unchecked(0);
+    st_root->keyvals.unchecked(key_idx) = p;
+
+    // erase successor starting from right child
+    erase(st_root->child(key_idx + 1), p.first);
   }
   // case 2c: left and right have 1 key... MERGE
   else
   {
-    // Insert node to delete into left child
-    this_key = st_root->key(key_idx);
-    new_val = st_root->val(key_idx);
-    std::pair<K, V> p{this_key, new_val};
-    st_root->child(key_idx)->keyvals.insert(p, 1);
-
-    // Erase node
-    st_root->keyvals.erase(key_idx);
-
-    // Insert right child key and children into left child
-    new_key = st_root->child(key_idx + 1)->key(0);
-    new_val = st_root->child(key_idx + 1)->val(0);
-    std::pair<K, V> p1{new_key, new_val};
-    st_root->child(key_idx)->keyvals.insert(p1, 2);
-
-    // traverse each child node if necessary
-    if (!st_root->child(key_idx)->leaf())
-    {
-      for (int i = 0; i < 2; ++i)
-      {
-        // copy right child's children into left child's children
-        st_root->child(key_idx)->children.insert(copy(st_root->child(key_idx + 1)->child(i)), i + 2);
-      }
-    }
-
-    // delete right child node
-    clear(st_root->child(key_idx + 1));
-    st_root->children.erase(key_idx + 1);
+    K this_key = st_root->key(key_idx);
+    merge(st_root, key_idx);
 
     // Erase "node to delete" in merged child
     erase(st_root->child(key_idx), this_key);
@@ -935,222 +2716,76 @@ void BTreeMap<K, V>::remove_internal(Node *st_root, int key_idx)
 }
 
 template <typename K, typename V>
-void BTreeMap<K, V>::rebalance(Node *st_root, int key_idx, int &child_idx)
+int BTreeMap<K, V>::rebalance(Node *st_root, int child_idx)
 {
-  int m = st_root->keyvals.size(), n = 0;
-  K n_key, p_key;
-  V n_val, p_val;
-
-  // Check Case 3a: Left or Right have 2 keys
-  // OTHERWISE: Case 3b: Left and Right only have 1 key
-
-  // Remove Key from Parent
-  p_key = st_root->key(key_idx);
-  p_val = st_root->key(key_idx);
-  std::pair<K, V> p{p_key, p_val};
-  st_root->keyvals.erase(key_idx);
+  int m = st_root->keyvals.size();
+  Node *child = st_root->child(child_idx);
 
-  // c_i is far right child
-  if (child_idx == m)
+  // case 3a: borrow from left neighbor through the parent
+  if (child_idx > 0 and st_root->child(child_idx - 1)->keyvals.size() > 1)
   {
-    // check if "only neighbor" has 2 keys
-    if (st_root->child(m - 1)->keyvals.size() > 1)
-    {
-      n = st_root->child(m - 1)->keyvals.size() - 1;
-
-      n_key = st_root->child(m - 1)->key(n);
-      n_val = st_root->child(m - 1)->val(n);
-      std::pair<K, V> ne{n_key, n_val};
-      st_root->child(m - 1)->keyvals.erase(n);
-
-      st_root->keyvals.insert(ne, key_idx);
-      st_root->child(m)->keyvals.insert(p, 1);
-
-      if (!st_root->child(m - 1)->leaf())
-      {
-        st_root->child(m)->children.insert(st_root->child(m - 1)->child(2), 2);
-        st_root->child(m - 1)->children.erase(2);
-      }
-      return;
-    }
-    // case 3b --------------------------------------------------------------------------
-    else
+    BTREE_COUNT(borrows);
+    Node *left = st_root->child(child_idx - 1);
+    int n = left->keyvals.size() - 1;
+    child->keyvals.insert(st_root->keyvals.unchecked(child_idx - 1), 0);
+    st_root->keyvals.unchecked(child_idx - 1) = left->keyvals.unchecked(n);
+    left->keyvals.erase(n);
+    if (!left->leaf())
     {
-      // merge with left neighbor and key from parent
-      st_root->child(m)->keyvals.insert(p, 0);
-
-      n_key = st_root->child(m - 1)->key(0);
-      n_val = st_root->child(m - 1)->val(0);
-      std::pair<K, V> ne{n_key, n_val};
-      st_root->child(m)->keyvals.insert(ne, 0);
-
-      // copy children
-      if (!st_root->child(m - 1)->leaf())
-      {
-        st_root->child(m)->children.insert(st_root->child(m - 1)->child(0), 0);
-        st_root->child(m)->children.insert(st_root->child(m - 1)->child(1), 1);
-      }
-
-      // delete right node
-      delete st_root->child(m - 1);
-      st_root->children.erase(m - 1);
-      child_idx = m - 1;
+      child->children.insert(left->child(n + 1), 0);
+      left->children.erase(n + 1);
     }
+    return child_idx;
   }
 
-  // c_i is far left child
-  else if (child_idx == 0)
+  // case 3a: borrow from right neighbor through the parent
+  if (child_idx < m and st_root->child(child_idx + 1)->keyvals.size() > 1)
   {
-    // check if "only neighbor" has 2 keys
-    if (st_root->child(1)->keyvals.size() > 1)
-    {
-      n_key = st_root->child(1)->key(0);
-      n_val = st_root->child(1)->val(0);
-      std::pair<K, V> n{n_key, n_val};
-      st_root->child(1)->keyvals.erase(0);
-
-      st_root->keyvals.insert(n, key_idx);
-      st_root->child(0)->keyvals.insert(p, 1);
-
-      // take care of children
-      if (!st_root->child(1)->leaf())
-      {
-        st_root->child(0)->children.insert(st_root->child(1)->child(0), 2);
-        st_root->child(1)->children.erase(0);
-      }
-
-      return;
-    }
-    // case 3b ------------------------------------------------------------------------
-    else
+    BTREE_COUNT(borrows);
+    Node *right = st_root->child(child_idx + 1);
+    child->keyvals.push_back(st_root->keyvals.unchecked(child_idx));
+    st_root->keyvals.unchecked(child_idx) = right->keyvals.unchecked(0);
+    right->keyvals.erase(0);
+    if (!right->leaf())
     {
-      // merge with right neighbor and key from parent
-      st_root->child(0)->keyvals.insert(p, 1);
-
-      n_key = st_root->child(1)->key(0);
-      n_val = st_root->child(1)->val(0);
-      std::pair<K, V> ne{n_key, n_val};
-      st_root->child(0)->keyvals.insert(ne, 2);
-
-      // copy children
-      if (!st_root->child(1)->leaf())
-      {
-        st_root->child(0)->children.insert(st_root->child(1)->child(0), 2);
-        st_root->child(0)->children.insert(st_root->child(1)->child(1), 3);
-      }
-
-      // delete right node
-      delete st_root->child(1);
-      st_root->children.erase(1);
-      child_idx = 0;
+      child->children.push_back(right->child(0));
+      right->children.erase(0);
     }
+    return child_idx;
   }
 
-  // c_i is a middle child (2 neighbors)
-  else
+  // case 3b: merge with a neighbor and the key from the parent
+  if (child_idx < m)
   {
-    // right neighbor has 2
-    if (st_root->child(child_idx + 1)->keyvals.size() > 1)
-    {
-      n_key = st_root->child(child_idx + 1)->key(0);
-      n_val = st_root->child(child_idx + 1)->val(0);
-      std::pair<K, V> n{n_key, n_val};
-      st_root->child(child_idx + 1)->keyvals.erase(0);
-
-      st_root->keyvals.insert(n, key_idx);
-
-      st_root->child(0)->keyvals.insert(p, 1);
-      return;
-    }
-    // left neighbor has 2
-    else if (st_root->child(child_idx - 1)->keyvals.size() > 1)
-    {
-      n = st_root->child(child_idx - 1)->keyvals.size() - 1;
-
-      n_key = st_root->child(child_idx - 1)->key(n);
-      n_val = st_root->child(child_idx - 1)->val(n);
-      std::pair<K, V> ne{n_key, n_val};
-      st_root->child(child_idx - 1)->keyvals.erase(n);
-
-      st_root->keyvals.insert(ne, key_idx);
-
-      st_root->child(m)->keyvals.insert(p, 1);
-
-      return;
-    }
-    // case 3b --------------------------------------------------------------------
-    else
-    {
-      // merge with any neighbor (chose right) and key from parent
-      st_root->child(key_idx)->keyvals.insert(p, 1);
-      n_key = st_root->child(key_idx + 1)->key(0);
-      n_val = st_root->child(key_idx + 1)->val(0);
-      std::pair<K, V> ne{n_key, n_val};
-      st_root->child(key_idx + 1)->keyvals.erase(0);
-      st_root->child(key_idx)->keyvals.insert(ne, 2);
-
-      // copy children
-      if (!st_root->child(key_idx + 1)->leaf())
-      {
-        st_root->child(key_idx)->children.insert(st_root->child(key_idx + 1)->child(0), 2);
-        st_root->child(key_idx)->children.insert(st_root->child(key_idx + 1)->child(1), 3);
-      }
-      // delete right node
-      delete st_root->child(key_idx + 1);
-      // clear(st_root->child(key_idx + 1));
-      st_root->children.erase(key_idx + 1);
-    }
+    merge(st_root, child_idx);
+    return child_idx;
   }
-  return;
+  merge(st_root, child_idx - 1);
+  return child_idx - 1;
 }
 
-// find_keys helper
+// merge the parent's i-th and (i+1)-th children around the i-th key
 template <typename K, typename V>
-void BTreeMap<K, V>::find_keys(const K &k1, const K &k2, const Node *st_root, ArraySeq<K> &keys) const
+void BTreeMap<K, V>::merge(Node *parent, int i)
 {
-  K key;
-  Node *temp = nullptr;
-  int m = st_root->keyvals.size();
+  BTREE_COUNT(merges);
+  Node *left = parent->child(i);
+  Node *right = parent->child(i + 1);
 
-  if (st_root == nullptr)
-  {
-    return;
-  }
-
-  if (!st_root->leaf())
-  {
-    for (int i = 0; i < m; ++i)
-    {
-      temp = st_root->child(i);
-
-      find_keys(k1, k2, temp, keys);
-
-      key = st_root->key(i);
-
-      if (key >= k1 and key <= k2) // DOESN'T ENTER ?????
-      {
+  // pull the separating key down, then append the right node
+  left->keyvals.push_back(parent->keyvals.unchecked(i));
+  left->keyvals.append(right->keyvals.data(), right->keyvals.size());
+  left->children.append(right->children.data(), right->children.size());
 
-        keys.insert(key, keys.size());
-      }
-    }
+  parent->keyvals.erase(i);
+  parent->children.erase(i + 1);
 
-    temp = st_root->child(m);
+  // delete right node
+  delete right;
+  BTREE_COUNT(frees);
+}
 
-    find_keys(k1, k2, temp, keys);
-  }
 
-  else
-  {
-    for (int j = 0; j < m; ++j)
-    {
-      key = st_root->key(j);
-      if (key >= k1 and key <= k2)
-      {
-        keys.insert(key, keys.size());
-      }
-    }
-  }
-}
 
 // sorted_keys helper
 template <typename K, typename V>
@@ -1163,16 +2798,19 @@ void BTreeMap<K, V>::sorted_keys(const Node *st_root, ArraySeq<K> &keys) const
   {
     return;
   }
+  BTREE_COUNT(node_visits);
 
   if (!st_root->leaf())
   {
     for (int i = 0; i < st_root->keyvals.size(); ++i)
     {
       temp = st_root->child(i);
+      // the next subtree loads while this one is walked
+      prefetch(st_root->child(i + 1));
       sorted_keys(temp, keys);
 
       key = st_root->key(i);
-      keys.insert(key, keys.size());
+      keys.push_back(key);
     }
     temp = st_root->child(st_root->keyvals.size());
     sorted_keys(temp, keys);
@@ -1182,58 +2820,90 @@ void BTreeMap<K, V>::sorted_keys(const Node *st_root, ArraySeq<K> &keys) const
   {
     for (int i = 0; i < st_root->keyvals.size(); ++i)
     {
-      keys.insert(st_root->key(i), keys.size());
+      keys.push_back(st_root->key(i));
     }
   }
 
   return;
 }
 
-// height helper
+// stats helper
 template <typename K, typename V>
-int BTreeMap<K, V>::height(const Node *st_root) const
+void BTreeMap<K, V>::stats(const Node *st_root, int depth, BTreeStats &st) const
 {
-  int m = 0, l_chld_ht = 0, r_chld_ht = 0, root_height = 0;
-
-  if (st_root == nullptr)
+  int m = st_root->keyvals.size();
+  st.nodes++;
+  st.keys += m;
+  st.fill[m < 3 ? m : 3]++;
+  st.bytes += sizeof(Node);
+  if (!st_root->keyvals.is_inline())
+  {
+    st.bytes += st_root->keyvals.reserved() * sizeof(Entry);
+  }
+  if (!st_root->children.is_inline())
   {
-    return 0;
+    st.bytes += st_root->children.reserved() * sizeof(Node *);
   }
+  if (depth > st.height)
+  {
+    st.height = depth;
+  }
+  if (st_root->leaf())
+  {
+    st.leaves++;
+    return;
+  }
+  for (int i = 0; i < st_root->children.size(); ++i)
+  {
+    stats(st_root->child(i), depth + 1, st);
+  }
+}
 
-  m = st_root->keyvals.size();
+// validate helper
+template <typename K, typename V>
+void BTreeMap<K, V>::validate(const Node *st_root, int depth, const K *lo, const K *hi,
+                              long long &keys) const
+{
+  int m = st_root->keyvals.size();
+  if (m < 1 or m > 3)
+  {
+    throw std::logic_error("node holds " + std::to_string(m) + " keys");
+  }
   for (int i = 0; i < m; ++i)
   {
-    // Leaf -> Height = 1, no children.
-    if (st_root->leaf())
+    if (i > 0 and !(st_root->key(i - 1) < st_root->key(i)))
     {
-      return 1;
+      throw std::logic_error("keys out of order within a node");
     }
-    // First key, traverse both right and left child
-    else if (i == 0)
+    if ((lo and !(*lo < st_root->key(i))) or (hi and !(st_root->key(i) < *hi)))
     {
-      l_chld_ht = height(st_root->child(i));
-      r_chld_ht = height(st_root->child(i + 1));
-      // Take the largest of the left and right child heights
-      if (l_chld_ht > r_chld_ht)
-      {
-        root_height = l_chld_ht + 1;
-      }
-      else
-      {
-        root_height = r_chld_ht + 1;
-      }
+      throw std::logic_error("key outside of its parent's range");
     }
-    // Other keys, traverse just right child
-    else
+  }
+  keys += m;
+
+  if (st_root->leaf())
+  {
+    if (depth != tree_levels)
     {
-      r_chld_ht = height(st_root->child(i + 1));
-      // Since only right child traversed, add right child height
-      if (r_chld_ht > root_height)
-      {
-        root_height = r_chld_ht + 1;
-      }
+      throw std::logic_error("leaf at depth " + std::to_string(depth) +
+                             " but height is " + std::to_string(tree_levels));
+    }
+    return;
+  }
+  if (st_root->children.size() != m + 1)
+  {
+    throw std::logic_error("node with " + std::to_string(m) + " keys has " +
+                           std::to_string(st_root->children.size()) + " children");
+  }
+  for (int i = 0; i <= m; ++i)
+  {
+    if (st_root->child(i) == nullptr)
+    {
+      throw std::logic_error("null child pointer");
     }
-    return root_height;
+    validate(st_root->child(i), depth + 1, i > 0 ? &st_root->key(i - 1) : lo,
+             i < m ? &st_root->key(i) : hi, keys);
   }
 }
 
@@ -0,0 +1,175 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: btreemultimap.h
+// DATE: Spring 2022
+// DESC: Map allowing several values per key, on the BTreeMap node
+//       engine. Each pair is stored under the composite key (key,
+//       sequence number), where the sequence number counts the inserts,
+//       so the pairs of one key sit next to each other in the tree in
+//       the order they were inserted.
+//---------------------------------------------------------------------------
+
+#ifndef BTREEMULTIMAP_H
+#define BTREEMULTIMAP_H
+
+#include <limits>
+#include <utility>
+#include "arrayseq.h"
+#include "btreemap.h"
+
+template <typename K, typename V>
+class BTreeMultiMap
+{
+public:
+  // Returns the number of key-value pairs
+  int size() const { return map.size(); }
+
+  // Tests if the multimap is empty
+  bool empty() const { return map.empty(); }
+
+  // Adds the pair, after any pairs already stored with the same key
+  void insert(const K &key, const V &value);
+
+  // Removes every pair with the given key and returns how many there
+  // were
+  int erase(const K &key);
+
+  // Returns true if at least one pair has the given key
+  bool contains(const K &key) const;
+
+  // Returns the number of pairs with the given key
+  int count(const K &key) const;
+
+  // Returns the values of the pairs with the given key, in insertion
+  // order (empty if there are none)
+  ArraySeq<V> values(const K &key) const;
+
+  // Returns the keys k of the pairs such that k1 <= k <= k2 in
+  // ascending order, a key appearing once per pair
+  ArraySeq<K> find_keys(const K &k1, const K &k2) const;
+
+  // Returns the keys of all the pairs in ascending order (with repeats)
+  ArraySeq<K> sorted_keys() const;
+
+  // Gives the closest distinct key after (next_key) or before
+  // (prev_key) the given key. Returns false if there is none.
+  bool next_key(const K &key, K &next_key) const;
+  bool prev_key(const K &key, K &next_key) const;
+
+  // Removes every pair
+  void clear() { map.clear(); }
+
+  // Tree shape, invariant checks and memory use
+  int height() const { return map.height(); }
+  void validate() const { map.validate(); }
+  BTreeStats stats() const { return map.stats(); }
+
+private:
+  using Seq = unsigned long long;
+  using Key = std::pair<K, Seq>;
+
+  // sequence numbers start at 1, so (key, 0) and (key, max) bound
+  // every composite key of key without being one
+  static Key lowest(const K &key) { return {key, 0}; }
+  static Key highest(const K &key) { return {key, std::numeric_limits<Seq>::max()}; }
+
+  BTreeMap<Key, V> map;
+
+  // sequence number of the next insert
+  Seq next_seq = 1;
+};
+
+template <typename K, typename V>
+void BTreeMultiMap<K, V>::insert(const K &key, const V &value)
+{
+  map.insert({key, next_seq++}, value);
+}
+
+template <typename K, typename V>
+int BTreeMultiMap<K, V>::erase(const K &key)
+{
+  ArraySeq<Key> keys = map.find_keys(lowest(key), highest(key));
+  for (int i = 0; i < keys.size(); ++i)
+  {
+    map.erase(keys.unchecked(i));
+  }
+  return keys.size();
+}
+
+template <typename K, typename V>
+bool BTreeMultiMap<K, V>::contains(const K &key) const
+{
+  Key next;
+  return map.next_key(lowest(key), next) and !(key < next.first);
+}
+
+template <typename K, typename V>
+int BTreeMultiMap<K, V>::count(const K &key) const
+{
+  return map.find_keys(lowest(key), highest(key)).size();
+}
+
+template <typename K, typename V>
+ArraySeq<V> BTreeMultiMap<K, V>::values(const K &key) const
+{
+  ArraySeq<std::pair<Key, V>> pairs = map.find_pairs(lowest(key), highest(key));
+  ArraySeq<V> found;
+  found.reserve(pairs.size());
+  for (int i = 0; i < pairs.size(); ++i)
+  {
+    found.push_back(pairs.unchecked(i).second);
+  }
+  return found;
+}
+
+template <typename K, typename V>
+ArraySeq<K> BTreeMultiMap<K, V>::find_keys(const K &k1, const K &k2) const
+{
+  ArraySeq<Key> keys = map.find_keys(lowest(k1), highest(k2));
+  ArraySeq<K> found;
+  found.reserve(keys.size());
+  for (int i = 0; i < keys.size(); ++i)
+  {
+    found.push_back(keys.unchecked(i).first);
+  }
+  return found;
+}
+
+template <typename K, typename V>
+ArraySeq<K> BTreeMultiMap<K, V>::sorted_keys() const
+{
+  ArraySeq<Key> keys = map.sorted_keys();
+  ArraySeq<K> found;
+  found.reserve(keys.size());
+  for (int i = 0; i < keys.size(); ++i)
+  {
+    found.push_back(keys.unchecked(i).first);
+  }
+  return found;
+}
+
+template <typename K, typename V>
+bool BTreeMultiMap<K, V>::next_key(const K &key, K &next_key) const
+{
+  Key next;
+  if (!map.next_key(highest(key), next))
+  {
+    return false;
+  }
+  next_key = next.first;
+  return true;
+}
+
+template <typename K, typename V>
+bool BTreeMultiMap<K, V>::prev_key(const K &key, K &next_key) const
+{
+  Key prev;
+  if (!map.prev_key(lowest(key), prev))
+  {
+    return false;
+  }
+  next_key = prev.first;
+  return true;
+}
+
+#endif
@@ -0,0 +1,95 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: btreeset.h
+// DATE: Spring 2022
+// DESC: Set of keys on the BTreeMap node engine. The map's value type
+//       is the empty BTreeNoValue, so its nodes store the keys alone
+//       (no dummy value next to each key as with BTreeMap<K, char>).
+//---------------------------------------------------------------------------
+
+#ifndef BTREESET_H
+#define BTREESET_H
+
+#include "arrayseq.h"
+#include "btreemap.h"
+
+// Value type of a BTreeSet's map (takes no space in the nodes). All
+// of them are equal, so pairs of them compare by key.
+struct BTreeNoValue
+{
+  friend bool operator==(BTreeNoValue, BTreeNoValue) { return true; }
+  friend bool operator<(BTreeNoValue, BTreeNoValue) { return false; }
+};
+
+template <typename K>
+class BTreeSet
+{
+public:
+  // Returns the number of keys in the set
+  int size() const { return map.size(); }
+
+  // Tests if the set is empty
+  bool empty() const { return map.empty(); }
+
+  // Adds the key. Returns false if it was already in the set.
+  bool insert(const K &key) { return map.insert_or_assign(key, BTreeNoValue()); }
+
+  // Removes the key. Returns false if it was not in the set.
+  bool erase(const K &key) { return map.try_erase(key); }
+
+  // Returns true if the key is in the set, and false otherwise
+  bool contains(const K &key) const { return map.contains(key); }
+
+  // Sets found[j] to whether keys[j] is in the set, for each of the n
+  // keys (see BTreeMap's batched contains)
+  void contains(const K *keys, int n, bool *found) const { map.contains(keys, n, found); }
+
+  // Returns the keys k in the set such that k1 <= k <= k2
+  ArraySeq<K> find_keys(const K &k1, const K &k2) const { return map.find_keys(k1, k2); }
+
+  // Returns the keys in ascending sorted order
+  ArraySeq<K> sorted_keys() const { return map.sorted_keys(); }
+
+  // Gives the key immediately after (next_key) or before (prev_key)
+  // the given key in ascending order. Returns false if there is none.
+  bool next_key(const K &key, K &next_key) const { return map.next_key(key, next_key); }
+  bool prev_key(const K &key, K &next_key) const { return map.prev_key(key, next_key); }
+
+  // Removes every key
+  void clear() { map.clear(); }
+
+  // Set algebra (see BTreeMap::unite, intersect and subtract)
+  void unite(const BTreeSet &rhs) { map.unite(rhs.map); }
+  void intersect(const BTreeSet &rhs) { map.intersect(rhs.map); }
+  void subtract(const BTreeSet &rhs) { map.subtract(rhs.map); }
+
+  // Moves the keys >= key into a new set (see BTreeMap::split_at)
+  BTreeSet split_at(const K &key)
+  {
+    BTreeSet upper;
+    upper.map = map.split_at(key);
+    return upper;
+  }
+
+  // Moves every key of other into this set; the key ranges must not
+  // overlap (see BTreeMap::join)
+  void join(BTreeSet &other) { map.join(other.map); }
+
+  // Optional Bloom filter in front of contains (see BTreeMap)
+  void enable_filter(int bits_per_key = 10) { map.enable_filter(bits_per_key); }
+  void disable_filter() { map.disable_filter(); }
+
+  // Optional hot-key cache in front of contains (see BTreeMap)
+  void enable_cache(int entries = 4096) { map.enable_cache(entries); }
+  void disable_cache() { map.disable_cache(); }
+
+  // Tree shape, invariant checks and memory use
+  int height() const { return map.height(); }
+  void validate() const { map.validate(); }
+  BTreeStats stats() const { return map.stats(); }
+
+private:
+  BTreeMap<K, BTreeNoValue> map;
+};
+
+#endif
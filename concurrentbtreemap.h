@@ -0,0 +1,676 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: concurrentbtreemap.h
+// DATE: Spring 2022
+// DESC: 2-3-4 B-Tree map for read-mostly concurrent use. Published
+//       nodes are never modified: writers (serialized by a mutex)
+//       copy the nodes on the path they change, publish the new root
+//       with an atomic store, and retire the replaced nodes through
+//       epoch-based reclamation. Readers only pin an epoch and follow
+//       pointers, so they never take a lock or perform an atomic
+//       read-modify-write.
+//---------------------------------------------------------------------------
+
+#ifndef CONCURRENTBTREEMAP_H
+#define CONCURRENTBTREEMAP_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include "arrayseq.h"
+#include "smallarrayseq.h"
+#include "epoch.h"
+
+template <typename K, typename V>
+class ConcurrentBTreeMap
+{
+public:
+  // default constructor
+  ConcurrentBTreeMap();
+
+  // not copyable (take a snapshot with sorted_keys() and operator[])
+  ConcurrentBTreeMap(const ConcurrentBTreeMap &rhs) = delete;
+  ConcurrentBTreeMap &operator=(const ConcurrentBTreeMap &rhs) = delete;
+
+  // destructor (no other thread may be using the map)
+  ~ConcurrentBTreeMap();
+
+  // Returns the number of key-value pairs in the map
+  int size() const;
+
+  // Tests if the map is empty
+  bool empty() const;
+
+  // Returns a copy of the value for a given key (a reference could
+  // outlive the node it points into). Throws out_of_range if the given
+  // key is not in the collection.
+  V operator[](const K &key) const;
+
+  // Copies the value for the key into value and returns true, or
+  // returns false if the key is not in the collection.
+  bool find(const K &key, V &value) const;
+
+  // Adds the key-value pair, or replaces the value if the key is
+  // already in the collection.
+  void insert(const K &key, const V &value);
+
+  // Removes the key-value pair with the given key. Throws out_of_range
+  // if the given key is not in the collection.
+  void erase(const K &key);
+
+  // Returns true if the key is in the collection, and false otherwise.
+  bool contains(const K &key) const;
+
+  // Returns the keys k in the collection such that k1 <= k <= k2
+  ArraySeq<K> find_keys(const K &k1, const K &k2) const;
+
+  // Returns the keys in the collection in ascending sorted order
+  ArraySeq<K> sorted_keys() const;
+
+  // Gives the key (as an ouptput parameter) immediately after the
+  // given key according to ascending sort order. Returns true if a
+  // successor key exists, and false otherwise.
+  bool next_key(const K &key, K &next_key) const;
+
+  // Gives the key (as an ouptput parameter) immediately before the
+  // given key according to ascending sort order. Returns true if a
+  // predecessor key exists, and false otherwise.
+  bool prev_key(const K &key, K &next_key) const;
+
+  // Removes all key-value pairs from the map.
+  void clear();
+
+  // Returns the height of the tree
+  int height() const;
+
+private:
+  // node for 2-3-4 tree; immutable once reachable from root
+  struct Node
+  {
+    SmallArraySeq<std::pair<K, V>, 3> keyvals;
+    SmallArraySeq<Node *, 4> children;
+    // the write that created the node (it may only be changed by
+    // that write, before it is published)
+    std::uint64_t version = 0;
+    // helper functions
+    bool full() const { return keyvals.size() == 3; }
+    bool leaf() const { return children.empty(); }
+    const K &key(int i) const { return keyvals.unchecked(i).first; }
+    V &val(int i) { return keyvals.unchecked(i).second; }
+    const V &val(int i) const { return keyvals.unchecked(i).second; }
+    Node *child(int i) const { return children.unchecked(i); }
+  };
+
+  // published root
+  std::atomic<Node *> root{nullptr};
+
+  // number of key-value pairs and levels in the published tree
+  std::atomic<int> count{0};
+  std::atomic<int> levels{0};
+
+  // serializes writers; everything below is only used by the writer
+  std::mutex write_mutex;
+
+  // id of the current write
+  std::uint64_t write_version = 0;
+
+  // published nodes replaced by the current write
+  ArraySeq<Node *> replaced;
+
+  // returns the first index i with key <= n->key(i) (or the key count)
+  static int lower_bound(const Node *n, const K &key);
+
+  // returns the node if the current write created it, otherwise a
+  // private copy of it (and remembers the original for retirement)
+  Node *own(Node *n);
+
+  // creates a node belonging to the current write
+  Node *make();
+
+  // drops a node that is no longer part of the new tree
+  void discard(Node *n);
+
+  // publishes the new root and retires the replaced nodes
+  void publish(Node *new_root);
+
+  // split the parent's i-th child (parent must be owned)
+  void split(Node *parent, int i);
+
+  // merge the parent's i-th and (i+1)-th children around the i-th key
+  // (parent must be owned)
+  void merge(Node *parent, int i);
+
+  // gives the parent's child_idx-th child a second key by borrowing or
+  // merging; returns the index of the child to descend into
+  int rebalance(Node *parent, int child_idx);
+
+  // erase helper (st_root must be owned and contain the key below it)
+  void erase(Node *st_root, const K &key);
+
+  // read helpers (run while pinned)
+  const Node *search(const K &key, int &idx) const;
+  void find_keys(const K &k1, const K &k2, const Node *st_root, ArraySeq<K> &keys) const;
+
+  // deleters handed to the epoch domain
+  static void delete_node(void *p) { delete static_cast<Node *>(p); }
+  static void delete_tree(void *p);
+};
+
+template <typename K, typename V>
+ConcurrentBTreeMap<K, V>::ConcurrentBTreeMap()
+{
+}
+
+template <typename K, typename V>
+ConcurrentBTreeMap<K, V>::~ConcurrentBTreeMap()
+{
+  delete_tree(root.load(std::memory_order_relaxed));
+}
+
+template <typename K, typename V>
+int ConcurrentBTreeMap<K, V>::size() const
+{
+  return count.load(std::memory_order_relaxed);
+}
+
+template <typename K, typename V>
+bool ConcurrentBTreeMap<K, V>::empty() const
+{
+  return root.load(std::memory_order_relaxed) == nullptr;
+}
+
+template <typename K, typename V>
+int ConcurrentBTreeMap<K, V>::height() const
+{
+  return levels.load(std::memory_order_relaxed);
+}
+
+template <typename K, typename V>
+V ConcurrentBTreeMap<K, V>::operator[](const K &key) const
+{
+  EpochDomain::Guard guard(EpochDomain::global());
+  int idx = 0;
+  const Node *n = search(key, idx);
+  if (n == nullptr)
+  {
+    throw std::out_of_range("Key is not in the collection");
+  }
+  return n->val(idx);
+}
+
+template <typename K, typename V>
+bool ConcurrentBTreeMap<K, V>::find(const K &key, V &value) const
+{
+  EpochDomain::Guard guard(EpochDomain::global());
+  int idx = 0;
+  const Node *n = search(key, idx);
+  if (n == nullptr)
+  {
+    return false;
+  }
+  value = n->val(idx);
+  return true;
+}
+
+template <typename K, typename V>
+bool ConcurrentBTreeMap<K, V>::contains(const K &key) const
+{
+  EpochDomain::Guard guard(EpochDomain::global());
+  int idx = 0;
+  return search(key, idx) != nullptr;
+}
+
+template <typename K, typename V>
+ArraySeq<K> ConcurrentBTreeMap<K, V>::find_keys(const K &k1, const K &k2) const
+{
+  EpochDomain::Guard guard(EpochDomain::global());
+  ArraySeq<K> keys;
+  const Node *r = root.load(std::memory_order_acquire);
+  if (r != nullptr)
+  {
+    find_keys(k1, k2, r, keys);
+  }
+  return keys;
+}
+
+template <typename K, typename V>
+ArraySeq<K> ConcurrentBTreeMap<K, V>::sorted_keys() const
+{
+  EpochDomain::Guard guard(EpochDomain::global());
+  ArraySeq<K> keys;
+  const Node *r = root.load(std::memory_order_acquire);
+  if (r == nullptr)
+  {
+    return keys;
+  }
+  // descend to the leftmost leaf to get the bounds for a full scan
+  const Node *lo = r;
+  while (!lo->leaf())
+    lo = lo->child(0);
+  const Node *hi = r;
+  while (!hi->leaf())
+    hi = hi->child(hi->children.size() - 1);
+  find_keys(lo->key(0), hi->key(hi->keyvals.size() - 1), r, keys);
+  return keys;
+}
+
+template <typename K, typename V>
+bool ConcurrentBTreeMap<K, V>::next_key(const K &key, K &next_key) const
+{
+  EpochDomain::Guard guard(EpochDomain::global());
+  const Node *n = root.load(std::memory_order_acquire);
+  bool found = false;
+  while (n != nullptr)
+  {
+    // first key greater than key
+    int m = n->keyvals.size(), i = 0;
+    while (i < m and !(key < n->key(i)))
+      ++i;
+    if (i < m)
+    {
+      next_key = n->key(i);
+      found = true;
+    }
+    n = n->leaf() ? nullptr : n->child(i);
+  }
+  return found;
+}
+
+template <typename K, typename V>
+bool ConcurrentBTreeMap<K, V>::prev_key(const K &key, K &next_key) const
+{
+  EpochDomain::Guard guard(EpochDomain::global());
+  const Node *n = root.load(std::memory_order_acquire);
+  bool found = false;
+  while (n != nullptr)
+  {
+    int i = lower_bound(n, key);
+    if (i > 0)
+    {
+      next_key = n->key(i - 1);
+      found = true;
+    }
+    n = n->leaf() ? nullptr : n->child(i);
+  }
+  return found;
+}
+
+template <typename K, typename V>
+void ConcurrentBTreeMap<K, V>::insert(const K &key, const V &value)
+{
+  std::lock_guard<std::mutex> lock(write_mutex);
+  ++write_version;
+  std::pair<K, V> p{key, value};
+
+  // empty tree
+  Node *r = root.load(std::memory_order_relaxed);
+  if (r == nullptr)
+  {
+    r = make();
+    r->keyvals.push_back(p);
+    levels.store(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    publish(r);
+    return;
+  }
+
+  // root is full
+  r = own(r);
+  if (r->full())
+  {
+    Node *left = r;
+    r = make();
+    r->children.push_back(left);
+    split(r, 0);
+    levels.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  Node *curr = r;
+  while (true)
+  {
+    int i = lower_bound(curr, key);
+    if (i < curr->keyvals.size() and key == curr->key(i))
+    {
+      curr->val(i) = value;
+      break;
+    }
+    if (curr->leaf())
+    {
+      curr->keyvals.insert(p, i);
+      count.fetch_add(1, std::memory_order_relaxed);
+      break;
+    }
+    // split full children on the way down
+    if (curr->child(i)->full())
+    {
+      split(curr, i);
+      if (key == curr->key(i))
+      {
+        curr->val(i) = value;
+        break;
+      }
+      if (curr->key(i) < key)
+      {
+        ++i;
+      }
+    }
+    Node *next = own(curr->child(i));
+    curr->children.unchecked(i) = next;
+    curr = next;
+  }
+  publish(r);
+}
+
+template <typename K, typename V>
+void ConcurrentBTreeMap<K, V>::erase(const K &key)
+{
+  std::lock_guard<std::mutex> lock(write_mutex);
+
+  // nothing can be reclaimed while we hold the writer lock, so the
+  // check can run unpinned
+  int idx = 0;
+  if (search(key, idx) == nullptr)
+  {
+    throw std::out_of_range("Key is not in the collection");
+  }
+
+  ++write_version;
+  Node *r = own(root.load(std::memory_order_relaxed));
+  erase(r, key);
+  if (r->keyvals.empty())
+  {
+    Node *left_child = r->leaf() ? nullptr : r->child(0);
+    discard(r);
+    r = left_child;
+    levels.fetch_sub(1, std::memory_order_relaxed);
+  }
+  count.fetch_sub(1, std::memory_order_relaxed);
+  publish(r);
+}
+
+template <typename K, typename V>
+void ConcurrentBTreeMap<K, V>::clear()
+{
+  std::lock_guard<std::mutex> lock(write_mutex);
+  Node *old = root.load(std::memory_order_relaxed);
+  root.store(nullptr, std::memory_order_release);
+  count.store(0, std::memory_order_relaxed);
+  levels.store(0, std::memory_order_relaxed);
+  if (old != nullptr)
+  {
+    EpochDomain::global().retire(old, &delete_tree);
+  }
+}
+
+template <typename K, typename V>
+int ConcurrentBTreeMap<K, V>::lower_bound(const Node *n, const K &key)
+{
+  int m = n->keyvals.size(), i = 0;
+  while (i < m and n->key(i) < key)
+    ++i;
+  return i;
+}
+
+template <typename K, typename V>
+typename ConcurrentBTreeMap<K, V>::Node *ConcurrentBTreeMap<K, V>::own(Node *n)
+{
+  if (n->version == write_version)
+  {
+    return n;
+  }
+  Node *copy = new Node;
+  copy->keyvals = n->keyvals;
+  copy->children = n->children;
+  copy->version = write_version;
+  replaced.push_back(n);
+  return copy;
+}
+
+template <typename K, typename V>
+typename ConcurrentBTreeMap<K, V>::Node *ConcurrentBTreeMap<K, V>::make()
+{
+  Node *n = new Node;
+  n->version = write_version;
+  return n;
+}
+
+template <typename K, typename V>
+void ConcurrentBTreeMap<K, V>::discard(Node *n)
+{
+  if (n->version == write_version)
+  {
+    delete n;
+  }
+  else
+  {
+    replaced.push_back(n);
+  }
+}
+
+template <typename K, typename V>
+void ConcurrentBTreeMap<K, V>::publish(Node *new_root)
+{
+  root.store(new_root, std::memory_order_release);
+  EpochDomain &domain = EpochDomain::global();
+  for (int i = 0; i < replaced.size(); ++i)
+  {
+    domain.retire(replaced.unchecked(i), &delete_node);
+  }
+  replaced.clear();
+}
+
+template <typename K, typename V>
+void ConcurrentBTreeMap<K, V>::split(Node *parent, int i)
+{
+  Node *left = own(parent->child(i));
+  parent->children.unchecked(i) = left;
+
+  // build right "NEW" node (values and children)
+  Node *right = make();
+  right->keyvals.push_back(left->keyvals.unchecked(2));
+  if (!left->leaf())
+  {
+    right->children.push_back(left->child(2));
+    right->children.push_back(left->child(3));
+    left->children.erase(3);
+    left->children.erase(2);
+  }
+
+  // insert middle element into parent node / update children
+  parent->children.insert(right, i + 1);
+  parent->keyvals.insert(left->keyvals.unchecked(1), i);
+
+  left->keyvals.erase(2);
+  left->keyvals.erase(1);
+}
+
+template <typename K, typename V>
+void ConcurrentBTreeMap<K, V>::merge(Node *parent, int i)
+{
+  Node *left = own(parent->child(i));
+  Node *right = parent->child(i + 1);
+
+  left->keyvals.push_back(parent->keyvals.unchecked(i));
+  left->keyvals.append(right->keyvals.data(), right->keyvals.size());
+  left->children.append(right->children.data(), right->children.size());
+
+  parent->keyvals.erase(i);
+  parent->children.erase(i + 1);
+  parent->children.unchecked(i) = left;
+  discard(right);
+}
+
+template <typename K, typename V>
+int ConcurrentBTreeMap<K, V>::rebalance(Node *parent, int child_idx)
+{
+  int m = parent->keyvals.size();
+
+  // borrow from left neighbor through the parent
+  if (child_idx > 0 and parent->child(child_idx - 1)->keyvals.size() > 1)
+  {
+    Node *left = own(parent->child(child_idx - 1));
+    Node *child = own(parent->child(child_idx));
+    parent->children.unchecked(child_idx - 1) = left;
+    parent->children.unchecked(child_idx) = child;
+    int n = left->keyvals.size() - 1;
+    child->keyvals.insert(parent->keyvals.unchecked(child_idx - 1), 0);
+    parent->keyvals.unchecked(child_idx - 1) = left->keyvals.unchecked(n);
+    left->keyvals.erase(n);
+    if (!left->leaf())
+    {
+      child->children.insert(left->child(n + 1), 0);
+      left->children.erase(n + 1);
+    }
+    return child_idx;
+  }
+
+  // borrow from right neighbor through the parent
+  if (child_idx < m and parent->child(child_idx + 1)->keyvals.size() > 1)
+  {
+    Node *right = own(parent->child(child_idx + 1));
+    Node *child = own(parent->child(child_idx));
+    parent->children.unchecked(child_idx + 1) = right;
+    parent->children.unchecked(child_idx) = child;
+    child->keyvals.push_back(parent->keyvals.unchecked(child_idx));
+    parent->keyvals.unchecked(child_idx) = right->keyvals.unchecked(0);
+    right->keyvals.erase(0);
+    if (!right->leaf())
+    {
+      child->children.push_back(right->child(0));
+      right->children.erase(0);
+    }
+    return child_idx;
+  }
+
+  // merge with a neighbor and the key from the parent
+  if (child_idx < m)
+  {
+    merge(parent, child_idx);
+    return child_idx;
+  }
+  merge(parent, child_idx - 1);
+  return child_idx - 1;
+}
+
+template <typename K, typename V>
+void ConcurrentBTreeMap<K, V>::erase(Node *st_root, const K &key)
+{
+  K target = key;
+  while (true)
+  {
+    int i = lower_bound(st_root, target);
+    if (i < st_root->keyvals.size() and target == st_root->key(i))
+    {
+      if (st_root->leaf())
+      {
+        st_root->keyvals.erase(i);
+        return;
+      }
+      if (st_root->child(i)->keyvals.size() > 1)
+      {
+        // replace with predecessor, then erase it from the left child
+        Node *left = own(st_root->child(i));
+        st_root->children.unchecked(i) = left;
+        const Node *traverse = left;
+        while (!traverse->leaf())
+          traverse = traverse->child(traverse->children.size() - 1);
+        st_root->keyvals.unchecked(i) = traverse->keyvals.unchecked(traverse->keyvals.size() - 1);
+        target = st_root->key(i);
+        st_root = left;
+      }
+      else if (st_root->child(i + 1)->keyvals.size() > 1)
+      {
+        // replace with successor, then erase it from the right child
+        Node *right = own(st_root->child(i + 1));
+        st_root->children.unchecked(i + 1) = right;
+        const Node *traverse = right;
+        while (!traverse->leaf())
+          traverse = traverse->child(0);
+        st_root->keyvals.unchecked(i) = traverse->keyvals.unchecked(0);
+        target = st_root->key(i);
+        st_root = right;
+      }
+      else
+      {
+        merge(st_root, i);
+        st_root = st_root->child(i);
+      }
+      continue;
+    }
+    if (st_root->leaf())
+    {
+      throw std::out_of_range("Key is not in the collection");
+    }
+    if (st_root->child(i)->keyvals.size() == 1)
+    {
+      i = rebalance(st_root, i);
+    }
+    Node *next = own(st_root->child(i));
+    st_root->children.unchecked(i) = next;
+    st_root = next;
+  }
+}
+
+template <typename K, typename V>
+const typename ConcurrentBTreeMap<K, V>::Node *ConcurrentBTreeMap<K, V>::search(const K &key, int &idx) const
+{
+  const Node *n = root.load(std::memory_order_acquire);
+  while (n != nullptr)
+  {
+    int i = lower_bound(n, key);
+    if (i < n->keyvals.size() and key == n->key(i))
+    {
+      idx = i;
+      return n;
+    }
+    n = n->leaf() ? nullptr : n->child(i);
+  }
+  return nullptr;
+}
+
+template <typename K, typename V>
+void ConcurrentBTreeMap<K, V>::find_keys(const K &k1, const K &k2, const Node *st_root,
+                                         ArraySeq<K> &keys) const
+{
+  int m = st_root->keyvals.size();
+  for (int i = 0; i < m; ++i)
+  {
+    const K &key = st_root->key(i);
+    // the i-th child holds keys less than key
+    if (!st_root->leaf() and k1 < key)
+    {
+      find_keys(k1, k2, st_root->child(i), keys);
+    }
+    if (k2 < key)
+    {
+      return;
+    }
+    if (!(key < k1))
+    {
+      keys.push_back(key);
+    }
+  }
+  if (!st_root->leaf())
+  {
+    find_keys(k1, k2, st_root->child(m), keys);
+  }
+}
+
+template <typename K, typename V>
+void ConcurrentBTreeMap<K, V>::delete_tree(void *p)
+{
+  Node *n = static_cast<Node *>(p);
+  if (n == nullptr)
+  {
+    return;
+  }
+  for (int i = 0; i < n->children.size(); ++i)
+  {
+    delete_tree(n->child(i));
+  }
+  delete n;
+}
+
+#endif
@@ -0,0 +1,188 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: epoch.h
+// DATE: Spring 2022
+// DESC: Epoch-based memory reclamation. Readers pin the current epoch
+//       while they traverse shared nodes; writers retire nodes they
+//       have unlinked, and a retired node is freed once every reader
+//       that could still see it has unpinned.
+//---------------------------------------------------------------------------
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+class EpochDomain
+{
+  // one registered thread's announcement (0 when not pinned)
+  struct alignas(64) Slot
+  {
+    std::atomic<std::uint64_t> epoch{0};
+    std::atomic<bool> used{false};
+    int depth = 0;
+  };
+
+public:
+  // Maximum number of threads that can be registered at once
+  static const int max_threads = 256;
+
+  // Number of retirements between reclamation attempts
+  static const int reclaim_every = 64;
+
+  // The process-wide domain
+  static EpochDomain &global()
+  {
+    static EpochDomain domain;
+    return domain;
+  }
+
+  // Keeps the calling thread pinned while in scope. Pins nest; only
+  // the outermost one publishes an epoch. Pinning writes only the
+  // thread's own (cache line padded) slot: one store and one fence,
+  // no read-modify-write on shared data.
+  class Guard
+  {
+  public:
+    explicit Guard(EpochDomain &domain) : slot(domain.local_slot())
+    {
+      if (slot.depth++ == 0)
+      {
+        slot.epoch.store(domain.epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        // the announcement must be visible before any shared pointer
+        // is read
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+      }
+    }
+    ~Guard()
+    {
+      if (--slot.depth == 0)
+      {
+        slot.epoch.store(0, std::memory_order_release);
+      }
+    }
+    Guard(const Guard &) = delete;
+    Guard &operator=(const Guard &) = delete;
+
+  private:
+    Slot &slot;
+  };
+
+  // Hands a node that is no longer reachable from the shared structure
+  // to the domain; deleter(p) runs once no pinned reader can hold it.
+  // The node must already be unlinked (e.g., by an atomic store of a
+  // new root) when this is called.
+  void retire(void *p, void (*deleter)(void *))
+  {
+    // order the unlinking store before reading the epoch
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::lock_guard<std::mutex> lock(retired_mutex);
+    retired.push_back({p, deleter, epoch.load(std::memory_order_relaxed)});
+    if (++since_reclaim >= reclaim_every)
+    {
+      since_reclaim = 0;
+      epoch.fetch_add(1, std::memory_order_acq_rel);
+      reclaim_locked();
+    }
+  }
+
+  // Frees every retired node that no pinned reader can still hold
+  void reclaim()
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::lock_guard<std::mutex> lock(retired_mutex);
+    epoch.fetch_add(1, std::memory_order_acq_rel);
+    reclaim_locked();
+  }
+
+  // Number of retired nodes waiting to be freed
+  std::size_t pending() const
+  {
+    std::lock_guard<std::mutex> lock(retired_mutex);
+    return retired.size();
+  }
+
+  ~EpochDomain()
+  {
+    for (const Retired &r : retired)
+      r.deleter(r.p);
+  }
+
+private:
+  // use global(); thread registrations are shared, so there is only one
+  // domain per process
+  EpochDomain() {}
+
+  struct Retired
+  {
+    void *p;
+    void (*deleter)(void *);
+    std::uint64_t epoch;
+  };
+
+  Slot slots[max_threads];
+  std::atomic<std::uint64_t> epoch{1};
+
+  mutable std::mutex retired_mutex;
+  std::vector<Retired> retired;
+  int since_reclaim = 0;
+
+  // releases a thread's slot when the thread exits
+  struct Registration
+  {
+    Slot *slot = nullptr;
+    ~Registration()
+    {
+      if (slot != nullptr)
+        slot->used.store(false, std::memory_order_release);
+    }
+  };
+
+  Slot &local_slot()
+  {
+    thread_local Registration reg;
+    if (reg.slot == nullptr)
+    {
+      for (Slot &s : slots)
+      {
+        bool expected = false;
+        if (!s.used.load(std::memory_order_relaxed) and
+            s.used.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+        {
+          reg.slot = &s;
+          break;
+        }
+      }
+      if (reg.slot == nullptr)
+        throw std::runtime_error("EpochDomain: too many threads");
+    }
+    return *reg.slot;
+  }
+
+  // frees nodes retired before the oldest epoch still pinned
+  void reclaim_locked()
+  {
+    std::uint64_t oldest = epoch.load(std::memory_order_relaxed);
+    for (const Slot &s : slots)
+    {
+      std::uint64_t e = s.epoch.load(std::memory_order_acquire);
+      if (e != 0 and e < oldest)
+        oldest = e;
+    }
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < retired.size(); ++i)
+    {
+      if (retired[i].epoch < oldest)
+        retired[i].deleter(retired[i].p);
+      else
+        retired[kept++] = retired[i];
+    }
+    retired.resize(kept);
+  }
+};
+
+#endif
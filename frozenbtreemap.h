@@ -0,0 +1,253 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: frozenbtreemap.h
+// DATE: Spring 2022
+// DESC: Read-only map built once from a BTreeMap (BTreeMap::freeze()).
+//       The pairs are kept in two sorted arrays (keys and values) with
+//       no pointers or per-node overhead. Lookups search a small index
+//       holding the first key of every block of block_size keys, laid
+//       out in Eytzinger (breadth first) order so the child positions
+//       of index entry i are implicit (2i and 2i + 1) and the top of
+//       the search stays in a few cache lines, and then scan the one
+//       block the key can be in.
+//---------------------------------------------------------------------------
+
+#ifndef FROZENBTREEMAP_H
+#define FROZENBTREEMAP_H
+
+#include <stdexcept>
+#include <utility>
+#include "arrayseq.h"
+#include "btreemap.h"
+
+template <typename K, typename V>
+class FrozenBTreeMap
+{
+public:
+  // keys per block of the sorted arrays (one index entry each)
+  static const int block_size = 16;
+
+  // empty map
+  FrozenBTreeMap() = default;
+
+  // Builds the map from the n pairs starting at pairs, which must be in
+  // strictly ascending key order (throws invalid_argument otherwise)
+  FrozenBTreeMap(const std::pair<K, V> *pairs, int n);
+
+  // Returns the number of key-value pairs in the map
+  int size() const { return keys.size(); }
+
+  // Tests if the map is empty
+  bool empty() const { return keys.empty(); }
+
+  // Returns the value for a given key. Throws out_of_range if the
+  // given key is not in the collection.
+  const V &operator[](const K &key) const;
+
+  // Returns a pointer to the value for key, or nullptr if key is not
+  // in the collection
+  const V *find(const K &key) const;
+
+  // Returns true if the key is in the collection, and false otherwise.
+  bool contains(const K &key) const;
+
+  // Returns the keys k in the collection such that k1 <= k <= k2
+  ArraySeq<K> find_keys(const K &k1, const K &k2) const;
+
+  // Returns the keys in the collection in ascending sorted order
+  ArraySeq<K> sorted_keys() const { return keys; }
+
+  // Gives the key immediately after (next_key) or before (prev_key)
+  // the given key in ascending order. Returns false if there is none.
+  bool next_key(const K &key, K &next_key) const;
+  bool prev_key(const K &key, K &next_key) const;
+
+  // Ordered iteration by rank: the pairs are numbered 0 to size() - 1
+  // in ascending key order, and lower_bound gives the rank of the
+  // first key >= key (size() if there is none). The caller must
+  // guarantee 0 <= rank < size().
+  int lower_bound(const K &key) const;
+  const K &key_at(int rank) const { return keys.unchecked(rank); }
+  const V &value_at(int rank) const { return values.unchecked(rank); }
+
+  // Memory used by the arrays and the index
+  long long bytes() const;
+
+private:
+  // the pairs, in ascending key order
+  ArraySeq<K> keys;
+  ArraySeq<V> values;
+
+  // first key of each block in Eytzinger order (entry 0 is unused),
+  // and the block each entry belongs to
+  ArraySeq<K> index;
+  ArraySeq<int> index_block;
+
+  // fills the index entries of the subtree rooted at entry i with the
+  // separators of the blocks from block on, in order
+  void build_index(int i, int &block);
+};
+
+// Returns a read-only copy of the map (see FrozenBTreeMap). Declared in
+// BTreeMap; defined here so btreemap.h does not depend on this file.
+template <typename K, typename V>
+FrozenBTreeMap<K, V> BTreeMap<K, V>::freeze() const
+{
+  ArraySeq<std::pair<K, V>> pairs = sorted_pairs();
+  return FrozenBTreeMap<K, V>(pairs.data(), pairs.size());
+}
+
+template <typename K, typename V>
+FrozenBTreeMap<K, V>::FrozenBTreeMap(const std::pair<K, V> *pairs, int n)
+{
+  keys.reserve(n);
+  values.reserve(n);
+  for (int i = 0; i < n; ++i)
+  {
+    if (i > 0 and !(pairs[i - 1].first < pairs[i].first))
+    {
+      throw std::invalid_argument("Keys are not in strictly ascending order");
+    }
+    keys.push_back(pairs[i].first);
+    values.push_back(pairs[i].second);
+  }
+  int blocks = (n + block_size - 1) / block_size;
+  index.resize(blocks + 1);
+  index_block.resize(blocks + 1);
+  int block = 0;
+  build_index(1, block);
+}
+
+template <typename K, typename V>
+void FrozenBTreeMap<K, V>::build_index(int i, int &block)
+{
+  if (i >= index.size())
+  {
+    return;
+  }
+  // in-order walk of the implicit tree visits the entries in key order
+  build_index(2 * i, block);
+  index.unchecked(i) = keys.unchecked(block * block_size);
+  index_block.unchecked(i) = block;
+  ++block;
+  build_index(2 * i + 1, block);
+}
+
+template <typename K, typename V>
+int FrozenBTreeMap<K, V>::lower_bound(const K &key) const
+{
+  int n = index.size();
+  if (n <= 1)
+  {
+    return 0;
+  }
+  // go right past every separator <= key; the entries four levels
+  // down (16 consecutive slots) load while these levels are searched.
+  // Near the bottom those entries do not exist, and the address is
+  // not formed at all (it would point past the end of the index).
+  int i = 1;
+  while (i < n)
+  {
+    if (i < n / 16)
+    {
+      BTREE_PREFETCH(index.data() + 16 * i);
+    }
+    i = 2 * i + !(key < index.unchecked(i));
+  }
+  // drop the trailing right turns and the last left turn: i is then
+  // the first separator > key (0 if there is none)
+  while (i & 1)
+  {
+    i >>= 1;
+  }
+  i >>= 1;
+  int block = (i == 0 ? n - 1 : index_block.unchecked(i)) - 1;
+  if (block < 0)
+  {
+    return 0;
+  }
+  // key can only be in the last block starting at or below it
+  int r = block * block_size;
+  int end = r + block_size < keys.size() ? r + block_size : keys.size();
+  while (r < end and keys.unchecked(r) < key)
+  {
+    ++r;
+  }
+  return r;
+}
+
+template <typename K, typename V>
+const V *FrozenBTreeMap<K, V>::find(const K &key) const
+{
+  int r = lower_bound(key);
+  if (r < keys.size() and !(key < keys.unchecked(r)))
+  {
+    return &values.unchecked(r);
+  }
+  return nullptr;
+}
+
+template <typename K, typename V>
+const V &FrozenBTreeMap<K, V>::operator[](const K &key) const
+{
+  const V *value = find(key);
+  if (value == nullptr)
+  {
+    throw std::out_of_range("Key is not in the collection");
+  }
+  return *value;
+}
+
+template <typename K, typename V>
+bool FrozenBTreeMap<K, V>::contains(const K &key) const
+{
+  return find(key) != nullptr;
+}
+
+template <typename K, typename V>
+ArraySeq<K> FrozenBTreeMap<K, V>::find_keys(const K &k1, const K &k2) const
+{
+  ArraySeq<K> found;
+  for (int r = lower_bound(k1); r < keys.size() and !(k2 < keys.unchecked(r)); ++r)
+  {
+    found.push_back(keys.unchecked(r));
+  }
+  return found;
+}
+
+template <typename K, typename V>
+bool FrozenBTreeMap<K, V>::next_key(const K &key, K &next_key) const
+{
+  int r = lower_bound(key);
+  if (r < keys.size() and !(key < keys.unchecked(r)))
+  {
+    ++r;
+  }
+  if (r == keys.size())
+  {
+    return false;
+  }
+  next_key = keys.unchecked(r);
+  return true;
+}
+
+template <typename K, typename V>
+bool FrozenBTreeMap<K, V>::prev_key(const K &key, K &next_key) const
+{
+  int r = lower_bound(key);
+  if (r == 0)
+  {
+    return false;
+  }
+  next_key = keys.unchecked(r - 1);
+  return true;
+}
+
+template <typename K, typename V>
+long long FrozenBTreeMap<K, V>::bytes() const
+{
+  return static_cast<long long>(sizeof(K) + sizeof(V)) * keys.size() +
+         static_cast<long long>(sizeof(K) + sizeof(int)) * index.size();
+}
+
+#endif
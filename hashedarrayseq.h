@@ -0,0 +1,392 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: hashedarrayseq.h
+// DATE: Spring 2022
+// DESC: Array sequence that keeps a hash index of its elements so
+//       that contains() runs in expected O(1) time instead of a
+//       linear scan. Meant for membership/dedup workloads.
+//---------------------------------------------------------------------------
+
+#ifndef HASHEDARRAYSEQ_H
+#define HASHEDARRAYSEQ_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include "arrayseq.h"
+
+template <typename T, typename Hash = std::hash<T>>
+class HashedArraySeq final : public Sequence<T>
+{
+public:
+  // Returns the number of elements in the sequence
+  int size() const;
+
+  // Tests if the sequence is empty
+  bool empty() const;
+
+  // Removes all of the elements from the sequence
+  void clear();
+
+  // Returns a reference to the element at the index in the
+  // sequence. Throws out_of_range if index is invalid. The element
+  // may be modified through the reference until the next call of a
+  // non-const member, which checks whether its hash changed and
+  // reindexes it if so (in O(1)); a plain read costs nothing more.
+  // set() is the direct way to replace an element.
+  T &operator[](int index);
+
+  // Returns a constant address to the element at the index in the
+  // sequence. Throws out_of_range if index is invalid.
+  const T &operator[](int index) const;
+
+  // Replaces the element at the index, updating the hash index in
+  // O(1). Throws out_of_range if index is invalid.
+  void set(int index, const T &elem);
+
+  // Extends the sequence by inserting the element at the given index.
+  // Throws out_of_range if the index is invalid. Appending (index ==
+  // size()) updates the hash index in O(1); inserting anywhere else
+  // shifts the later elements and rebuilds the index.
+  void insert(const T &elem, int index);
+
+  // Shrinks the sequence by removing the element at the index in the
+  // sequence. Throws out_of_range if index is invalid. Removing the
+  // last element is O(1); anything else rebuilds the index.
+  void erase(int index);
+
+  // Returns true if the element is in the sequence, and false
+  // otherwise. Expected O(1), plus a comparison with each element
+  // handed out by the non-const operator[] since the last non-const
+  // call. Never changes the sequence or its index, so concurrent
+  // const calls are safe.
+  bool contains(const T &elem) const;
+
+  // Sorts the elements in the sequence (see ArraySeq::sort()).
+  void sort();
+
+  // Adds the element to the end of the sequence.
+  void push_back(const T &elem);
+
+  // Adds the element to the end of the sequence only if it is not
+  // already in the sequence. Returns true if the element was added.
+  bool insert_unique(const T &elem);
+
+  // The underlying elements, in sequence order
+  const ArraySeq<T> &elements() const { return elems; }
+
+private:
+  // the elements in sequence order
+  ArraySeq<T> elems;
+
+  // the (spread) hash each element was indexed under; removal finds
+  // an element's slot from it, so the table stays consistent even if
+  // the element was changed through operator[]
+  ArraySeq<std::uint64_t> hashes;
+
+  // open addressing (linear probing) table of element index + 1,
+  // where 0 marks an empty slot. The size is always a power of two
+  // (or zero) and kept at most half full.
+  ArraySeq<int> slots;
+
+  // elements handed out by the non-const operator[] since the last
+  // non-const call (each listed once, as marked in is_pending)
+  ArraySeq<int> pending;
+  ArraySeq<char> is_pending;
+
+  // hash function object
+  Hash hasher;
+
+  // the spread hash of an element, and the home slot of a hash
+  std::uint64_t hash(const T &elem) const;
+  int home(std::uint64_t h) const
+  {
+    return static_cast<int>(h & static_cast<std::uint64_t>(slots.size() - 1));
+  }
+
+  // adds element index i to the table (table must have room)
+  void index_add(int i);
+
+  // removes element index i from the table
+  void index_remove(int i);
+
+  // returns the slot holding an element equal to elem, or -1
+  int index_find(const T &elem) const;
+
+  // reindexes the pending elements whose hash changed
+  void settle();
+
+  // rebuilds the table for the current elements
+  void rebuild();
+};
+
+template <typename T, typename Hash>
+std::ostream &operator<<(std::ostream &stream, const HashedArraySeq<T, Hash> &seq)
+{
+  return stream << seq.elements();
+}
+
+template <typename T, typename Hash>
+int HashedArraySeq<T, Hash>::size() const
+{
+  return elems.size();
+}
+
+template <typename T, typename Hash>
+bool HashedArraySeq<T, Hash>::empty() const
+{
+  return elems.empty();
+}
+
+template <typename T, typename Hash>
+void HashedArraySeq<T, Hash>::clear()
+{
+  elems.clear();
+  hashes.clear();
+  slots.clear();
+  pending.clear();
+  is_pending.clear();
+}
+
+template <typename T, typename Hash>
+T &HashedArraySeq<T, Hash>::operator[](int index)
+{
+  T &elem = elems[index];
+  if (!is_pending.unchecked(index))
+  {
+    is_pending.unchecked(index) = 1;
+    pending.push_back(index);
+  }
+  return elem;
+}
+
+template <typename T, typename Hash>
+const T &HashedArraySeq<T, Hash>::operator[](int index) const
+{
+  return elems[index];
+}
+
+template <typename T, typename Hash>
+void HashedArraySeq<T, Hash>::set(int index, const T &elem)
+{
+  if (index < 0 or index >= elems.size())
+  {
+    throw std::out_of_range("Invalid Index");
+  }
+  settle();
+  // elem may be the element itself, so copy it before unindexing
+  T copy = elem;
+  index_remove(index);
+  elems.unchecked(index) = std::move(copy);
+  hashes.unchecked(index) = hash(elems.unchecked(index));
+  index_add(index);
+}
+
+template <typename T, typename Hash>
+void HashedArraySeq<T, Hash>::insert(const T &elem, int index)
+{
+  if (index == elems.size())
+  {
+    push_back(elem);
+    return;
+  }
+  elems.insert(elem, index);
+  rebuild();
+}
+
+template <typename T, typename Hash>
+void HashedArraySeq<T, Hash>::erase(int index)
+{
+  if (index < 0 or index >= elems.size())
+  {
+    throw std::out_of_range("Invalid Index");
+  }
+  settle();
+  if (index == elems.size() - 1)
+  {
+    index_remove(index);
+    elems.erase(index);
+    hashes.erase(index);
+    is_pending.erase(index);
+    return;
+  }
+  elems.erase(index);
+  rebuild();
+}
+
+template <typename T, typename Hash>
+bool HashedArraySeq<T, Hash>::contains(const T &elem) const
+{
+  if (index_find(elem) != -1)
+  {
+    return true;
+  }
+  // a pending element changed to elem is still filed under its old
+  // hash
+  for (int i = 0; i < pending.size(); ++i)
+  {
+    if (elems.unchecked(pending.unchecked(i)) == elem)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename T, typename Hash>
+void HashedArraySeq<T, Hash>::sort()
+{
+  elems.sort();
+  rebuild();
+}
+
+template <typename T, typename Hash>
+void HashedArraySeq<T, Hash>::push_back(const T &elem)
+{
+  settle();
+  elems.push_back(elem);
+  hashes.push_back(hash(elems.unchecked(elems.size() - 1)));
+  is_pending.push_back(0);
+  if (2 * elems.size() > slots.size())
+  {
+    rebuild();
+  }
+  else
+  {
+    index_add(elems.size() - 1);
+  }
+}
+
+template <typename T, typename Hash>
+bool HashedArraySeq<T, Hash>::insert_unique(const T &elem)
+{
+  if (contains(elem))
+  {
+    return false;
+  }
+  push_back(elem);
+  return true;
+}
+
+template <typename T, typename Hash>
+std::uint64_t HashedArraySeq<T, Hash>::hash(const T &elem) const
+{
+  // spread the bits so identity hashes (e.g., of ints) still use the
+  // whole table
+  std::uint64_t h = static_cast<std::uint64_t>(hasher(elem));
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+template <typename T, typename Hash>
+void HashedArraySeq<T, Hash>::index_add(int i)
+{
+  int mask = slots.size() - 1;
+  int s = home(hashes.unchecked(i));
+  while (slots.unchecked(s) != 0)
+  {
+    s = (s + 1) & mask;
+  }
+  slots.unchecked(s) = i + 1;
+}
+
+template <typename T, typename Hash>
+void HashedArraySeq<T, Hash>::index_remove(int i)
+{
+  if (slots.empty())
+  {
+    return;
+  }
+  int mask = slots.size() - 1;
+  int s = home(hashes.unchecked(i));
+  while (slots.unchecked(s) != i + 1)
+  {
+    s = (s + 1) & mask;
+  }
+  // backward shift deletion keeps probe sequences intact without
+  // tombstones
+  int hole = s;
+  int next = (s + 1) & mask;
+  while (slots.unchecked(next) != 0)
+  {
+    int h = home(hashes.unchecked(slots.unchecked(next) - 1));
+    // move the entry into the hole if its home is not in (hole, next]
+    if (((next - h) & mask) >= ((next - hole) & mask))
+    {
+      slots.unchecked(hole) = slots.unchecked(next);
+      hole = next;
+    }
+    next = (next + 1) & mask;
+  }
+  slots.unchecked(hole) = 0;
+}
+
+template <typename T, typename Hash>
+int HashedArraySeq<T, Hash>::index_find(const T &elem) const
+{
+  if (slots.empty())
+  {
+    return -1;
+  }
+  int mask = slots.size() - 1;
+  int s = home(hash(elem));
+  while (slots.unchecked(s) != 0)
+  {
+    if (elems.unchecked(slots.unchecked(s) - 1) == elem)
+    {
+      return s;
+    }
+    s = (s + 1) & mask;
+  }
+  return -1;
+}
+
+template <typename T, typename Hash>
+void HashedArraySeq<T, Hash>::settle()
+{
+  for (int j = 0; j < pending.size(); ++j)
+  {
+    int i = pending.unchecked(j);
+    is_pending.unchecked(i) = 0;
+    std::uint64_t h = hash(elems.unchecked(i));
+    if (h != hashes.unchecked(i))
+    {
+      index_remove(i);
+      hashes.unchecked(i) = h;
+      index_add(i);
+    }
+  }
+  pending.clear();
+}
+
+template <typename T, typename Hash>
+void HashedArraySeq<T, Hash>::rebuild()
+{
+  int n = 8;
+  while (n < 4 * elems.size())
+  {
+    n = n * 2;
+  }
+  slots.clear();
+  slots.reserve(n);
+  for (int i = 0; i < n; ++i)
+  {
+    slots.push_back(0);
+  }
+  hashes.clear();
+  hashes.reserve(elems.size());
+  is_pending.clear();
+  is_pending.reserve(elems.size());
+  pending.clear();
+  for (int i = 0; i < elems.size(); ++i)
+  {
+    hashes.push_back(hash(elems.unchecked(i)));
+    is_pending.push_back(0);
+    index_add(i);
+  }
+}
+
+#endif
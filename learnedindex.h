@@ -0,0 +1,198 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: learnedindex.h
+// DATE: Spring 2022
+// DESC: Learned index over a FrozenBTreeMap with integer keys. The
+//       sorted keys are covered by line segments, each predicting the
+//       rank of a key from the key itself to within epsilon positions.
+//       A lookup finds the segment for the key, computes the predicted
+//       rank and searches only the 2 * epsilon + 3 keys around it. The
+//       fewer bends the key distribution has (dense or evenly spread
+//       ids), the fewer segments are needed.
+//---------------------------------------------------------------------------
+
+#ifndef LEARNEDINDEX_H
+#define LEARNEDINDEX_H
+
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "arrayseq.h"
+#include "frozenbtreemap.h"
+
+template <typename K, typename V>
+class LearnedIndex
+{
+  static_assert(std::is_integral<K>::value, "LearnedIndex needs integer keys");
+
+public:
+  // Fits the segments over the keys of map, which must outlive the
+  // index (and cannot change, being frozen). Throws invalid_argument
+  // if epsilon is negative.
+  explicit LearnedIndex(const FrozenBTreeMap<K, V> &map, int epsilon = 32);
+
+  // Same results as the map's own lookups
+  int lower_bound(const K &key) const;
+  const V *find(const K &key) const;
+  bool contains(const K &key) const { return find(key) != nullptr; }
+
+  // Returns the value for a given key. Throws out_of_range if the
+  // given key is not in the collection.
+  const V &operator[](const K &key) const;
+
+  // Maximum distance between a predicted and an actual rank
+  int epsilon() const { return eps; }
+
+  // Number of line segments fitted
+  int segments() const { return firsts.size(); }
+
+  // Memory used by the segments
+  long long bytes() const
+  {
+    return static_cast<long long>(sizeof(K) + sizeof(Segment)) * firsts.size();
+  }
+
+private:
+  using U = typename std::make_unsigned<K>::type;
+
+  // rank(key) ~ rank + slope * (key - first); end is the rank after
+  // the segment's last key
+  struct Segment
+  {
+    int rank;
+    int end;
+    double slope;
+  };
+
+  const FrozenBTreeMap<K, V> &map;
+  int eps;
+
+  // first key of each segment, and the segment's model
+  ArraySeq<K> firsts;
+  std::vector<Segment> models;
+
+  // distance between two keys, a <= b (exact in U even when b - a
+  // overflows K)
+  static double distance(const K &a, const K &b)
+  {
+    return static_cast<double>(static_cast<U>(static_cast<U>(b) - static_cast<U>(a)));
+  }
+};
+
+template <typename K, typename V>
+LearnedIndex<K, V>::LearnedIndex(const FrozenBTreeMap<K, V> &map, int epsilon)
+    : map(map), eps(epsilon)
+{
+  if (epsilon < 0)
+  {
+    throw std::invalid_argument("Epsilon must not be negative");
+  }
+  // Greedy shrinking cone: every key added to a segment narrows the
+  // range of slopes that predict all of the segment's keys to within
+  // eps. When a key leaves no slope the segment ends and a new one
+  // starts at that key.
+  int n = map.size();
+  int start = 0;
+  double lo = 0, hi = 0;
+  for (int r = 0; n > 0 and r <= n; ++r)
+  {
+    bool fits = false;
+    if (r < n and r > start)
+    {
+      double dx = distance(map.key_at(start), map.key_at(r));
+      double dy = r - start;
+      double low = (dy - eps) / dx, high = (dy + eps) / dx;
+      if (r == start + 1)
+      {
+        lo = low, hi = high;
+        fits = true;
+      }
+      else if (low <= hi and lo <= high)
+      {
+        lo = low > lo ? low : lo;
+        hi = high < hi ? high : hi;
+        fits = true;
+      }
+    }
+    else if (r < n)
+    {
+      fits = true;
+    }
+    if (!fits)
+    {
+      // close the segment [start, r)
+      double slope = r - start > 1 ? (lo + hi) / 2 : 0;
+      firsts.push_back(map.key_at(start));
+      models.push_back({start, r, slope < 0 ? 0 : slope});
+      start = r;
+    }
+  }
+}
+
+template <typename K, typename V>
+int LearnedIndex<K, V>::lower_bound(const K &key) const
+{
+  int n = map.size();
+  if (n == 0 or key < firsts.unchecked(0))
+  {
+    return 0;
+  }
+  // last segment whose first key is <= key
+  int a = 0, b = firsts.size();
+  while (b - a > 1)
+  {
+    int mid = (a + b) / 2;
+    if (key < firsts.unchecked(mid))
+      b = mid;
+    else
+      a = mid;
+  }
+  const Segment &seg = models[a];
+  // the prediction is kept inside the segment, so a key past its last
+  // key (whose rank is seg.end) is still predicted within eps
+  double guess = seg.rank + seg.slope * distance(firsts.unchecked(a), key);
+  int pos = guess < seg.end ? static_cast<int>(guess) : seg.end;
+  // one extra position on each side covers rounding in the model
+  int first = pos - eps - 1 < 0 ? 0 : pos - eps - 1;
+  int last = pos + eps + 2 < n ? pos + eps + 2 : n;
+  while (first < last)
+  {
+    int mid = (first + last) / 2;
+    if (map.key_at(mid) < key)
+      first = mid + 1;
+    else
+      last = mid;
+  }
+  // the bound is guaranteed by the fit; check it rather than trust
+  // floating point, and fall back to the map's own search
+  if ((first > 0 and !(map.key_at(first - 1) < key)) or
+      (first < n and map.key_at(first) < key))
+  {
+    return map.lower_bound(key);
+  }
+  return first;
+}
+
+template <typename K, typename V>
+const V *LearnedIndex<K, V>::find(const K &key) const
+{
+  int r = lower_bound(key);
+  if (r < map.size() and !(key < map.key_at(r)))
+  {
+    return &map.value_at(r);
+  }
+  return nullptr;
+}
+
+template <typename K, typename V>
+const V &LearnedIndex<K, V>::operator[](const K &key) const
+{
+  const V *value = find(key);
+  if (value == nullptr)
+  {
+    throw std::out_of_range("Key is not in the collection");
+  }
+  return *value;
+}
+
+#endif
@@ -0,0 +1,147 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: maptraits.h
+// DATE: Spring 2022
+// DESC: Static (compile time) versions of the Map and Sequence
+//       interfaces. Generic code written as a template over the map
+//       or sequence type, checked with is_map / is_sequence, calls
+//       the concrete member functions directly so they can be
+//       inlined. MapAdapter and SequenceAdapter go the other way: they
+//       wrap any such type behind the virtual Map / Sequence
+//       interface for code that needs one type for every container.
+//---------------------------------------------------------------------------
+
+#ifndef MAPTRAITS_H
+#define MAPTRAITS_H
+
+#include <type_traits>
+#include <utility>
+#include "map.h"
+#include "sequence.h"
+
+namespace map_traits_detail
+{
+
+template <typename M, typename K, typename V, typename = void>
+struct is_map : std::false_type
+{
+};
+
+template <typename M, typename K, typename V>
+struct is_map<
+    M, K, V,
+    std::void_t<
+        decltype(std::declval<const M &>().size()),
+        decltype(std::declval<const M &>().empty()),
+        decltype(std::declval<M &>()[std::declval<const K &>()]),
+        decltype(std::declval<M &>().insert(std::declval<const K &>(), std::declval<const V &>())),
+        decltype(std::declval<M &>().erase(std::declval<const K &>())),
+        decltype(std::declval<const M &>().contains(std::declval<const K &>())),
+        decltype(std::declval<const M &>().find_keys(std::declval<const K &>(),
+                                                     std::declval<const K &>())),
+        decltype(std::declval<const M &>().sorted_keys()),
+        decltype(std::declval<const M &>().next_key(std::declval<const K &>(),
+                                                    std::declval<K &>())),
+        decltype(std::declval<const M &>().prev_key(std::declval<const K &>(),
+                                                    std::declval<K &>())),
+        decltype(std::declval<M &>().clear())>>
+    : std::integral_constant<
+          bool, std::is_convertible<decltype(std::declval<M &>()[std::declval<const K &>()]),
+                                    V &>::value and
+                    std::is_convertible<decltype(std::declval<const M &>().contains(
+                                            std::declval<const K &>())),
+                                        bool>::value>
+{
+};
+
+template <typename S, typename T, typename = void>
+struct is_sequence : std::false_type
+{
+};
+
+template <typename S, typename T>
+struct is_sequence<
+    S, T,
+    std::void_t<
+        decltype(std::declval<const S &>().size()),
+        decltype(std::declval<const S &>().empty()),
+        decltype(std::declval<S &>().clear()),
+        decltype(std::declval<S &>()[0]),
+        decltype(std::declval<S &>().insert(std::declval<const T &>(), 0)),
+        decltype(std::declval<S &>().erase(0)),
+        decltype(std::declval<const S &>().contains(std::declval<const T &>())),
+        decltype(std::declval<S &>().sort())>>
+    : std::is_convertible<decltype(std::declval<S &>()[0]), T &>
+{
+};
+
+} // namespace map_traits_detail
+
+// True if M has every member function of Map<K,V> (with operator[]
+// returning a V&), whether or not it derives from Map<K,V>
+template <typename M, typename K, typename V>
+struct is_map : map_traits_detail::is_map<M, K, V>
+{
+};
+
+// True if S has every member function of Sequence<T>
+template <typename S, typename T>
+struct is_sequence : map_traits_detail::is_sequence<S, T>
+{
+};
+
+// Presents any map type M with the Map<K,V> member functions through
+// the virtual Map<K,V> interface. The wrapped map must outlive the
+// adapter.
+template <typename M, typename K, typename V>
+class MapAdapter final : public Map<K, V>
+{
+  static_assert(is_map<M, K, V>::value, "MapAdapter needs a type with the Map<K,V> members");
+
+public:
+  explicit MapAdapter(M &inner) : inner(inner) {}
+
+  int size() const { return inner.size(); }
+  bool empty() const { return inner.empty(); }
+  V &operator[](const K &key) { return inner[key]; }
+  const V &operator[](const K &key) const { return static_cast<const M &>(inner)[key]; }
+  void insert(const K &key, const V &value) { inner.insert(key, value); }
+  void erase(const K &key) { inner.erase(key); }
+  bool contains(const K &key) const { return inner.contains(key); }
+  ArraySeq<K> find_keys(const K &k1, const K &k2) const { return inner.find_keys(k1, k2); }
+  ArraySeq<K> sorted_keys() const { return inner.sorted_keys(); }
+  bool next_key(const K &key, K &next_key) const { return inner.next_key(key, next_key); }
+  bool prev_key(const K &key, K &next_key) const { return inner.prev_key(key, next_key); }
+  void clear() { inner.clear(); }
+
+private:
+  M &inner;
+};
+
+// Presents any sequence type S with the Sequence<T> member functions
+// through the virtual Sequence<T> interface. The wrapped sequence must
+// outlive the adapter.
+template <typename S, typename T>
+class SequenceAdapter final : public Sequence<T>
+{
+  static_assert(is_sequence<S, T>::value,
+                "SequenceAdapter needs a type with the Sequence<T> members");
+
+public:
+  explicit SequenceAdapter(S &inner) : inner(inner) {}
+
+  int size() const { return inner.size(); }
+  bool empty() const { return inner.empty(); }
+  void clear() { inner.clear(); }
+  T &operator[](int index) { return inner[index]; }
+  const T &operator[](int index) const { return static_cast<const S &>(inner)[index]; }
+  void insert(const T &elem, int index) { inner.insert(elem, index); }
+  void erase(int index) { inner.erase(index); }
+  bool contains(const T &elem) const { return inner.contains(elem); }
+  void sort() { inner.sort(); }
+
+private:
+  S &inner;
+};
+
+#endif
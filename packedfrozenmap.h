@@ -0,0 +1,374 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: packedfrozenmap.h
+// DATE: Spring 2022
+// DESC: Read-only map with integer keys stored frame-of-reference
+//       compressed. The sorted keys are cut into blocks of block_size;
+//       each block keeps its first key in full (the base) and every key
+//       as its distance from the base, packed in the narrowest of 1, 2,
+//       4 or 8 bytes that holds the block's largest distance. Dense or
+//       evenly spaced keys (ids, timestamps) then take 1 or 2 bytes each
+//       instead of sizeof(K). A lookup binary searches the bases and
+//       counts the distances below the key's within one block; the
+//       count and the decoding for scans are plain loops over the packed
+//       array with no early exit, which the compiler vectorizes.
+//---------------------------------------------------------------------------
+
+#ifndef PACKEDFROZENMAP_H
+#define PACKEDFROZENMAP_H
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "arrayseq.h"
+#include "btreemap.h"
+
+template <typename K, typename V>
+class PackedFrozenMap
+{
+  static_assert(std::is_integral<K>::value, "PackedFrozenMap needs integer keys");
+
+public:
+  // keys per block (one base and one packing width each)
+  static const int block_size = 64;
+
+  // empty map
+  PackedFrozenMap() = default;
+
+  // Builds the map from the n pairs starting at pairs, which must be in
+  // strictly ascending key order (throws invalid_argument otherwise)
+  PackedFrozenMap(const std::pair<K, V> *pairs, int n);
+
+  // Builds a read-only copy of map
+  explicit PackedFrozenMap(const BTreeMap<K, V> &map);
+
+  // Returns the number of key-value pairs in the map
+  int size() const { return values.size(); }
+
+  // Tests if the map is empty
+  bool empty() const { return values.empty(); }
+
+  // Returns the value for a given key. Throws out_of_range if the
+  // given key is not in the collection.
+  const V &operator[](const K &key) const;
+
+  // Returns a pointer to the value for key, or nullptr if key is not
+  // in the collection
+  const V *find(const K &key) const;
+
+  // Returns true if the key is in the collection, and false otherwise.
+  bool contains(const K &key) const { return find(key) != nullptr; }
+
+  // Returns the keys k in the collection such that k1 <= k <= k2
+  ArraySeq<K> find_keys(const K &k1, const K &k2) const;
+
+  // Returns the keys in the collection in ascending sorted order
+  ArraySeq<K> sorted_keys() const;
+
+  // Gives the key immediately after (next_key) or before (prev_key)
+  // the given key in ascending order. Returns false if there is none.
+  bool next_key(const K &key, K &next_key) const;
+  bool prev_key(const K &key, K &next_key) const;
+
+  // Ordered iteration by rank, as in FrozenBTreeMap (keys are decoded,
+  // so key_at returns a copy). The caller must guarantee
+  // 0 <= rank < size().
+  int lower_bound(const K &key) const;
+  K key_at(int rank) const;
+  const V &value_at(int rank) const { return values.unchecked(rank); }
+
+  // Memory used by the keys alone, and by the whole map
+  long long key_bytes() const;
+  long long bytes() const { return key_bytes() + static_cast<long long>(sizeof(V)) * values.size(); }
+
+private:
+  using U = typename std::make_unsigned<K>::type;
+
+  // where a block's distances are: offset into the array of its width
+  struct Block
+  {
+    int offset;
+    int width;
+  };
+
+  ArraySeq<V> values;
+
+  // first key of each block, and its packing
+  ArraySeq<K> bases;
+  std::vector<Block> blocks;
+
+  // the distances of all the blocks of each width, block after block
+  std::vector<std::uint8_t> deltas8;
+  std::vector<std::uint16_t> deltas16;
+  std::vector<std::uint32_t> deltas32;
+  std::vector<std::uint64_t> deltas64;
+
+  // number of keys in block b
+  int block_count(int b) const
+  {
+    int rest = values.size() - b * block_size;
+    return rest < block_size ? rest : block_size;
+  }
+
+  // calls f with a pointer to the distances of block b
+  template <typename F>
+  auto with_deltas(int b, F f) const
+  {
+    const Block &block = blocks[b];
+    switch (block.width)
+    {
+    case 1:
+      return f(deltas8.data() + block.offset);
+    case 2:
+      return f(deltas16.data() + block.offset);
+    case 4:
+      return f(deltas32.data() + block.offset);
+    default:
+      return f(deltas64.data() + block.offset);
+    }
+  }
+
+  // appends the distances of the count keys at pairs from base to d,
+  // padded to block_size with the largest distance T holds so every
+  // block is full (the loops over a block then have a fixed trip
+  // count, and the padding is never below a target)
+  template <typename T>
+  static void pack_block(const std::pair<K, V> *pairs, int count, U base, std::vector<T> &d)
+  {
+    for (int i = 0; i < block_size; ++i)
+    {
+      d.push_back(i < count ? static_cast<T>(static_cast<U>(pairs[i].first) - base)
+                            : std::numeric_limits<T>::max());
+    }
+  }
+
+  // number of the block's distances at d that are below target
+  template <typename T>
+  static int count_below(const T *d, U target)
+  {
+    if (target > std::numeric_limits<T>::max())
+    {
+      return block_size;
+    }
+    T t = static_cast<T>(target);
+    int below = 0;
+    for (int j = 0; j < block_size; ++j)
+    {
+      below += d[j] < t;
+    }
+    return below;
+  }
+
+  // adds the keys of block b from its from-th up to (not including)
+  // its to-th to out
+  void decode(int b, int from, int to, ArraySeq<K> &out) const;
+
+  void pack(const std::pair<K, V> *pairs, int n);
+};
+
+template <typename K, typename V>
+PackedFrozenMap<K, V>::PackedFrozenMap(const std::pair<K, V> *pairs, int n)
+{
+  pack(pairs, n);
+}
+
+template <typename K, typename V>
+PackedFrozenMap<K, V>::PackedFrozenMap(const BTreeMap<K, V> &map)
+{
+  ArraySeq<std::pair<K, V>> pairs = map.sorted_pairs();
+  pack(pairs.data(), pairs.size());
+}
+
+template <typename K, typename V>
+void PackedFrozenMap<K, V>::pack(const std::pair<K, V> *pairs, int n)
+{
+  values.reserve(n);
+  for (int i = 0; i < n; ++i)
+  {
+    if (i > 0 and !(pairs[i - 1].first < pairs[i].first))
+    {
+      throw std::invalid_argument("Keys are not in strictly ascending order");
+    }
+    values.push_back(pairs[i].second);
+  }
+  for (int start = 0; start < n; start += block_size)
+  {
+    int count = n - start < block_size ? n - start : block_size;
+    U base = static_cast<U>(pairs[start].first);
+    // keys ascend, so the last one is the farthest from the base
+    U span = static_cast<U>(pairs[start + count - 1].first) - base;
+    Block block;
+    if (span <= 0xFF)
+    {
+      block = {static_cast<int>(deltas8.size()), 1};
+      pack_block(pairs + start, count, base, deltas8);
+    }
+    else if (span <= 0xFFFF)
+    {
+      block = {static_cast<int>(deltas16.size()), 2};
+      pack_block(pairs + start, count, base, deltas16);
+    }
+    else if (span <= 0xFFFFFFFF)
+    {
+      block = {static_cast<int>(deltas32.size()), 4};
+      pack_block(pairs + start, count, base, deltas32);
+    }
+    else
+    {
+      block = {static_cast<int>(deltas64.size()), 8};
+      pack_block(pairs + start, count, base, deltas64);
+    }
+    bases.push_back(pairs[start].first);
+    blocks.push_back(block);
+  }
+}
+
+template <typename K, typename V>
+int PackedFrozenMap<K, V>::lower_bound(const K &key) const
+{
+  if (bases.empty() or key < bases.unchecked(0))
+  {
+    return 0;
+  }
+  // last block whose base is <= key (branch free: the loop runs the
+  // same number of times for every key)
+  int b = 0;
+  for (int len = bases.size(); len > 1; len -= len / 2)
+  {
+    b = bases.unchecked(b + len / 2) <= key ? b + len / 2 : b;
+  }
+  // a target too wide for the block's distances counts the padding of
+  // the last block too, so clamp to the keys the block has
+  U target = static_cast<U>(key) - static_cast<U>(bases.unchecked(b));
+  int below = with_deltas(b, [&](auto d)
+                          { return count_below(d, target); });
+  int count = block_count(b);
+  return b * block_size + (below < count ? below : count);
+}
+
+template <typename K, typename V>
+K PackedFrozenMap<K, V>::key_at(int rank) const
+{
+  int b = rank / block_size;
+  U base = static_cast<U>(bases.unchecked(b));
+  return static_cast<K>(with_deltas(b, [&](auto d)
+                                    { return static_cast<U>(base + d[rank % block_size]); }));
+}
+
+template <typename K, typename V>
+void PackedFrozenMap<K, V>::decode(int b, int from, int to, ArraySeq<K> &out) const
+{
+  K keys[block_size];
+  U base = static_cast<U>(bases.unchecked(b));
+  with_deltas(b, [&](auto d)
+              {
+                for (int i = 0; i < block_size; ++i)
+                {
+                  keys[i] = static_cast<K>(static_cast<U>(base + d[i]));
+                }
+                return 0; });
+  for (int i = from; i < to; ++i)
+  {
+    out.push_back(keys[i]);
+  }
+}
+
+template <typename K, typename V>
+const V *PackedFrozenMap<K, V>::find(const K &key) const
+{
+  int r = lower_bound(key);
+  if (r < size() and key_at(r) == key)
+  {
+    return &values.unchecked(r);
+  }
+  return nullptr;
+}
+
+template <typename K, typename V>
+const V &PackedFrozenMap<K, V>::operator[](const K &key) const
+{
+  const V *value = find(key);
+  if (value == nullptr)
+  {
+    throw std::out_of_range("Key is not in the collection");
+  }
+  return *value;
+}
+
+template <typename K, typename V>
+ArraySeq<K> PackedFrozenMap<K, V>::find_keys(const K &k1, const K &k2) const
+{
+  ArraySeq<K> found;
+  if (k2 < k1)
+  {
+    return found;
+  }
+  int r = lower_bound(k1);
+  int end = lower_bound(k2);
+  if (end < size() and key_at(end) == k2)
+  {
+    ++end;
+  }
+  found.reserve(end - r);
+  // decode whole blocks, keeping the keys of ranks r to end - 1
+  for (int b = r / block_size; b * block_size < end; ++b)
+  {
+    int first = b * block_size;
+    decode(b, r > first ? r - first : 0, end - first < block_size ? end - first : block_size,
+           found);
+  }
+  return found;
+}
+
+template <typename K, typename V>
+ArraySeq<K> PackedFrozenMap<K, V>::sorted_keys() const
+{
+  ArraySeq<K> found;
+  found.reserve(size());
+  for (int b = 0; b < bases.size(); ++b)
+  {
+    decode(b, 0, block_count(b), found);
+  }
+  return found;
+}
+
+template <typename K, typename V>
+bool PackedFrozenMap<K, V>::next_key(const K &key, K &next_key) const
+{
+  int r = lower_bound(key);
+  if (r < size() and key_at(r) == key)
+  {
+    ++r;
+  }
+  if (r == size())
+  {
+    return false;
+  }
+  next_key = key_at(r);
+  return true;
+}
+
+template <typename K, typename V>
+bool PackedFrozenMap<K, V>::prev_key(const K &key, K &next_key) const
+{
+  int r = lower_bound(key);
+  if (r == 0)
+  {
+    return false;
+  }
+  next_key = key_at(r - 1);
+  return true;
+}
+
+template <typename K, typename V>
+long long PackedFrozenMap<K, V>::key_bytes() const
+{
+  return static_cast<long long>(sizeof(K) + sizeof(Block)) * bases.size() +
+         static_cast<long long>(deltas8.size()) + 2LL * deltas16.size() +
+         4LL * deltas32.size() + 8LL * deltas64.size();
+}
+
+#endif
@@ -0,0 +1,432 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: shardedbtreemap.h
+// DATE: Spring 2022
+// DESC: Map split into N BTreeMap shards by key range, each with its
+//       own lock, so writers to different ranges do not contend.
+//       Shard boundaries are recomputed from the keys when the shards
+//       become unbalanced. Range results stay globally ordered since
+//       the shards' ranges are ordered. Give the constructor split
+//       keys when the key distribution is known up front; otherwise
+//       the map starts as a single shard (see below).
+//---------------------------------------------------------------------------
+
+#ifndef SHARDEDBTREEMAP_H
+#define SHARDEDBTREEMAP_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <vector>
+#include "btreemap.h"
+
+template <typename K, typename V>
+class ShardedBTreeMap
+{
+public:
+  // Creates a map with the given number of shards but no boundaries,
+  // since nothing is known yet about the keys. Until the first
+  // rebalance every key lives in shard 0, so writers all take shard
+  // 0's lock. The first rebalance runs when shard 0 reaches the
+  // minimum rebalance size (4096 keys by default; see
+  // set_skew_limit()) and, like every rebalance, rebuilds all of the
+  // shards in O(n) while holding the map exclusively.
+  explicit ShardedBTreeMap(int shard_count = 16);
+
+  // Creates a map with the given (ascending) split keys: shard i holds
+  // the keys k with split_keys[i-1] <= k < split_keys[i]. Writers
+  // spread over the shards from the first insert.
+  explicit ShardedBTreeMap(const ArraySeq<K> &split_keys);
+
+  // not copyable
+  ShardedBTreeMap(const ShardedBTreeMap &rhs) = delete;
+  ShardedBTreeMap &operator=(const ShardedBTreeMap &rhs) = delete;
+
+  // Returns the number of key-value pairs in the map
+  int size() const;
+
+  // Tests if the map is empty
+  bool empty() const;
+
+  // Returns a copy of the value for the given key. Throws out_of_range
+  // if the given key is not in the collection.
+  V operator[](const K &key) const;
+
+  // Copies the value for the key into value and returns true, or
+  // returns false if the key is not in the collection.
+  bool find(const K &key, V &value) const;
+
+  // Replaces the value for the key. Throws out_of_range if the given
+  // key is not in the collection.
+  void update(const K &key, const V &value);
+
+  // Extends the collection by adding the given key-value pair.
+  // Expects key to not exist in map prior to insertion.
+  void insert(const K &key, const V &value);
+
+  // Shrinks the collection by removing the key-value pair with the
+  // given key. Throws out_of_range if the given key is not in the
+  // collection.
+  void erase(const K &key);
+
+  // Returns true if the key is in the collection, and false otherwise.
+  bool contains(const K &key) const;
+
+  // Returns the keys k in the collection such that k1 <= k <= k2
+  ArraySeq<K> find_keys(const K &k1, const K &k2) const;
+
+  // Returns the keys in the collection in ascending sorted order
+  ArraySeq<K> sorted_keys() const;
+
+  // Gives the key (as an ouptput parameter) immediately after the
+  // given key according to ascending sort order. Returns true if a
+  // successor key exists, and false otherwise.
+  bool next_key(const K &key, K &next_key) const;
+
+  // Gives the key (as an ouptput parameter) immediately before the
+  // given key according to ascending sort order. Returns true if a
+  // predecessor key exists, and false otherwise.
+  bool prev_key(const K &key, K &next_key) const;
+
+  // Removes all key-value pairs from the map.
+  void clear();
+
+  // Number of shards
+  int shard_count() const { return static_cast<int>(shards.size()); }
+
+  // Number of keys in the i-th shard
+  int shard_size(int i) const;
+
+  // A shard holding more than skew_limit times the average shard size
+  // (and at least min_size keys) triggers a rebalance on insert.
+  void set_skew_limit(double skew_limit, int min_size);
+
+  // Recomputes the shard boundaries so every shard holds about the
+  // same number of keys, and moves the keys accordingly. Copies and
+  // rebuilds every shard, O(n), and blocks all other operations while
+  // it runs.
+  void rebalance();
+
+private:
+  struct Shard
+  {
+    BTreeMap<K, V> map;
+    mutable std::shared_mutex mutex;
+  };
+
+  // shards in key order (the vector itself never changes size)
+  std::vector<std::unique_ptr<Shard>> shards;
+
+  // boundaries[i] is the smallest key of shard i + 1
+  ArraySeq<K> boundaries;
+
+  // held shared by every operation and exclusively by rebalance()
+  mutable std::shared_mutex layout_mutex;
+
+  // total number of keys
+  std::atomic<int> count{0};
+
+  // rebalance trigger settings
+  double skew = 4.0;
+  int min_rebalance_size = 4096;
+
+  // returns the index of the shard whose range holds key
+  int shard_of(const K &key) const;
+
+  // true if the shard has grown past the skew limit
+  bool skewed(int shard_size) const;
+};
+
+template <typename K, typename V>
+ShardedBTreeMap<K, V>::ShardedBTreeMap(int shard_count)
+{
+  if (shard_count < 1)
+  {
+    throw std::invalid_argument("ShardedBTreeMap needs at least one shard");
+  }
+  for (int i = 0; i < shard_count; ++i)
+  {
+    shards.emplace_back(new Shard);
+  }
+}
+
+template <typename K, typename V>
+ShardedBTreeMap<K, V>::ShardedBTreeMap(const ArraySeq<K> &split_keys)
+    : boundaries(split_keys)
+{
+  for (int i = 1; i < boundaries.size(); ++i)
+  {
+    if (!(boundaries[i - 1] < boundaries[i]))
+    {
+      throw std::invalid_argument("shard boundaries must be ascending");
+    }
+  }
+  for (int i = 0; i <= boundaries.size(); ++i)
+  {
+    shards.emplace_back(new Shard);
+  }
+}
+
+template <typename K, typename V>
+int ShardedBTreeMap<K, V>::size() const
+{
+  return count.load(std::memory_order_relaxed);
+}
+
+template <typename K, typename V>
+bool ShardedBTreeMap<K, V>::empty() const
+{
+  return size() == 0;
+}
+
+template <typename K, typename V>
+V ShardedBTreeMap<K, V>::operator[](const K &key) const
+{
+  std::shared_lock<std::shared_mutex> layout(layout_mutex);
+  const Shard &s = *shards[shard_of(key)];
+  std::shared_lock<std::shared_mutex> lock(s.mutex);
+  return s.map[key];
+}
+
+template <typename K, typename V>
+bool ShardedBTreeMap<K, V>::find(const K &key, V &value) const
+{
+  std::shared_lock<std::shared_mutex> layout(layout_mutex);
+  const Shard &s = *shards[shard_of(key)];
+  std::shared_lock<std::shared_mutex> lock(s.mutex);
+  const V *found = s.map.find(key);
+  if (found == nullptr)
+  {
+    return false;
+  }
+  value = *found;
+  return true;
+}
+
+template <typename K, typename V>
+void ShardedBTreeMap<K, V>::update(const K &key, const V &value)
+{
+  std::shared_lock<std::shared_mutex> layout(layout_mutex);
+  Shard &s = *shards[shard_of(key)];
+  std::unique_lock<std::shared_mutex> lock(s.mutex);
+  s.map[key] = value;
+}
+
+template <typename K, typename V>
+void ShardedBTreeMap<K, V>::insert(const K &key, const V &value)
+{
+  bool needs_rebalance = false;
+  {
+    std::shared_lock<std::shared_mutex> layout(layout_mutex);
+    Shard &s = *shards[shard_of(key)];
+    std::unique_lock<std::shared_mutex> lock(s.mutex);
+    if (s.map.insert_or_assign(key, value))
+    {
+      count.fetch_add(1, std::memory_order_relaxed);
+    }
+    needs_rebalance = skewed(s.map.size());
+  }
+  if (needs_rebalance)
+  {
+    rebalance();
+  }
+}
+
+template <typename K, typename V>
+void ShardedBTreeMap<K, V>::erase(const K &key)
+{
+  std::shared_lock<std::shared_mutex> layout(layout_mutex);
+  Shard &s = *shards[shard_of(key)];
+  std::unique_lock<std::shared_mutex> lock(s.mutex);
+  s.map.erase(key);
+  count.fetch_sub(1, std::memory_order_relaxed);
+}
+
+template <typename K, typename V>
+bool ShardedBTreeMap<K, V>::contains(const K &key) const
+{
+  std::shared_lock<std::shared_mutex> layout(layout_mutex);
+  const Shard &s = *shards[shard_of(key)];
+  std::shared_lock<std::shared_mutex> lock(s.mutex);
+  return s.map.contains(key);
+}
+
+template <typename K, typename V>
+ArraySeq<K> ShardedBTreeMap<K, V>::find_keys(const K &k1, const K &k2) const
+{
+  ArraySeq<K> keys;
+  if (k2 < k1)
+  {
+    return keys;
+  }
+  std::shared_lock<std::shared_mutex> layout(layout_mutex);
+  // shards cover ascending ranges, so appending their results in
+  // shard order gives globally sorted keys
+  int last = shard_of(k2);
+  for (int i = shard_of(k1); i <= last; ++i)
+  {
+    std::shared_lock<std::shared_mutex> lock(shards[i]->mutex);
+    keys.append(shards[i]->map.find_keys(k1, k2));
+  }
+  return keys;
+}
+
+template <typename K, typename V>
+ArraySeq<K> ShardedBTreeMap<K, V>::sorted_keys() const
+{
+  ArraySeq<K> keys;
+  std::shared_lock<std::shared_mutex> layout(layout_mutex);
+  keys.reserve(size());
+  for (const auto &s : shards)
+  {
+    std::shared_lock<std::shared_mutex> lock(s->mutex);
+    keys.append(s->map.sorted_keys());
+  }
+  return keys;
+}
+
+template <typename K, typename V>
+bool ShardedBTreeMap<K, V>::next_key(const K &key, K &next_key) const
+{
+  std::shared_lock<std::shared_mutex> layout(layout_mutex);
+  // later shards only hold larger keys, so their smallest key is the
+  // successor if this shard has none
+  for (int i = shard_of(key); i < shard_count(); ++i)
+  {
+    std::shared_lock<std::shared_mutex> lock(shards[i]->mutex);
+    if (shards[i]->map.next_key(key, next_key))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename K, typename V>
+bool ShardedBTreeMap<K, V>::prev_key(const K &key, K &next_key) const
+{
+  std::shared_lock<std::shared_mutex> layout(layout_mutex);
+  for (int i = shard_of(key); i >= 0; --i)
+  {
+    std::shared_lock<std::shared_mutex> lock(shards[i]->mutex);
+    if (shards[i]->map.prev_key(key, next_key))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename K, typename V>
+void ShardedBTreeMap<K, V>::clear()
+{
+  std::unique_lock<std::shared_mutex> layout(layout_mutex);
+  for (auto &s : shards)
+  {
+    s->map.clear();
+  }
+  count.store(0, std::memory_order_relaxed);
+}
+
+template <typename K, typename V>
+int ShardedBTreeMap<K, V>::shard_size(int i) const
+{
+  std::shared_lock<std::shared_mutex> layout(layout_mutex);
+  std::shared_lock<std::shared_mutex> lock(shards.at(i)->mutex);
+  return shards[i]->map.size();
+}
+
+template <typename K, typename V>
+void ShardedBTreeMap<K, V>::set_skew_limit(double skew_limit, int min_size)
+{
+  std::unique_lock<std::shared_mutex> layout(layout_mutex);
+  skew = skew_limit;
+  min_rebalance_size = min_size;
+}
+
+template <typename K, typename V>
+void ShardedBTreeMap<K, V>::rebalance()
+{
+  std::unique_lock<std::shared_mutex> layout(layout_mutex);
+  int n = shard_count();
+  if (n == 1)
+  {
+    return;
+  }
+
+  // another thread may have rebalanced while we waited
+  int largest = 0;
+  for (const auto &s : shards)
+  {
+    if (s->map.size() > largest)
+      largest = s->map.size();
+  }
+  if (boundaries.size() == n - 1 and !skewed(largest))
+  {
+    return;
+  }
+
+  // collect every pair in key order (shards are in key order)
+  ArraySeq<std::pair<K, V>> pairs;
+  pairs.reserve(size());
+  for (auto &s : shards)
+  {
+    pairs.append(s->map.sorted_pairs());
+  }
+
+  // split at evenly spaced ranks and bulk build each shard
+  int total = pairs.size();
+  boundaries.clear();
+  if (total < n)
+  {
+    // too few keys to give every shard one; keep them in shard 0
+    for (int i = 1; i < n; ++i)
+    {
+      shards[i]->map.clear();
+    }
+    shards[0]->map.assign_sorted(pairs.data(), total);
+    return;
+  }
+  int start = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    int end = static_cast<int>(static_cast<long long>(total) * (i + 1) / n);
+    if (i > 0)
+    {
+      boundaries.push_back(pairs.unchecked(start).first);
+    }
+    shards[i]->map.assign_sorted(pairs.data() + start, end - start);
+    start = end;
+  }
+}
+
+template <typename K, typename V>
+int ShardedBTreeMap<K, V>::shard_of(const K &key) const
+{
+  // first boundary greater than key
+  int lo = 0, hi = boundaries.size();
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (key < boundaries.unchecked(mid))
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+template <typename K, typename V>
+bool ShardedBTreeMap<K, V>::skewed(int shard_size) const
+{
+  if (shards.size() == 1 or shard_size < min_rebalance_size)
+  {
+    return false;
+  }
+  double average = static_cast<double>(size()) / shards.size();
+  return shard_size > skew * average;
+}
+
+#endif
@@ -0,0 +1,428 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: smallarrayseq.h
+// DATE: Spring 2022
+// DESC: Array sequence with a fixed-size inline buffer. Up to N
+//       elements are stored inside the object itself; the sequence
+//       only allocates from the heap once it grows past N elements.
+//       It has the Sequence<T> member functions but does not derive
+//       from Sequence<T>: it is meant for storage inside other nodes,
+//       where a vtable pointer per array would be pure overhead (wrap
+//       it in a SequenceAdapter from maptraits.h when a Sequence<T> is
+//       needed).
+//---------------------------------------------------------------------------
+
+#ifndef SMALLARRAYSEQ_H
+#define SMALLARRAYSEQ_H
+
+#include <stdexcept>
+#include <ostream>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+template <typename T, int N>
+class SmallArraySeq final
+{
+  static_assert(N > 0, "inline capacity must be positive");
+
+public:
+  // Default constructor
+  SmallArraySeq();
+
+  // Copy constructor
+  SmallArraySeq(const SmallArraySeq &rhs);
+
+  // Move constructor
+  SmallArraySeq(SmallArraySeq &&rhs);
+
+  // Copy assignment operator
+  SmallArraySeq &operator=(const SmallArraySeq &rhs);
+
+  // Move assignment operator
+  SmallArraySeq &operator=(SmallArraySeq &&rhs);
+
+  // Destructor
+  ~SmallArraySeq();
+
+  // Returns the number of elements in the sequence
+  int size() const;
+
+  // Tests if the sequence is empty
+  bool empty() const;
+
+  // Removes all of the elements from the sequence (and releases any
+  // heap storage)
+  void clear();
+
+  // Returns a reference to the element at the index in the
+  // sequence. Throws out_of_range if index is invalid (less than 0 or
+  // greater than or equal to size()).
+  T &operator[](int index);
+
+  // Returns a constant address to the element at the index in the
+  // sequence. Throws out_of_range if index is invalid (less than 0 or
+  // greater than or equal to size()).
+  const T &operator[](int index) const;
+
+  // Returns a reference to the element at the index without checking
+  // the index. The caller must guarantee 0 <= index < size().
+  T &unchecked(int index) { return array[index]; }
+  const T &unchecked(int index) const { return array[index]; }
+
+  // Returns a pointer to the current storage (inline or heap). Valid
+  // until the next operation that grows the sequence.
+  T *data() { return array; }
+  const T *data() const { return array; }
+
+  // Extends the sequence by inserting the element at the given index.
+  // Throws out_of_range if the index is invalid (less than 0 or
+  // greater than size()).
+  void insert(const T &elem, int index);
+
+  // Shrinks the sequence by removing the element at the index in the
+  // sequence. Throws out_of_range if index is invalid.
+  void erase(int index);
+
+  // Adds the element to the end of the sequence.
+  void push_back(const T &elem);
+
+  // Constructs an element from the given arguments at the end of the
+  // sequence.
+  template <typename... Args>
+  void emplace_back(Args &&...args);
+
+  // Adds the n elements starting at elems to the end of the sequence.
+  void append(const T *elems, int n);
+
+  // Makes sure the sequence can hold at least n elements without
+  // reallocating.
+  void reserve(int n);
+
+  // Returns true if the element is in the sequence, and false
+  // otherwise.
+  bool contains(const T &elem) const;
+
+  // Sorts the elements in the sequence in place using less than (<).
+  // Uses insertion sort, which is the fastest choice for the short
+  // sequences this class is meant for.
+  void sort();
+
+  // True if the elements currently live in the inline buffer
+  bool is_inline() const { return array == inline_array; }
+
+  // Number of elements the current storage can hold
+  int reserved() const { return capacity; }
+
+private:
+  // inline storage used until the sequence grows past N elements
+  T inline_array[N];
+
+  // current storage (either inline_array or a heap array)
+  T *array = inline_array;
+
+  // size of list
+  int count = 0;
+
+  // max capacity of the current storage
+  int capacity = N;
+
+  // helper to double the capacity until it can hold at least
+  // min_capacity elements (moves the elements to the heap)
+  void grow(int min_capacity);
+
+  // helper to move n elements from src to dst (ranges may overlap),
+  // using memmove for trivially copyable types
+  static void move_elems(T *dst, T *src, int n);
+};
+
+template <typename T, int N>
+std::ostream &operator<<(std::ostream &stream, const SmallArraySeq<T, N> &seq)
+{
+  int n = seq.size();
+  for (int i = 0; i < n - 1; ++i)
+    stream << seq[i] << ", ";
+  if (n > 0)
+    stream << seq[n - 1];
+  return stream;
+}
+
+template <typename T, int N>
+SmallArraySeq<T, N>::SmallArraySeq()
+{
+}
+
+template <typename T, int N>
+SmallArraySeq<T, N>::SmallArraySeq(const SmallArraySeq &rhs)
+{
+  *this = rhs;
+}
+
+template <typename T, int N>
+SmallArraySeq<T, N>::SmallArraySeq(SmallArraySeq &&rhs)
+{
+  *this = std::move(rhs);
+}
+
+template <typename T, int N>
+SmallArraySeq<T, N> &SmallArraySeq<T, N>::operator=(const SmallArraySeq &rhs)
+{
+  if (this != &rhs)
+  {
+    clear();
+    if (rhs.count > capacity)
+    {
+      reserve(rhs.count);
+    }
+    for (int i = 0; i < rhs.count; ++i)
+    {
+      array[i] = rhs.array[i];
+    }
+    count = rhs.count;
+  }
+  return *this;
+}
+
+template <typename T, int N>
+SmallArraySeq<T, N> &SmallArraySeq<T, N>::operator=(SmallArraySeq &&rhs)
+{
+  if (this != &rhs)
+  {
+    clear();
+    if (rhs.is_inline())
+    {
+      // inline elements have to be moved one by one
+      move_elems(array, rhs.array, rhs.count);
+      count = rhs.count;
+    }
+    else
+    {
+      // steal the heap array
+      array = rhs.array;
+      count = rhs.count;
+      capacity = rhs.capacity;
+      rhs.array = rhs.inline_array;
+      rhs.capacity = N;
+    }
+    rhs.count = 0;
+  }
+  return *this;
+}
+
+template <typename T, int N>
+SmallArraySeq<T, N>::~SmallArraySeq()
+{
+  clear();
+}
+
+template <typename T, int N>
+int SmallArraySeq<T, N>::size() const
+{
+  return count;
+}
+
+template <typename T, int N>
+bool SmallArraySeq<T, N>::empty() const
+{
+  return count == 0;
+}
+
+template <typename T, int N>
+void SmallArraySeq<T, N>::clear()
+{
+  if (!is_inline())
+  {
+    delete[] array;
+    array = inline_array;
+    capacity = N;
+  }
+  count = 0;
+}
+
+template <typename T, int N>
+T &SmallArraySeq<T, N>::operator[](int index)
+{
+  if (index < 0 or index >= count)
+  {
+    throw std::out_of_range("Invalid Index");
+  }
+  return array[index];
+}
+
+template <typename T, int N>
+const T &SmallArraySeq<T, N>::operator[](int index) const
+{
+  if (index < 0 or index >= count)
+  {
+    throw std::out_of_range("Invalid Index");
+  }
+  return array[index];
+}
+
+template <typename T, int N>
+void SmallArraySeq<T, N>::insert(const T &elem, int index)
+{
+  if (index < 0 or index > count)
+  {
+    throw std::out_of_range("Invalid Index");
+  }
+  // elem may refer into the array being shifted or reallocated
+  T copy = elem;
+  if (count == capacity)
+  {
+    grow(count + 1);
+  }
+  move_elems(array + index + 1, array + index, count - index);
+  array[index] = std::move(copy);
+  count++;
+}
+
+template <typename T, int N>
+void SmallArraySeq<T, N>::erase(int index)
+{
+  if (index < 0 or index >= count)
+  {
+    throw std::out_of_range("Invalid Index");
+  }
+  move_elems(array + index, array + index + 1, count - index - 1);
+  count--;
+}
+
+template <typename T, int N>
+void SmallArraySeq<T, N>::push_back(const T &elem)
+{
+  if (count == capacity)
+  {
+    T copy = elem;
+    grow(count + 1);
+    array[count++] = std::move(copy);
+    return;
+  }
+  array[count++] = elem;
+}
+
+template <typename T, int N>
+template <typename... Args>
+void SmallArraySeq<T, N>::emplace_back(Args &&...args)
+{
+  T elem(std::forward<Args>(args)...);
+  if (count == capacity)
+  {
+    grow(count + 1);
+  }
+  array[count++] = std::move(elem);
+}
+
+template <typename T, int N>
+void SmallArraySeq<T, N>::append(const T *elems, int n)
+{
+  if (n <= 0)
+  {
+    return;
+  }
+  if (count + n > capacity)
+  {
+    // elems may point into this sequence
+    SmallArraySeq tmp;
+    tmp.reserve(count + n);
+    move_elems(tmp.array, array, count);
+    for (int i = 0; i < n; ++i)
+    {
+      tmp.array[count + i] = elems[i];
+    }
+    tmp.count = count + n;
+    *this = std::move(tmp);
+    return;
+  }
+  for (int i = 0; i < n; ++i)
+  {
+    array[count + i] = elems[i];
+  }
+  count += n;
+}
+
+template <typename T, int N>
+void SmallArraySeq<T, N>::reserve(int n)
+{
+  if (n <= capacity)
+  {
+    return;
+  }
+  T *new_array = new T[n];
+  move_elems(new_array, array, count);
+  if (!is_inline())
+  {
+    delete[] array;
+  }
+  array = new_array;
+  capacity = n;
+}
+
+template <typename T, int N>
+bool SmallArraySeq<T, N>::contains(const T &elem) const
+{
+  for (int i = 0; i < count; ++i)
+  {
+    if (array[i] == elem)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename T, int N>
+void SmallArraySeq<T, N>::sort()
+{
+  for (int i = 1; i < count; ++i)
+  {
+    T elem = std::move(array[i]);
+    int j = i - 1;
+    while (j >= 0 and elem < array[j])
+    {
+      array[j + 1] = std::move(array[j]);
+      --j;
+    }
+    array[j + 1] = std::move(elem);
+  }
+}
+
+template <typename T, int N>
+void SmallArraySeq<T, N>::grow(int min_capacity)
+{
+  int new_capacity = capacity;
+  while (new_capacity < min_capacity)
+  {
+    new_capacity = new_capacity * 2;
+  }
+  reserve(new_capacity);
+}
+
+template <typename T, int N>
+void SmallArraySeq<T, N>::move_elems(T *dst, T *src, int n)
+{
+  if (n <= 0 or dst == src)
+  {
+    return;
+  }
+  if (std::is_trivially_copyable<T>::value)
+  {
+    std::memmove(static_cast<void *>(dst), static_cast<const void *>(src), n * sizeof(T));
+  }
+  else if (dst < src)
+  {
+    for (int i = 0; i < n; ++i)
+    {
+      dst[i] = std::move(src[i]);
+    }
+  }
+  else
+  {
+    for (int i = n - 1; i >= 0; --i)
+    {
+      dst[i] = std::move(src[i]);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,152 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: btreemap_fuzz.cpp
+// DATE: Spring 2022
+// DESC: Randomized test of BTreeMap inserts and erases. Runs random
+//       insert, erase and try_erase calls on a BTreeMap and a std::map
+//       side by side, calling validate() after every step, and checks
+//       that both maps hold the same pairs. Small key ranges keep the
+//       tree churning through merges, borrows and root collapses.
+//
+// BUILD: g++ -std=c++17 -O1 -g -fsanitize=address,undefined -o btreemap_fuzz btreemap_fuzz.cpp
+//
+// USAGE: btreemap_fuzz [--seeds N] [--steps N]
+//        --seeds sets the number of random seeds (default 20) and
+//        --steps the operations per seed (default 10000). Prints "ok"
+//        and exits 0 if every check passes; otherwise prints the seed
+//        and the check that failed and exits 1.
+//---------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include "../btreemap.h"
+
+namespace
+{
+
+// the first failure found (the tree's own checks throw logic_error)
+struct Failure : std::runtime_error
+{
+  using std::runtime_error::runtime_error;
+};
+
+void check(bool ok, const char *what)
+{
+  if (!ok)
+    throw Failure(what);
+}
+
+// every pair of model is in map, in the same order, and nothing else
+void compare(const BTreeMap<int, int> &map, const std::map<int, int> &model)
+{
+  check(map.size() == static_cast<int>(model.size()), "size differs");
+  ArraySeq<std::pair<int, int>> pairs = map.sorted_pairs();
+  check(pairs.size() == static_cast<int>(model.size()), "sorted_pairs size differs");
+  int i = 0;
+  for (const auto &p : model)
+  {
+    check(pairs.unchecked(i).first == p.first and pairs.unchecked(i).second == p.second,
+          "pair differs");
+    check(map[p.first] == p.second, "lookup differs");
+    ++i;
+  }
+}
+
+// one seed: steps random operations over keys in [0, range)
+void run(unsigned seed, int steps, int range)
+{
+  std::mt19937_64 rng(seed);
+  BTreeMap<int, int> map;
+  std::map<int, int> model;
+  for (int step = 0; step < steps; ++step)
+  {
+    int key = static_cast<int>(rng() % range);
+    bool present = model.count(key) != 0;
+    switch (rng() % 3)
+    {
+    case 0:
+      if (!present)
+      {
+        map.insert(key, step);
+        model[key] = step;
+      }
+      break;
+    case 1:
+    {
+      bool threw = false;
+      try
+      {
+        map.erase(key);
+      }
+      catch (std::out_of_range &)
+      {
+        threw = true;
+      }
+      check(threw != present, "erase threw for a present key or not for an absent one");
+      model.erase(key);
+      break;
+    }
+    default:
+      check(map.try_erase(key) == present, "try_erase result differs");
+      model.erase(key);
+      break;
+    }
+    map.validate();
+    check(map.contains(key) == (model.count(key) != 0), "contains differs");
+    if (step % 1000 == 0)
+      compare(map, model);
+  }
+  compare(map, model);
+
+  // drain it completely, then check the empty tree still works
+  while (!model.empty())
+  {
+    int key = model.begin()->first;
+    map.erase(key);
+    model.erase(model.begin());
+    map.validate();
+  }
+  check(map.empty() and map.height() == 0, "drained map is not empty");
+  map.insert(1, 1);
+  map.validate();
+  compare(map, {{1, 1}});
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  int seeds = 20, steps = 10000;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (std::strcmp(argv[i], "--seeds") == 0)
+      seeds = std::stoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--steps") == 0)
+      steps = std::stoi(argv[i + 1]);
+    else
+    {
+      std::fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  for (int seed = 0; seed < seeds; ++seed)
+  {
+    // alternate a small range (mostly erasing) with a large one
+    int range = seed % 2 ? 300 : 5000;
+    try
+    {
+      run(seed, steps, range);
+    }
+    catch (std::exception &e)
+    {
+      std::printf("seed %d (keys 0..%d): %s\n", seed, range - 1, e.what());
+      return 1;
+    }
+  }
+  std::printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,349 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: cache_test.cpp
+// DATE: Spring 2022
+// DESC: Test of BTreeMap's optional lookup cache. Built with
+//       BTREEMAP_STATS, a lookup that makes no node visits was answered
+//       from the cache, so the test checks that repeated lookups hit
+//       and that erase, clear, split_at, join, copies and moves empty
+//       the cache: afterwards the keys that were cached must be looked
+//       up in the tree again, and keys that left the map (or moved to
+//       another one) must not be found through a slot still pointing at
+//       their old node. A random run then checks every lookup against
+//       a std::map, and several threads read one map at once through a
+//       small cache they all fill (build with -fsanitize=thread as
+//       well to check that the slots do not race).
+//
+// BUILD: g++ -std=c++17 -O1 -g -fsanitize=address,undefined -pthread -o cache_test cache_test.cpp
+//
+// USAGE: cache_test [--seeds N] [--steps N] [--threads N]
+//        --seeds sets the number of random seeds (default 10), --steps
+//        the operations per seed (default 5000) and --threads the
+//        reader threads (default 4). Prints "ok" and exits 0 if every
+//        check passes; otherwise prints the seed and the check that
+//        failed and exits 1.
+//---------------------------------------------------------------------------
+
+#define BTREEMAP_STATS
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "../btreemap.h"
+
+namespace
+{
+
+struct Failure : std::runtime_error
+{
+  using std::runtime_error::runtime_error;
+};
+
+void check(bool ok, const char *what)
+{
+  if (!ok)
+    throw Failure(what);
+}
+
+using Map = BTreeMap<int, int>;
+
+// node visits of one contains call (0 on a cache hit)
+long long visits(Map &map, int key, bool &found)
+{
+  map.reset_counters();
+  found = map.contains(key);
+  return map.counters(BTreeOp::contains).node_visits;
+}
+
+// a map of the keys 0, 2, ..., 2 * (n - 1) with a cache of 4096 slots
+Map make_map(int n)
+{
+  Map map;
+  map.enable_cache();
+  for (int i = 0; i < n; ++i)
+    map.insert(2 * i, i);
+  return map;
+}
+
+// looks key up until it is cached; the second lookup must hit
+void warm(Map &map, int key)
+{
+  bool found = false;
+  visits(map, key, found);
+  check(found, "warm key is missing");
+  check(visits(map, key, found) == 0 and found, "second lookup missed the cache");
+}
+
+// key is looked up in the tree (not through a stale slot), with the
+// given result
+void cold(Map &map, int key, bool present, const char *what)
+{
+  bool found = false;
+  long long n = visits(map, key, found);
+  check(found == present, what);
+  check(map.empty() or n > 0, "lookup hit a slot the cache should have dropped");
+}
+
+void test_invalidation()
+{
+  const int n = 2000;
+  // erase of another key: nodes may merge, so every slot goes
+  {
+    Map map = make_map(n);
+    warm(map, 10);
+    warm(map, 2 * n - 2);
+    map.erase(12);
+    cold(map, 10, true, "erase lost a cached key");
+    cold(map, 2 * n - 2, true, "erase lost a cached key");
+    // and of the cached key itself
+    warm(map, 10);
+    map.erase(10);
+    cold(map, 10, false, "erased key still found through the cache");
+  }
+  // clear
+  {
+    Map map = make_map(n);
+    warm(map, 100);
+    map.clear();
+    cold(map, 100, false, "cleared key still found through the cache");
+    map.insert(100, 1);
+    cold(map, 100, true, "key inserted after clear not found");
+    check(map[100] == 1, "stale value after clear");
+  }
+  // split_at: the upper keys now live in nodes of the new map
+  {
+    Map map = make_map(n);
+    warm(map, 10);
+    warm(map, 3000);
+    Map upper = map.split_at(n);
+    cold(map, 10, true, "split_at lost a cached lower key");
+    cold(map, 3000, false, "moved key still found through the cache");
+    bool found = false;
+    visits(upper, 3000, found);
+    check(found, "split_at lost the moved key");
+  }
+  // join: other's nodes now belong to this map
+  {
+    Map map = make_map(n), other;
+    other.enable_cache(64);
+    for (int key = 2 * n; key < 3 * n; ++key)
+      other.insert(key, -key);
+    warm(map, 10);
+    warm(other, 2 * n + 5);
+    map.join(other);
+    check(other.empty(), "join left keys in other");
+    cold(other, 2 * n + 5, false, "joined key still found through other's cache");
+    cold(map, 10, true, "join lost a cached key");
+    cold(map, 2 * n + 5, true, "join lost a key of other");
+    check(map[2 * n + 5] == -(2 * n + 5), "joined key has the wrong value");
+    // into an empty map, which takes other's whole tree
+    Map empty;
+    empty.enable_cache();
+    warm(map, 2 * n + 5);
+    empty.join(map);
+    cold(map, 2 * n + 5, false, "joined key still found through other's cache");
+    cold(empty, 2 * n + 5, true, "join into an empty map lost a key");
+  }
+  // copies have their own empty cache, and moves leave the source
+  // without the nodes its slots pointed at
+  {
+    Map map = make_map(n);
+    warm(map, 10);
+    Map copy = map;
+    check(copy.has_cache(), "copy lost the cache");
+    cold(copy, 10, true, "copy lost a key");
+    Map moved = std::move(map);
+    check(moved.has_cache(), "move lost the cache");
+    cold(moved, 10, true, "move lost a key");
+    cold(map, 10, false, "moved-from map still found a key through the cache");
+    // move assignment over a map with a warm cache of its own
+    warm(copy, 20);
+    warm(moved, 20);
+    copy = std::move(moved);
+    cold(copy, 20, true, "move assignment lost a key");
+    cold(moved, 20, false, "moved-from map still found a key through the cache");
+    copy.insert(1, 1);
+    copy = Map(copy);
+    cold(copy, 20, true, "copy assignment lost a key");
+  }
+}
+
+// random operations on a map with a small cache (so slots collide),
+// every lookup checked against a std::map
+void run(unsigned seed, int steps)
+{
+  std::mt19937 rng(seed);
+  const int range = 2000;
+  Map map;
+  map.enable_cache(1 << (rng() % 8));
+  if (rng() % 2)
+    map.enable_filter();
+  std::map<int, int> model;
+  for (int step = 0; step < steps; ++step)
+  {
+    // mostly a small set of hot keys
+    int key = static_cast<int>(rng() % (rng() % 4 == 0 ? range : 50));
+    int value = static_cast<int>(rng() % 1000);
+    switch (rng() % 12)
+    {
+    case 0:
+    case 1:
+      map.insert_or_assign(key, value);
+      model[key] = value;
+      break;
+    case 2:
+      check(map.try_erase(key) == (model.erase(key) != 0), "try_erase differs");
+      break;
+    case 3:
+      if (rng() % 50 == 0)
+      {
+        map.clear();
+        model.clear();
+      }
+      break;
+    case 4:
+    {
+      Map upper = map.split_at(key);
+      for (int k = key; k < key + 20; ++k)
+        check(!map.contains(k), "split_at left a key above the split");
+      map.join(upper);
+      break;
+    }
+    case 5:
+      if (rng() % 10 == 0)
+      {
+        Map copy = map;
+        map = std::move(copy);
+      }
+      break;
+    case 6:
+    {
+      // writes through the non-const lookups
+      auto it = model.find(key);
+      int *v = map.find(key);
+      check((v != nullptr) == (it != model.end()), "find differs");
+      if (v != nullptr)
+      {
+        *v = value;
+        it->second = value;
+      }
+      break;
+    }
+    default:
+    {
+      const Map &read = map;
+      auto it = model.find(key);
+      bool present = it != model.end();
+      check(read.contains(key) == present, "contains differs");
+      const int *v = read.find(key);
+      check((v != nullptr) == present and (v == nullptr or *v == it->second), "find differs");
+      check(read.get_or(key, -1) == (present ? it->second : -1), "get_or differs");
+      break;
+    }
+    }
+  }
+  map.validate();
+  for (int key = 0; key < range; ++key)
+  {
+    auto it = model.find(key);
+    const int *v = map.find(key);
+    check((v != nullptr) == (it != model.end()) and (v == nullptr or *v == it->second),
+          "find differs at the end");
+  }
+}
+
+// several threads read one map at once through a small shared cache;
+// the map changes only between rounds, with no reader running (round
+// 0 has every key, and each later round only the keys of its parity)
+void test_threads(int threads)
+{
+  const int n = 5000;
+  Map map;
+  map.enable_cache(64);
+  for (int i = 0; i < n; ++i)
+    map.insert(i, 3 * i);
+  for (int round = 0; round < 4; ++round)
+  {
+    std::atomic<bool> ok{true};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < threads; ++t)
+    {
+      readers.emplace_back([&map, &ok, t, round]() {
+        const Map &read = map;
+        std::mt19937 rng(t * 7 + round);
+        for (int i = 0; i < 20000; ++i)
+        {
+          // hot keys collide in the 64 slots, so the threads keep
+          // replacing each other's entries
+          int key = static_cast<int>(rng() % (i % 2 ? 200 : 2 * n));
+          bool present = key < n and (round == 0 or key % 2 == round % 2);
+          const int *v = read.find(key);
+          if ((v != nullptr) != present or (v != nullptr and *v != 3 * key))
+            ok = false;
+        }
+      });
+    }
+    for (std::thread &reader : readers)
+      reader.join();
+    check(ok, "a reader saw the wrong result through the shared cache");
+    for (int key = 0; key < n; ++key)
+    {
+      if (key % 2 != (round + 1) % 2)
+        map.try_erase(key);
+      else if (!map.contains(key))
+        map.insert(key, 3 * key);
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  int seeds = 10, steps = 5000, threads = 4;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (std::strcmp(argv[i], "--seeds") == 0)
+      seeds = std::stoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--steps") == 0)
+      steps = std::stoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--threads") == 0)
+      threads = std::stoi(argv[i + 1]);
+    else
+    {
+      std::fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  try
+  {
+    test_invalidation();
+    test_threads(threads);
+  }
+  catch (std::exception &e)
+  {
+    std::printf("%s\n", e.what());
+    return 1;
+  }
+  for (int seed = 0; seed < seeds; ++seed)
+  {
+    try
+    {
+      run(seed, steps);
+    }
+    catch (std::exception &e)
+    {
+      std::printf("seed %d: %s\n", seed, e.what());
+      return 1;
+    }
+  }
+  std::printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,187 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: concurrent_stress.cpp
+// DATE: Spring 2022
+// DESC: Reader/writer stress test of ConcurrentBTreeMap. One writer
+//       inserts, overwrites and erases random keys while reader threads
+//       call find, find_keys and next_key. Every value stored for a key
+//       encodes that key, and every tenth key is inserted up front and
+//       never erased, so each reader can check what it sees against any
+//       published version of the map: values belong to their keys, key
+//       ranges are ascending and in bounds, and no permanent key is ever
+//       missing or skipped. Build it with ASan so a node reclaimed while
+//       a reader still uses it shows up as a use-after-free.
+//
+// BUILD: g++ -std=c++17 -O1 -g -fsanitize=address,undefined -pthread -o concurrent_stress concurrent_stress.cpp
+//
+// USAGE: concurrent_stress [--readers N] [--writes N]
+//        --readers sets the number of reader threads (default 3) and
+//        --writes the number of writer operations (default 100000).
+//        Prints "ok" and exits 0 if every check passes; otherwise
+//        prints the first failed check and exits 1.
+//---------------------------------------------------------------------------
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../concurrentbtreemap.h"
+
+namespace
+{
+
+// keys are 0 to key_range - 1; the multiples of 10 are permanent
+const int key_range = 20000;
+
+bool permanent(int key)
+{
+  return key % 10 == 0;
+}
+
+// values carry their key in the high bits and a write number in the
+// low ones, so overwrites change the value but not the key it encodes
+int value_for(int key, int write)
+{
+  return key * 256 + (write & 255);
+}
+
+int key_of(int value)
+{
+  return value / 256;
+}
+
+// first failed check, reported once all threads have stopped
+std::atomic<bool> failed{false};
+std::mutex failure_mutex;
+std::string failure;
+
+void check(bool ok, const char *what)
+{
+  if (!ok and !failed.exchange(true))
+  {
+    std::lock_guard<std::mutex> lock(failure_mutex);
+    failure = what;
+  }
+}
+
+void reader(const ConcurrentBTreeMap<int, int> &map, const std::atomic<bool> &done,
+            unsigned seed)
+{
+  std::mt19937 rng(seed);
+  while (!done.load(std::memory_order_relaxed) and !failed.load(std::memory_order_relaxed))
+  {
+    int key = static_cast<int>(rng() % key_range);
+    int value = 0;
+    bool found = map.find(key, value);
+    check(!found or key_of(value) == key, "find returned another key's value");
+    check(found or !permanent(key), "find missed a permanent key");
+
+    int lo = static_cast<int>(rng() % key_range);
+    int hi = lo + static_cast<int>(rng() % 200);
+    ArraySeq<int> keys = map.find_keys(lo, hi);
+    int expected = lo;
+    for (int i = 0; i < keys.size(); ++i)
+    {
+      int k = keys.unchecked(i);
+      check(lo <= k and k <= hi, "find_keys returned a key out of range");
+      check(i == 0 or keys.unchecked(i - 1) < k, "find_keys keys not ascending");
+      // every permanent key between the previous key and this one
+      // must have been returned
+      for (; expected < k; ++expected)
+        check(!permanent(expected), "find_keys skipped a permanent key");
+      expected = k + 1;
+    }
+    for (; expected <= hi and expected < key_range; ++expected)
+      check(!permanent(expected), "find_keys skipped a permanent key");
+
+    int next = 0;
+    if (map.next_key(key, next))
+    {
+      check(key < next, "next_key not after the key");
+      // the next permanent key bounds the successor
+      int bound = (key / 10 + 1) * 10;
+      check(bound >= key_range or next <= bound, "next_key skipped a permanent key");
+    }
+    else
+    {
+      check(key >= key_range - 10, "next_key found no successor");
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  int readers = 3, writes = 100000;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (std::strcmp(argv[i], "--readers") == 0)
+      readers = std::stoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--writes") == 0)
+      writes = std::stoi(argv[i + 1]);
+    else
+    {
+      std::fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  ConcurrentBTreeMap<int, int> map;
+  std::set<int> model;
+  for (int key = 0; key < key_range; key += 10)
+  {
+    map.insert(key, value_for(key, 0));
+    model.insert(key);
+  }
+
+  std::atomic<bool> done{false};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < readers; ++t)
+    threads.emplace_back(reader, std::cref(map), std::cref(done), 100 + t);
+
+  // the writer: inserts (or overwrites) and erases the other keys,
+  // and overwrites the permanent ones
+  std::mt19937 rng(1);
+  for (int write = 1; write <= writes and !failed.load(); ++write)
+  {
+    int key = static_cast<int>(rng() % key_range);
+    if (permanent(key) or rng() % 2)
+    {
+      map.insert(key, value_for(key, write));
+      model.insert(key);
+    }
+    else if (model.erase(key))
+    {
+      map.erase(key);
+    }
+  }
+  done = true;
+  for (std::thread &thread : threads)
+    thread.join();
+
+  // with the readers stopped the map must match the writer's model
+  ArraySeq<int> keys = map.sorted_keys();
+  check(keys.size() == static_cast<int>(model.size()) and map.size() == keys.size(),
+        "final size differs");
+  int i = 0;
+  for (int key : model)
+  {
+    if (i >= keys.size())
+      break;
+    check(keys.unchecked(i++) == key, "final keys differ");
+  }
+
+  if (failed)
+  {
+    std::printf("failed: %s\n", failure.c_str());
+    return 1;
+  }
+  std::printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,225 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: cursor_test.cpp
+// DATE: Spring 2022
+// DESC: Randomized test of BTreeMap's hinted insert, contains and at.
+//       Keeps a few cursors and uses them at random, mostly on keys
+//       near the last key each one reached (so the leaf fast path is
+//       taken) and sometimes anywhere. Plain inserts, erases, clear,
+//       split_at and join, copies and moves change the tree under the
+//       cursors, leaving them out of date; every hinted call must
+//       still agree with a std::map. Inserting a key that is already
+//       present, plain or hinted, replaces its value.
+//
+// BUILD: g++ -std=c++17 -O1 -g -fsanitize=address,undefined -o cursor_test cursor_test.cpp
+//
+// USAGE: cursor_test [--seeds N] [--steps N]
+//        --seeds sets the number of random seeds (default 10) and
+//        --steps the operations per seed (default 20000). Prints "ok"
+//        and exits 0 if every check passes; otherwise prints the seed
+//        and the check that failed and exits 1.
+//---------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "../btreemap.h"
+
+namespace
+{
+
+struct Failure : std::runtime_error
+{
+  using std::runtime_error::runtime_error;
+};
+
+void check(bool ok, const char *what)
+{
+  if (!ok)
+    throw Failure(what);
+}
+
+using Map = BTreeMap<int, int>;
+
+void compare(const Map &map, const std::map<int, int> &model)
+{
+  map.validate();
+  check(map.size() == static_cast<int>(model.size()), "size differs");
+  ArraySeq<std::pair<int, int>> pairs = map.sorted_pairs();
+  int i = 0;
+  for (const auto &p : model)
+  {
+    check(pairs.unchecked(i).first == p.first and pairs.unchecked(i).second == p.second,
+          "pair differs");
+    ++i;
+  }
+}
+
+// one hinted call with cursor c on key, checked against the model
+void hinted(std::mt19937 &rng, Map &map, std::map<int, int> &model, Map::Cursor &c, int key,
+            int value)
+{
+  bool present = model.count(key) != 0;
+  switch (rng() % 3)
+  {
+  case 0:
+    // a present key has its value replaced
+    map.insert(key, value, c);
+    model[key] = value;
+    break;
+  case 1:
+    check(map.contains(key, c) == present, "hinted contains differs");
+    break;
+  default:
+  {
+    bool threw = false;
+    try
+    {
+      int &v = map.at(key, c);
+      check(present and v == model[key], "hinted at returned the wrong value");
+      // writes go through the returned reference
+      v = value;
+      model[key] = value;
+    }
+    catch (std::out_of_range &)
+    {
+      threw = true;
+    }
+    check(threw != present, "hinted at threw for a present key or not for an absent one");
+    break;
+  }
+  }
+}
+
+void run(unsigned seed, int steps)
+{
+  std::mt19937 rng(seed);
+  const int range = 4000;
+  Map map;
+  std::map<int, int> model;
+  Map::Cursor cursors[3];
+  int last[3] = {0, range / 2, range - 1};
+  for (int step = 0; step < steps; ++step)
+  {
+    int value = static_cast<int>(rng() % 100000);
+    int c = static_cast<int>(rng() % 3);
+    switch (rng() % 20)
+    {
+    case 0:
+    case 1:
+    {
+      // plain insert: new keys split leaves and outdate the cursors;
+      // a present key is replaced
+      int key = static_cast<int>(rng() % range);
+      map.insert(key, value);
+      model[key] = value;
+      break;
+    }
+    case 2:
+    case 3:
+    {
+      int key = static_cast<int>(rng() % range);
+      check(map.try_erase(key) == (model.erase(key) != 0), "try_erase differs");
+      break;
+    }
+    case 4:
+      if (rng() % 50 == 0)
+      {
+        map.clear();
+        model.clear();
+      }
+      break;
+    case 5:
+      if (rng() % 20 == 0)
+      {
+        // split off the top and join it back
+        int key = static_cast<int>(rng() % range);
+        Map upper = map.split_at(key);
+        check(!upper.contains(key - 1), "split_at moved a smaller key");
+        map.join(upper);
+      }
+      break;
+    case 6:
+      if (rng() % 20 == 0)
+      {
+        // round trip through a copy and a move: the cursors belong to
+        // the old tree
+        Map copy = map;
+        map = std::move(copy);
+      }
+      break;
+    case 7:
+    case 8:
+    case 9:
+      // anywhere
+      last[c] = static_cast<int>(rng() % range);
+      hinted(rng, map, model, cursors[c], last[c], value);
+      break;
+    default:
+      // near the cursor's last key, so it usually covers the key
+      last[c] += static_cast<int>(rng() % 7) - 3;
+      if (last[c] < 0)
+        last[c] = 0;
+      if (last[c] >= range)
+        last[c] = range - 1;
+      hinted(rng, map, model, cursors[c], last[c], value);
+      break;
+    }
+    if (step % 500 == 0)
+      compare(map, model);
+  }
+  compare(map, model);
+
+  // ascending appends take the rightmost leaf path of plain insert
+  Map appended;
+  std::map<int, int> model_appended;
+  for (int key = 0; key < 5000; ++key)
+  {
+    appended.insert(key, key);
+    model_appended[key] = key;
+    if (key % 7 == 0)
+    {
+      // replaces, and must not add a second copy
+      appended.insert(key, -key);
+      model_appended[key] = -key;
+    }
+  }
+  compare(appended, model_appended);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  int seeds = 10, steps = 20000;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (std::strcmp(argv[i], "--seeds") == 0)
+      seeds = std::stoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--steps") == 0)
+      steps = std::stoi(argv[i + 1]);
+    else
+    {
+      std::fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  for (int seed = 0; seed < seeds; ++seed)
+  {
+    try
+    {
+      run(seed, steps);
+    }
+    catch (std::exception &e)
+    {
+      std::printf("seed %d: %s\n", seed, e.what());
+      return 1;
+    }
+  }
+  std::printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,317 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: filter_test.cpp
+// DATE: Spring 2022
+// DESC: Test of BTreeMap's optional Bloom filter. A map with the filter
+//       on and one with it off run the same random inserts, upserts,
+//       erases, bulk operations, clears, splits, joins, copies and
+//       moves side by side with a std::map; after every step each
+//       present key must be found by both maps (the filter must never
+//       turn away a key that is there) and absent keys must not be.
+//       Built with BTREEMAP_STATS, it also counts the nodes misses
+//       visit to check that the filter turns most misses away, that it
+//       is refilled after clear, rebuilt once split_at has moved most
+//       of the keys out, and skipped after join until the next insert
+//       rebuilds it.
+//
+// BUILD: g++ -std=c++17 -O1 -g -fsanitize=address,undefined -o filter_test filter_test.cpp
+//
+// USAGE: filter_test [--seeds N] [--steps N]
+//        --seeds sets the number of random seeds (default 10) and
+//        --steps the operations per seed (default 4000). Prints "ok"
+//        and exits 0 if every check passes; otherwise prints the seed
+//        and the check that failed and exits 1.
+//---------------------------------------------------------------------------
+
+#define BTREEMAP_STATS
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "../btreemap.h"
+
+namespace
+{
+
+struct Failure : std::runtime_error
+{
+  using std::runtime_error::runtime_error;
+};
+
+void check(bool ok, const char *what)
+{
+  if (!ok)
+    throw Failure(what);
+}
+
+using Map = BTreeMap<int, int>;
+
+// every key of model is found through each lookup, and the other
+// keys in [lo, hi) are not
+void compare(const Map &map, const std::map<int, int> &model, int lo, int hi)
+{
+  check(map.size() == static_cast<int>(model.size()), "size differs");
+  for (int key = lo; key < hi; ++key)
+  {
+    auto it = model.find(key);
+    bool present = it != model.end();
+    check(map.contains(key) == present, present ? "contains missed a present key"
+                                                : "contains found an absent key");
+    const int *value = map.find(key);
+    check((value != nullptr) == present, "find differs");
+    check(!present or *value == it->second, "find returned the wrong value");
+    check(map.get_or(key, -7) == (present ? it->second : -7), "get_or differs");
+  }
+}
+
+// node visits of the contains calls for n absent keys: first, first
+// + 2 and so on (odd by default, while the present keys are even)
+long long miss_visits(Map &map, int n, int first = 1)
+{
+  map.reset_counters();
+  for (int i = 0; i < n; ++i)
+    map.contains(first + 2 * i);
+  return map.counters(BTreeOp::contains).node_visits;
+}
+
+void run(unsigned seed, int steps)
+{
+  std::mt19937 rng(seed);
+  const int range = 3000;
+  Map filtered, plain;
+  filtered.enable_filter(4 + static_cast<int>(rng() % 12));
+  std::map<int, int> model;
+  for (int step = 0; step < steps; ++step)
+  {
+    int key = static_cast<int>(rng() % range);
+    int value = static_cast<int>(rng() % 1000);
+    switch (rng() % 16)
+    {
+    case 0:
+    case 1:
+    case 2:
+      if (!model.count(key))
+      {
+        filtered.insert(key, value);
+        plain.insert(key, value);
+        model[key] = value;
+      }
+      break;
+    case 3:
+    case 4:
+      filtered.insert_or_assign(key, value);
+      plain.insert_or_assign(key, value);
+      model[key] = value;
+      break;
+    case 5:
+    {
+      auto add = [value](int &v) { v += value; };
+      filtered.upsert(key, value, add);
+      plain.upsert(key, value, add);
+      auto it = model.find(key);
+      if (it == model.end())
+        model[key] = value;
+      else
+        it->second += value;
+      break;
+    }
+    case 6:
+    case 7:
+    case 8:
+    case 9:
+    {
+      // erases outnumber inserts, so the filter keeps filling with
+      // erased keys and has to be rebuilt
+      bool present = model.erase(key) != 0;
+      check(filtered.try_erase(key) == present, "try_erase differs with the filter");
+      check(plain.try_erase(key) == present, "try_erase differs without the filter");
+      break;
+    }
+    case 10:
+    {
+      // batched lookups take the filter too
+      int keys[8];
+      bool found[8];
+      for (int &k : keys)
+        k = static_cast<int>(rng() % range);
+      filtered.contains(keys, 8, found);
+      for (int j = 0; j < 8; ++j)
+        check(found[j] == (model.count(keys[j]) != 0), "batched contains differs");
+      break;
+    }
+    case 11:
+      if (rng() % 30 == 0)
+      {
+        filtered.clear();
+        plain.clear();
+        model.clear();
+      }
+      break;
+    case 12:
+    {
+      // split, then join back
+      Map upper = filtered.split_at(key), plain_upper = plain.split_at(key);
+      check(!upper.has_filter(), "split_at gave the new map a filter");
+      for (int k = 0; k < key; ++k)
+        check(filtered.contains(k) == (model.count(k) != 0), "contains differs after split_at");
+      filtered.join(upper);
+      plain.join(plain_upper);
+      break;
+    }
+    case 13:
+    {
+      // join keys from another map above the range, then drop them
+      Map extra;
+      if (rng() % 2)
+        extra.enable_filter();
+      std::map<int, int> joined;
+      for (int k = range; k < range + 50; k += 1 + static_cast<int>(rng() % 5))
+      {
+        extra.insert(k, k);
+        joined[k] = k;
+      }
+      filtered.join(extra);
+      check(filtered.size() == static_cast<int>(model.size() + joined.size()), "join size differs");
+      for (int k = range; k < range + 50; ++k)
+        check(filtered.contains(k) == (joined.count(k) != 0), "contains differs after join");
+      Map dropped = filtered.split_at(range);
+      compare(dropped, joined, range, range + 50);
+      break;
+    }
+    case 14:
+      if (rng() % 10 == 0)
+      {
+        // bulk rebuild through set algebra
+        Map other;
+        for (int k = 0; k < range; k += 1 + static_cast<int>(rng() % 40))
+          other.insert(k, k);
+        filtered.subtract(other);
+        plain.subtract(other);
+        for (int k = 0; k < range; ++k)
+          if (other.contains(k))
+            model.erase(k);
+      }
+      break;
+    default:
+      if (rng() % 10 == 0)
+      {
+        // copies and moves carry the filter
+        Map copy = filtered;
+        check(copy.has_filter(), "copy lost the filter");
+        filtered = std::move(copy);
+        check(filtered.has_filter(), "move lost the filter");
+      }
+      break;
+    }
+    filtered.validate();
+    check(filtered.contains(key) == (model.count(key) != 0), "contains differs after a step");
+    if (step % 250 == 0)
+    {
+      compare(filtered, model, -1, range + 1);
+      compare(plain, model, -1, range + 1);
+    }
+  }
+  compare(filtered, model, -1, range + 1);
+  compare(plain, model, -1, range + 1);
+}
+
+// the filter's effect on misses, through the node visit counters
+void test_rebuilds()
+{
+  const int n = 20000;
+  Map map, plain;
+  map.enable_filter();
+  for (int i = 0; i < n; ++i)
+  {
+    map.insert(2 * i, i);
+    plain.insert(2 * i, i);
+  }
+  long long unfiltered = miss_visits(plain, n);
+  check(unfiltered >= n, "misses without a filter skipped the tree");
+  // about 1% of the misses get through at 10 bits per key
+  check(miss_visits(map, n) * 10 < unfiltered, "filter let most misses through");
+
+  // cleared and refilled
+  map.clear();
+  check(miss_visits(map, n) == 0, "cleared map visited nodes");
+  for (int i = 0; i < n; ++i)
+    map.insert(2 * i, i);
+  check(miss_visits(map, n) * 10 < unfiltered, "filter not refilled after clear");
+
+  // split_at moves three quarters of the keys out; the filter still
+  // holds them (and lets lookups of them into the tree) until an erase
+  // rebuilds it
+  Map upper = map.split_at(n / 2);
+  for (int i = 0; i < n / 4; ++i)
+    check(map.contains(2 * i), "split_at lost a key");
+  const int moved = n - n / 4;
+  long long before_erase = miss_visits(map, moved, n / 2);
+  check(before_erase >= moved, "filter dropped the moved keys without a rebuild");
+  map.erase(0);
+  map.insert(0, 0);
+  check(miss_visits(map, moved, n / 2) * 10 < before_erase, "filter not rebuilt after split_at");
+  check(miss_visits(map, n) * 10 < unfiltered, "rebuilt filter let most misses through");
+
+  // join: the map's filter has not seen the joined keys, so it is off
+  // (no false negatives) until the next insert rebuilds it
+  map.join(upper);
+  for (int i = 0; i < n; ++i)
+    check(map.contains(2 * i), "filter turned away a joined key");
+  check(miss_visits(map, n) >= n, "stale filter still used after join");
+  map.insert(-2, 0);
+  check(miss_visits(map, n) * 10 < unfiltered, "filter not rebuilt after join");
+  for (int i = 0; i < n; ++i)
+    check(map.contains(2 * i), "rebuilt filter turned away a key");
+
+  // turning it off and on again
+  map.disable_filter();
+  check(!map.has_filter() and miss_visits(map, n) >= n, "disabled filter still used");
+  map.enable_filter();
+  check(miss_visits(map, n) * 10 < unfiltered, "filter not built by enable_filter");
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  int seeds = 10, steps = 4000;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (std::strcmp(argv[i], "--seeds") == 0)
+      seeds = std::stoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--steps") == 0)
+      steps = std::stoi(argv[i + 1]);
+    else
+    {
+      std::fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  try
+  {
+    test_rebuilds();
+  }
+  catch (std::exception &e)
+  {
+    std::printf("%s\n", e.what());
+    return 1;
+  }
+  for (int seed = 0; seed < seeds; ++seed)
+  {
+    try
+    {
+      run(seed, steps);
+    }
+    catch (std::exception &e)
+    {
+      std::printf("seed %d: %s\n", seed, e.what());
+      return 1;
+    }
+  }
+  std::printf("ok\n");
+  return 0;
+}
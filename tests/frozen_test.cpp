@@ -0,0 +1,270 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: frozen_test.cpp
+// DATE: Spring 2022
+// DESC: Test of the read-only maps: FrozenBTreeMap, LearnedIndex and
+//       PackedFrozenMap. Freezes BTreeMaps of many sizes (empty, one
+//       key, blocks exactly full at 16 and 64 keys and one past, and
+//       larger random ones) with key gaps chosen so the packed map
+//       stores its distances in 1, 2, 4 and 8 bytes, including keys at
+//       the ends of the key type's range. Every present key and the
+//       keys around it must be found (or not) as in the source map,
+//       and lower_bound, find_keys, sorted_keys, next_key and prev_key
+//       must agree with it.
+//
+// BUILD: g++ -std=c++17 -O1 -g -fsanitize=address,undefined -o frozen_test frozen_test.cpp
+//
+// USAGE: frozen_test [--seeds N]
+//        --seeds sets the number of random seeds (default 5). Prints
+//        "ok" and exits 0 if every check passes; otherwise prints the
+//        seed and the check that failed and exits 1.
+//---------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../frozenbtreemap.h"
+#include "../learnedindex.h"
+#include "../packedfrozenmap.h"
+
+namespace
+{
+
+struct Failure : std::runtime_error
+{
+  using std::runtime_error::runtime_error;
+};
+
+void check(bool ok, const char *what)
+{
+  if (!ok)
+    throw Failure(what);
+}
+
+using Key = long long;
+const Key lowest = std::numeric_limits<Key>::min();
+const Key highest = std::numeric_limits<Key>::max();
+
+// the rank of the first key >= key among the sorted keys
+int rank_of(const std::vector<Key> &sorted, Key key)
+{
+  return static_cast<int>(std::lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin());
+}
+
+// a frozen map's results for one key against the source
+template <typename M>
+void check_key(const M &frozen, const std::map<Key, int> &model, Key key, int rank)
+{
+  auto it = model.find(key);
+  const int *value = frozen.find(key);
+  check((value != nullptr) == (it != model.end()), "find differs");
+  check(value == nullptr or *value == it->second, "find returned the wrong value");
+  check(frozen.contains(key) == (it != model.end()), "contains differs");
+  check(frozen.lower_bound(key) == rank, "lower_bound differs");
+  bool threw = false;
+  try
+  {
+    check(frozen[key] == it->second, "operator[] returned the wrong value");
+  }
+  catch (std::out_of_range &)
+  {
+    threw = true;
+  }
+  check(threw == (it == model.end()), "operator[] threw for a present key or not for an absent one");
+}
+
+// FrozenBTreeMap and PackedFrozenMap also have the ordered queries
+template <typename M>
+void check_ordered(std::mt19937 &rng, const M &frozen, const BTreeMap<Key, int> &source,
+                   const std::map<Key, int> &model, const std::vector<Key> &probes)
+{
+  check(frozen.size() == source.size() and frozen.empty() == source.empty(), "size differs");
+  ArraySeq<Key> keys = frozen.sorted_keys(), expected = source.sorted_keys();
+  check(keys.size() == expected.size(), "sorted_keys size differs");
+  for (int i = 0; i < keys.size() and i < expected.size(); ++i)
+  {
+    check(keys.unchecked(i) == expected.unchecked(i), "sorted_keys differs");
+    check(frozen.key_at(i) == expected.unchecked(i), "key_at differs");
+    check(frozen.value_at(i) == model.at(expected.unchecked(i)), "value_at differs");
+  }
+  for (Key key : probes)
+  {
+    Key a = 0, b = 0;
+    bool fa = frozen.next_key(key, a), fb = source.next_key(key, b);
+    check(fa == fb and (!fa or a == b), "next_key differs");
+    fa = frozen.prev_key(key, a);
+    fb = source.prev_key(key, b);
+    check(fa == fb and (!fa or a == b), "prev_key differs");
+  }
+  // ranges between probes, in both orders, and over everything
+  for (int r = 0; r < 50; ++r)
+  {
+    Key k1 = probes[rng() % probes.size()], k2 = probes[rng() % probes.size()];
+    if (r == 0)
+      k1 = lowest, k2 = highest;
+    ArraySeq<Key> found = frozen.find_keys(k1, k2), want = source.find_keys(k1, k2);
+    check(found.size() == want.size(), "find_keys size differs");
+    for (int i = 0; i < found.size() and i < want.size(); ++i)
+      check(found.unchecked(i) == want.unchecked(i), "find_keys differs");
+  }
+}
+
+// n keys starting at start, each gap drawn from [min_gap, max_gap]
+std::map<Key, int> make_keys(std::mt19937_64 &rng, int n, Key start, Key min_gap, Key max_gap)
+{
+  std::map<Key, int> model;
+  Key key = start;
+  for (int i = 0; i < n; ++i)
+  {
+    model[key] = static_cast<int>(rng() % 1000000);
+    if (i + 1 < n)
+      key += min_gap + static_cast<Key>(rng() % static_cast<unsigned long long>(max_gap - min_gap + 1));
+  }
+  return model;
+}
+
+void test_map(std::mt19937_64 &rng, const std::map<Key, int> &model, int width)
+{
+  BTreeMap<Key, int> source;
+  for (const auto &p : model)
+    source.insert(p.first, p.second);
+  FrozenBTreeMap<Key, int> frozen = source.freeze();
+  PackedFrozenMap<Key, int> packed(source);
+  LearnedIndex<Key, int> learned(frozen, static_cast<int>(rng() % 3) * 16);
+
+  // every key, its neighbours and the ends of the key range
+  std::vector<Key> sorted, probes = {lowest, highest, 0, -1, 1};
+  for (const auto &p : model)
+  {
+    probes.push_back(p.first);
+    if (p.first != lowest)
+      probes.push_back(p.first - 1);
+    if (p.first != highest)
+      probes.push_back(p.first + 1);
+  }
+  for (int i = 0; i < 20; ++i)
+    probes.push_back(static_cast<Key>(rng()));
+  for (const auto &p : model)
+    sorted.push_back(p.first);
+  for (Key key : probes)
+  {
+    int rank = rank_of(sorted, key);
+    check_key(frozen, model, key, rank);
+    check_key(packed, model, key, rank);
+    check_key(learned, model, key, rank);
+  }
+  std::mt19937 small_rng(static_cast<unsigned>(rng()));
+  check_ordered(small_rng, frozen, source, model, probes);
+  check_ordered(small_rng, packed, source, model, probes);
+
+  // every block of packed packs its distances in width bytes
+  if (width > 0)
+  {
+    long long blocks = (static_cast<long long>(model.size()) + 63) / 64;
+    long long per_block = sizeof(Key) + 2 * sizeof(int) + 64LL * width;
+    check(packed.key_bytes() == blocks * per_block, "packed distances have the wrong width");
+  }
+}
+
+void run(unsigned seed)
+{
+  std::mt19937_64 rng(seed);
+  // the largest gap that keeps a block of 64 keys within each width;
+  // gaps of at least half of it (more than the next narrower width
+  // holds) make every block of two or more keys use exactly that width
+  const Key gaps[] = {255 / 63, 65535 / 63, 4294967295LL / 63, 1LL << 50};
+  const int widths[] = {1, 2, 4, 8};
+  for (int n : {0, 1, 2, 15, 16, 17, 63, 64, 65, 128, 1000})
+  {
+    for (int w = 0; w < 4; ++w)
+    {
+      Key max_gap = gaps[w], min_gap = w == 0 ? 1 : max_gap / 2 + 1;
+      // start low enough that n gaps cannot overflow
+      Key start = w == 3 ? lowest + static_cast<Key>(rng() % 1000) : -static_cast<Key>(n) * max_gap / 2;
+      std::map<Key, int> model = make_keys(rng, n, start, min_gap, max_gap);
+      // a block of one key has no distance wider than 1 byte
+      test_map(rng, model, w == 0 or n % 64 != 1 ? widths[w] : 0);
+    }
+  }
+  // the largest key of the type, and both ends at once
+  test_map(rng, {{highest, 1}}, 0);
+  test_map(rng, {{lowest, 1}, {highest, 2}}, 8);
+  std::map<Key, int> ends;
+  for (Key k = 0; k < 40; ++k)
+  {
+    ends[lowest + k] = 1;
+    ends[highest - k] = 2;
+  }
+  test_map(rng, ends, 0);
+
+  // a random mix of gaps
+  std::map<Key, int> mixed;
+  Key key = 0;
+  for (int i = 0; i < 5000; ++i)
+  {
+    key += 1 + static_cast<Key>(rng() % static_cast<unsigned long long>(gaps[rng() % 3]));
+    mixed[key] = i;
+  }
+  test_map(rng, mixed, 0);
+
+  // pairs out of order are refused
+  std::pair<Key, int> bad[] = {{1, 0}, {3, 0}, {2, 0}};
+  bool threw = false;
+  try
+  {
+    FrozenBTreeMap<Key, int> f(bad, 3);
+  }
+  catch (std::invalid_argument &)
+  {
+    threw = true;
+  }
+  check(threw, "FrozenBTreeMap accepted keys out of order");
+  threw = false;
+  try
+  {
+    PackedFrozenMap<Key, int> p(bad, 3);
+  }
+  catch (std::invalid_argument &)
+  {
+    threw = true;
+  }
+  check(threw, "PackedFrozenMap accepted keys out of order");
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  int seeds = 5;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (std::strcmp(argv[i], "--seeds") == 0)
+      seeds = std::stoi(argv[i + 1]);
+    else
+    {
+      std::fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  for (int seed = 0; seed < seeds; ++seed)
+  {
+    try
+    {
+      run(seed);
+    }
+    catch (std::exception &e)
+    {
+      std::printf("seed %d: %s\n", seed, e.what());
+      return 1;
+    }
+  }
+  std::printf("ok\n");
+  return 0;
+}
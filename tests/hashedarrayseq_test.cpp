@@ -0,0 +1,185 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: hashedarrayseq_test.cpp
+// DATE: Spring 2022
+// DESC: Randomized test of HashedArraySeq. Runs random push_back,
+//       insert, erase, set, writes through operator[], sort and
+//       insert_unique on a HashedArraySeq and a std::vector side by
+//       side and checks contains() against the contents of the
+//       vector after every step. A hash with few distinct values
+//       builds long probe chains, so erasing the last element and
+//       set() take the backward shift delete through every case.
+//
+// BUILD: g++ -std=c++17 -O1 -g -fsanitize=address,undefined -o hashedarrayseq_test hashedarrayseq_test.cpp
+//
+// USAGE: hashedarrayseq_test [--seeds N] [--steps N]
+//        --seeds sets the number of random seeds (default 10) and
+//        --steps the operations per seed (default 3000). Prints "ok"
+//        and exits 0 if every check passes; otherwise prints the seed
+//        and the check that failed and exits 1.
+//---------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../hashedarrayseq.h"
+
+namespace
+{
+
+struct Failure : std::runtime_error
+{
+  using std::runtime_error::runtime_error;
+};
+
+void check(bool ok, const char *what)
+{
+  if (!ok)
+    throw Failure(what);
+}
+
+// only a few distinct hash values, so elements share home slots
+struct ClusteredHash
+{
+  std::size_t operator()(int x) const { return static_cast<std::size_t>(x % 7); }
+};
+
+template <typename Seq>
+void compare(const Seq &seq, const std::vector<int> &model, int range)
+{
+  check(seq.size() == static_cast<int>(model.size()), "size differs");
+  for (int i = 0; i < seq.size(); ++i)
+    check(seq[i] == model[i], "element differs");
+  std::vector<char> present(range, 0);
+  for (int x : model)
+    present[x] = 1;
+  for (int x = -1; x <= range; ++x)
+  {
+    bool expected = x >= 0 and x < range and present[x];
+    check(seq.contains(x) == expected, "contains differs");
+  }
+}
+
+template <typename Hash>
+void run(unsigned seed, int steps)
+{
+  std::mt19937 rng(seed);
+  HashedArraySeq<int, Hash> seq;
+  std::vector<int> model;
+  const int range = 200;
+  for (int step = 0; step < steps; ++step)
+  {
+    int x = static_cast<int>(rng() % range);
+    int n = static_cast<int>(model.size());
+    switch (rng() % 9)
+    {
+    case 0:
+    case 1:
+      seq.push_back(x);
+      model.push_back(x);
+      break;
+    case 2:
+    {
+      int i = static_cast<int>(rng() % (n + 1));
+      seq.insert(x, i);
+      model.insert(model.begin() + i, x);
+      break;
+    }
+    case 3:
+      // the last element: the O(1) path through index_remove
+      if (n > 0)
+      {
+        seq.erase(n - 1);
+        model.pop_back();
+      }
+      break;
+    case 4:
+      if (n > 0)
+      {
+        int i = static_cast<int>(rng() % n);
+        seq.erase(i);
+        model.erase(model.begin() + i);
+      }
+      break;
+    case 5:
+      if (n > 0)
+      {
+        int i = static_cast<int>(rng() % n);
+        seq.set(i, x);
+        model[i] = x;
+      }
+      break;
+    case 6:
+      // write through the reference, then read through another one;
+      // contains must see both before any other call
+      if (n > 0)
+      {
+        int i = static_cast<int>(rng() % n);
+        seq[i] = x;
+        model[i] = x;
+        int j = static_cast<int>(rng() % n);
+        check(seq[j] == model[j], "read through operator[] differs");
+      }
+      break;
+    case 7:
+      check(seq.insert_unique(x) ==
+                (std::find(model.begin(), model.end(), x) == model.end()),
+            "insert_unique result differs");
+      if (std::find(model.begin(), model.end(), x) == model.end())
+        model.push_back(x);
+      break;
+    default:
+      if (rng() % 20 == 0)
+      {
+        seq.sort();
+        std::sort(model.begin(), model.end());
+      }
+      break;
+    }
+    compare(seq, model, range);
+  }
+  seq.clear();
+  model.clear();
+  compare(seq, model, range);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  int seeds = 10, steps = 3000;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (std::strcmp(argv[i], "--seeds") == 0)
+      seeds = std::stoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--steps") == 0)
+      steps = std::stoi(argv[i + 1]);
+    else
+    {
+      std::fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  for (int seed = 0; seed < seeds; ++seed)
+  {
+    try
+    {
+      if (seed % 2)
+        run<ClusteredHash>(seed, steps);
+      else
+        run<std::hash<int>>(seed, steps);
+    }
+    catch (std::exception &e)
+    {
+      std::printf("seed %d: %s\n", seed, e.what());
+      return 1;
+    }
+  }
+  std::printf("ok\n");
+  return 0;
+}
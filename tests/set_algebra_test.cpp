@@ -0,0 +1,222 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: set_algebra_test.cpp
+// DATE: Spring 2022
+// DESC: Randomized test of BTreeMap's unite, intersect and subtract,
+//       and of assign_sorted. Builds random pairs of maps, runs each
+//       operation on a BTreeMap and on std::maps side by side, and
+//       calls validate() after every step. Right-hand maps far smaller
+//       than the left take the point lookup path; maps of similar size
+//       take the merge path. unite also runs with a combine callback
+//       that adds the values, and with a map united with itself.
+//       assign_sorted must build the given pairs and reject (without
+//       changing the map) pairs out of order or with duplicate keys.
+//
+// BUILD: g++ -std=c++17 -O1 -g -fsanitize=address,undefined -o set_algebra_test set_algebra_test.cpp
+//
+// USAGE: set_algebra_test [--seeds N] [--rounds N]
+//        --seeds sets the number of random seeds (default 10) and
+//        --rounds the map pairs tried per seed (default 60). Prints
+//        "ok" and exits 0 if every check passes; otherwise prints the
+//        seed and the check that failed and exits 1.
+//---------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../btreemap.h"
+
+namespace
+{
+
+struct Failure : std::runtime_error
+{
+  using std::runtime_error::runtime_error;
+};
+
+void check(bool ok, const char *what)
+{
+  if (!ok)
+    throw Failure(what);
+}
+
+// map holds exactly the pairs of model
+void compare(const BTreeMap<int, int> &map, const std::map<int, int> &model)
+{
+  map.validate();
+  check(map.size() == static_cast<int>(model.size()), "size differs");
+  ArraySeq<std::pair<int, int>> pairs = map.sorted_pairs();
+  check(pairs.size() == static_cast<int>(model.size()), "sorted_pairs size differs");
+  int i = 0;
+  for (const auto &p : model)
+  {
+    check(pairs.unchecked(i).first == p.first and pairs.unchecked(i).second == p.second,
+          "pair differs");
+    ++i;
+  }
+}
+
+// n random pairs with keys in [0, range), in both kinds of map
+void fill(std::mt19937 &rng, int n, int range, BTreeMap<int, int> &map,
+          std::map<int, int> &model)
+{
+  for (int i = 0; i < n; ++i)
+  {
+    int key = static_cast<int>(rng() % range);
+    int value = static_cast<int>(rng() % 1000);
+    map.insert_or_assign(key, value);
+    model[key] = value;
+  }
+}
+
+void run_round(std::mt19937 &rng)
+{
+  int range = 1 + static_cast<int>(rng() % 5000);
+  int left = static_cast<int>(rng() % 3000);
+  // a tiny right side for the point path, or one like the left
+  int right = rng() % 2 ? static_cast<int>(rng() % 20) : static_cast<int>(rng() % 3000);
+  BTreeMap<int, int> a, b;
+  std::map<int, int> ma, mb;
+  fill(rng, left, range, a, ma);
+  fill(rng, right, range, b, mb);
+
+  switch (rng() % 5)
+  {
+  case 0:
+    // keys of b not in a are added; a's values win
+    a.unite(b);
+    for (const auto &p : mb)
+      ma.insert(p);
+    break;
+  case 1:
+    // values of keys in both maps are added together
+    a.unite(b, [](int &mine, const int &theirs) { mine += theirs; });
+    for (const auto &p : mb)
+    {
+      auto it = ma.find(p.first);
+      if (it == ma.end())
+        ma.insert(p);
+      else
+        it->second += p.second;
+    }
+    break;
+  case 2:
+    a.intersect(b);
+    for (auto it = ma.begin(); it != ma.end();)
+      it = mb.count(it->first) ? std::next(it) : ma.erase(it);
+    break;
+  case 3:
+    a.subtract(b);
+    for (const auto &p : mb)
+      ma.erase(p.first);
+    break;
+  default:
+    // with itself: unite doubles every value, intersect keeps all and
+    // subtract empties the map
+    a.unite(a, [](int &mine, const int &theirs) { mine += theirs; });
+    for (auto &p : ma)
+      p.second *= 2;
+    compare(a, ma);
+    a.intersect(a);
+    compare(a, ma);
+    a.subtract(a);
+    ma.clear();
+    break;
+  }
+  compare(a, ma);
+  compare(b, mb);
+
+  // the result must still take ordinary updates
+  int key = static_cast<int>(rng() % range);
+  a.insert_or_assign(key, -1);
+  ma[key] = -1;
+  if (a.try_erase(key + 1))
+    ma.erase(key + 1);
+  compare(a, ma);
+}
+
+void test_assign_sorted(std::mt19937 &rng)
+{
+  for (int n : {0, 1, 2, 3, 4, 255, 256, 1000})
+  {
+    std::vector<std::pair<int, int>> pairs;
+    std::map<int, int> model;
+    int key = -50;
+    for (int i = 0; i < n; ++i)
+    {
+      key += 1 + static_cast<int>(rng() % 3);
+      pairs.push_back({key, i});
+      model[key] = i;
+    }
+    BTreeMap<int, int> map;
+    map.insert(-1000, 0);
+    map.assign_sorted(pairs.data(), n);
+    compare(map, model);
+
+    if (n < 2)
+      continue;
+    // out of order, then a duplicate key: both throw and leave the
+    // map as it was
+    for (int bad = 0; bad < 2; ++bad)
+    {
+      std::vector<std::pair<int, int>> wrong = pairs;
+      int i = 1 + static_cast<int>(rng() % (n - 1));
+      if (bad == 0)
+        std::swap(wrong[i - 1], wrong[i]);
+      else
+        wrong[i].first = wrong[i - 1].first;
+      bool threw = false;
+      try
+      {
+        map.assign_sorted(wrong.data(), n);
+      }
+      catch (std::invalid_argument &)
+      {
+        threw = true;
+      }
+      check(threw, "assign_sorted accepted pairs out of order");
+      compare(map, model);
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  int seeds = 10, rounds = 60;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (std::strcmp(argv[i], "--seeds") == 0)
+      seeds = std::stoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--rounds") == 0)
+      rounds = std::stoi(argv[i + 1]);
+    else
+    {
+      std::fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  for (int seed = 0; seed < seeds; ++seed)
+  {
+    try
+    {
+      std::mt19937 rng(seed);
+      test_assign_sorted(rng);
+      for (int round = 0; round < rounds; ++round)
+        run_round(rng);
+    }
+    catch (std::exception &e)
+    {
+      std::printf("seed %d: %s\n", seed, e.what());
+      return 1;
+    }
+  }
+  std::printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,310 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: set_multimap_test.cpp
+// DATE: Spring 2022
+// DESC: Randomized test of BTreeSet against std::set and BTreeMultiMap
+//       against std::multimap. The set runs inserts, erases, single and
+//       batched lookups, set algebra, split_at and join, and clears;
+//       the multimap runs inserts of repeated keys, erase(key) (which
+//       removes every pair of the key and returns how many there were),
+//       and clears. After every few steps size(), contains, count,
+//       find_keys, sorted_keys, next_key and prev_key must agree with
+//       the std container, and the values of each key must come back in
+//       insertion order (std::multimap keeps equal keys in that order
+//       too), including keys inserted again after an erase or clear.
+//
+// BUILD: g++ -std=c++17 -O1 -g -fsanitize=address,undefined -o set_multimap_test set_multimap_test.cpp
+//
+// USAGE: set_multimap_test [--seeds N] [--steps N]
+//        --seeds sets the number of random seeds (default 10) and
+//        --steps the operations per seed (default 5000). Prints "ok"
+//        and exits 0 if every check passes; otherwise prints the seed
+//        and the check that failed and exits 1.
+//---------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "../btreemultimap.h"
+#include "../btreeset.h"
+
+namespace
+{
+
+struct Failure : std::runtime_error
+{
+  using std::runtime_error::runtime_error;
+};
+
+void check(bool ok, const char *what)
+{
+  if (!ok)
+    throw Failure(what);
+}
+
+const int range = 500;
+
+// seq holds exactly the keys from first to last, in order
+template <typename It>
+void check_keys(const ArraySeq<int> &seq, It first, It last, const char *what)
+{
+  check(seq.size() == static_cast<int>(std::distance(first, last)), what);
+  for (int i = 0; first != last; ++i, ++first)
+    check(seq.unchecked(i) == *first, what);
+}
+
+void compare_set(const BTreeSet<int> &set, const std::set<int> &model, std::mt19937 &rng)
+{
+  set.validate();
+  check(set.size() == static_cast<int>(model.size()), "set size differs");
+  check(set.empty() == model.empty(), "set empty differs");
+  check_keys(set.sorted_keys(), model.begin(), model.end(), "set sorted_keys differs");
+  for (int key = -1; key <= range; ++key)
+  {
+    check(set.contains(key) == (model.count(key) != 0), "set contains differs");
+    int next = 0;
+    auto it = model.upper_bound(key);
+    check(set.next_key(key, next) == (it != model.end()) and (it == model.end() or next == *it),
+          "set next_key differs");
+    it = model.lower_bound(key);
+    check(set.prev_key(key, next) == (it != model.begin()) and
+              (it == model.begin() or next == *std::prev(it)),
+          "set prev_key differs");
+  }
+  for (int r = 0; r < 10; ++r)
+  {
+    int k1 = static_cast<int>(rng() % range) - 1, k2 = static_cast<int>(rng() % range);
+    auto last = k2 < k1 ? model.lower_bound(k1) : model.upper_bound(k2);
+    check_keys(set.find_keys(k1, k2), model.lower_bound(k1), last, "set find_keys differs");
+  }
+}
+
+void run_set(unsigned seed, int steps)
+{
+  std::mt19937 rng(seed);
+  BTreeSet<int> set;
+  std::set<int> model;
+  if (rng() % 2)
+    set.enable_filter();
+  for (int step = 0; step < steps; ++step)
+  {
+    int key = static_cast<int>(rng() % range);
+    switch (rng() % 12)
+    {
+    case 0:
+    case 1:
+    case 2:
+    case 3:
+      check(set.insert(key) == model.insert(key).second, "set insert result differs");
+      break;
+    case 4:
+    case 5:
+      check(set.erase(key) == (model.erase(key) != 0), "set erase result differs");
+      break;
+    case 6:
+    {
+      int keys[8];
+      bool found[8];
+      for (int &k : keys)
+        k = static_cast<int>(rng() % range);
+      set.contains(keys, 8, found);
+      for (int j = 0; j < 8; ++j)
+        check(found[j] == (model.count(keys[j]) != 0), "set batched contains differs");
+      break;
+    }
+    case 7:
+    {
+      // set algebra with a random set
+      BTreeSet<int> other;
+      std::set<int> model_other;
+      for (int i = static_cast<int>(rng() % 100); i > 0; --i)
+      {
+        int k = static_cast<int>(rng() % range);
+        other.insert(k);
+        model_other.insert(k);
+      }
+      std::set<int> result;
+      switch (rng() % 3)
+      {
+      case 0:
+        set.unite(other);
+        result = model;
+        result.insert(model_other.begin(), model_other.end());
+        break;
+      case 1:
+        set.intersect(other);
+        for (int k : model)
+          if (model_other.count(k))
+            result.insert(k);
+        break;
+      default:
+        set.subtract(other);
+        for (int k : model)
+          if (!model_other.count(k))
+            result.insert(k);
+        break;
+      }
+      model = result;
+      break;
+    }
+    case 8:
+    {
+      BTreeSet<int> upper = set.split_at(key);
+      std::set<int> model_upper(model.lower_bound(key), model.end());
+      model.erase(model.lower_bound(key), model.end());
+      compare_set(set, model, rng);
+      compare_set(upper, model_upper, rng);
+      set.join(upper);
+      model.insert(model_upper.begin(), model_upper.end());
+      check(upper.empty(), "join left keys in the other set");
+      break;
+    }
+    case 9:
+      if (rng() % 20 == 0)
+      {
+        set.clear();
+        model.clear();
+      }
+      break;
+    default:
+      check(set.contains(key) == (model.count(key) != 0), "set contains differs");
+      break;
+    }
+    if (step % 100 == 0)
+      compare_set(set, model, rng);
+  }
+  compare_set(set, model, rng);
+}
+
+using Model = std::multimap<int, int>;
+
+void compare_multimap(const BTreeMultiMap<int, int> &multi, const Model &model, std::mt19937 &rng)
+{
+  multi.validate();
+  check(multi.size() == static_cast<int>(model.size()), "multimap size differs");
+  check(multi.empty() == model.empty(), "multimap empty differs");
+  ArraySeq<int> keys = multi.sorted_keys();
+  check(keys.size() == static_cast<int>(model.size()), "multimap sorted_keys size differs");
+  int i = 0;
+  for (const auto &p : model)
+    check(keys.unchecked(i++) == p.first, "multimap sorted_keys differs");
+  for (int key = -1; key <= range; ++key)
+  {
+    auto equal = model.equal_range(key);
+    int n = static_cast<int>(std::distance(equal.first, equal.second));
+    check(multi.count(key) == n, "multimap count differs");
+    check(multi.contains(key) == (n != 0), "multimap contains differs");
+    // the values of one key in the order they were inserted
+    ArraySeq<int> values = multi.values(key);
+    check(values.size() == n, "multimap values size differs");
+    int j = 0;
+    for (auto it = equal.first; it != equal.second; ++it)
+      check(values.unchecked(j++) == it->second, "multimap values out of insertion order");
+    // next_key and prev_key skip the other pairs of key
+    int next = 0;
+    auto it = model.upper_bound(key);
+    check(multi.next_key(key, next) == (it != model.end()) and (it == model.end() or next == it->first),
+          "multimap next_key differs");
+    it = model.lower_bound(key);
+    check(multi.prev_key(key, next) == (it != model.begin()) and
+              (it == model.begin() or next == std::prev(it)->first),
+          "multimap prev_key differs");
+  }
+  for (int r = 0; r < 10; ++r)
+  {
+    int k1 = static_cast<int>(rng() % range) - 1, k2 = static_cast<int>(rng() % range);
+    ArraySeq<int> found = multi.find_keys(k1, k2);
+    auto first = model.lower_bound(k1), last = k2 < k1 ? first : model.upper_bound(k2);
+    check(found.size() == static_cast<int>(std::distance(first, last)), "multimap find_keys size differs");
+    for (int j = 0; first != last; ++j, ++first)
+      check(found.unchecked(j) == first->first, "multimap find_keys differs");
+  }
+}
+
+void run_multimap(unsigned seed, int steps)
+{
+  std::mt19937 rng(seed);
+  BTreeMultiMap<int, int> multi;
+  Model model;
+  for (int step = 0; step < steps; ++step)
+  {
+    // few distinct keys, so most of them repeat
+    int key = static_cast<int>(rng() % (rng() % 2 ? 20 : range));
+    int value = static_cast<int>(rng() % 1000000);
+    switch (rng() % 10)
+    {
+    case 0:
+    case 1:
+    case 2:
+    case 3:
+    case 4:
+    case 5:
+      multi.insert(key, value);
+      model.insert({key, value});
+      break;
+    case 6:
+    case 7:
+    {
+      // every pair of the key goes, and the count comes back
+      int n = static_cast<int>(model.erase(key));
+      check(multi.erase(key) == n, "multimap erase count differs");
+      check(!multi.contains(key) and multi.count(key) == 0, "multimap erase left pairs behind");
+      check(multi.erase(key) == 0, "second erase found pairs");
+      break;
+    }
+    case 8:
+      if (rng() % 20 == 0)
+      {
+        multi.clear();
+        model.clear();
+      }
+      break;
+    default:
+      check(multi.count(key) == static_cast<int>(model.count(key)), "multimap count differs");
+      break;
+    }
+    if (step % 100 == 0)
+      compare_multimap(multi, model, rng);
+  }
+  compare_multimap(multi, model, rng);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  int seeds = 10, steps = 5000;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (std::strcmp(argv[i], "--seeds") == 0)
+      seeds = std::stoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--steps") == 0)
+      steps = std::stoi(argv[i + 1]);
+    else
+    {
+      std::fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  for (int seed = 0; seed < seeds; ++seed)
+  {
+    try
+    {
+      run_set(seed, steps);
+      run_multimap(seed, steps);
+    }
+    catch (std::exception &e)
+    {
+      std::printf("seed %d: %s\n", seed, e.what());
+      return 1;
+    }
+  }
+  std::printf("ok\n");
+  return 0;
+}
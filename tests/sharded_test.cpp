@@ -0,0 +1,302 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: sharded_test.cpp
+// DATE: Spring 2022
+// DESC: Multi-threaded test of ShardedBTreeMap, the work-stealing
+//       ThreadPool and BTreeMap's parallel assign, clear, sorted_keys
+//       and find_keys. Writer threads own disjoint key sets of a
+//       sharded map (with a low skew limit, so rebalances run while
+//       they write) and readers check that ranges stay ordered; at the
+//       end the map must match the writers' models. The pool runs
+//       nested task groups, a pool without workers and a throwing
+//       task. The parallel map paths run on a tree tall enough to
+//       hand subtrees to the workers and must match the sequential
+//       versions. Build it with ThreadSanitizer to check for races.
+//
+// BUILD: g++ -std=c++17 -O1 -g -fsanitize=address,undefined -pthread -o sharded_test sharded_test.cpp
+//
+// USAGE: sharded_test [--threads N] [--steps N]
+//        --threads sets the number of writer threads and pool workers
+//        (default 3) and --steps the operations per writer (default
+//        20000). Prints "ok" and exits 0 if every check passes;
+//        otherwise prints the first failed check and exits 1.
+//---------------------------------------------------------------------------
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../shardedbtreemap.h"
+
+namespace
+{
+
+// first failed check, reported once all threads have stopped
+std::atomic<bool> failed{false};
+std::mutex failure_mutex;
+std::string failure;
+
+void check(bool ok, const char *what)
+{
+  if (!ok and !failed.exchange(true))
+  {
+    std::lock_guard<std::mutex> lock(failure_mutex);
+    failure = what;
+  }
+}
+
+const int key_range = 50000;
+
+// writer t owns the keys k with k % writers == t, so its model is
+// exact however the threads interleave
+void writer(ShardedBTreeMap<int, int> &map, std::map<int, int> &model, int t, int writers,
+            int steps)
+{
+  std::mt19937 rng(t + 1);
+  for (int step = 0; step < steps and !failed.load(std::memory_order_relaxed); ++step)
+  {
+    int key = static_cast<int>(rng() % (key_range / writers)) * writers + t;
+    bool present = model.count(key) != 0;
+    switch (rng() % 4)
+    {
+    case 0:
+    case 1:
+      map.insert(key, step);
+      model[key] = step;
+      break;
+    case 2:
+      if (present)
+      {
+        map.erase(key);
+        model.erase(key);
+      }
+      break;
+    default:
+    {
+      int value = -1;
+      bool found = map.find(key, value);
+      check(found == present, "find differs from the writer's model");
+      check(!found or value == model[key], "find returned a stale value");
+      break;
+    }
+    }
+  }
+}
+
+void reader(const ShardedBTreeMap<int, int> &map, const std::atomic<bool> &done, unsigned seed)
+{
+  std::mt19937 rng(seed);
+  while (!done.load(std::memory_order_relaxed) and !failed.load(std::memory_order_relaxed))
+  {
+    int lo = static_cast<int>(rng() % key_range);
+    int hi = lo + static_cast<int>(rng() % 500);
+    ArraySeq<int> keys = map.find_keys(lo, hi);
+    for (int i = 0; i < keys.size(); ++i)
+    {
+      check(lo <= keys.unchecked(i) and keys.unchecked(i) <= hi,
+            "find_keys returned a key out of range");
+      check(i == 0 or keys.unchecked(i - 1) < keys.unchecked(i),
+            "find_keys keys not ascending");
+    }
+    int next = 0;
+    if (map.next_key(lo, next))
+      check(lo < next, "next_key not after the key");
+    if (map.prev_key(lo, next))
+      check(next < lo, "prev_key not before the key");
+  }
+}
+
+void test_sharded(int writers, int steps)
+{
+  ShardedBTreeMap<int, int> map(8);
+  map.set_skew_limit(1.5, 256);
+  std::vector<std::map<int, int>> models(writers);
+  std::atomic<bool> done{false};
+  std::vector<std::thread> threads;
+  std::thread read(reader, std::cref(map), std::cref(done), 99);
+  for (int t = 0; t < writers; ++t)
+    threads.emplace_back(writer, std::ref(map), std::ref(models[t]), t, writers, steps);
+  for (std::thread &thread : threads)
+    thread.join();
+  done = true;
+  read.join();
+
+  std::map<int, int> model;
+  for (const auto &m : models)
+    model.insert(m.begin(), m.end());
+  ArraySeq<int> keys = map.sorted_keys();
+  check(map.size() == static_cast<int>(model.size()), "sharded size differs");
+  check(keys.size() == static_cast<int>(model.size()), "sharded sorted_keys size differs");
+  int i = 0, total = 0;
+  for (const auto &p : model)
+  {
+    if (i >= keys.size())
+      break;
+    check(keys.unchecked(i++) == p.first, "sharded keys differ");
+    check(map[p.first] == p.second, "sharded value differs");
+  }
+  for (int s = 0; s < map.shard_count(); ++s)
+    total += map.shard_size(s);
+  check(total == map.size(), "shard sizes do not add up");
+  check(map.shard_size(0) < map.size(), "keys never left shard 0");
+
+  // split keys given up front: every shard is used from the start
+  ArraySeq<int> split_keys;
+  for (int k = 1000; k < 4000; k += 1000)
+    split_keys.push_back(k);
+  ShardedBTreeMap<int, int> seeded(split_keys);
+  for (int k = 0; k < 4000; k += 7)
+    seeded.insert(k, k);
+  for (int s = 0; s < seeded.shard_count(); ++s)
+    check(seeded.shard_size(s) > 0, "seeded shard left empty");
+  seeded.clear();
+  check(seeded.empty() and seeded.sorted_keys().empty(), "cleared sharded map not empty");
+}
+
+// sums 1..n by splitting the range into tasks that wait on their own
+// nested groups
+long long nested_sum(ThreadPool &pool, long long lo, long long hi)
+{
+  if (hi - lo < 64)
+  {
+    long long sum = 0;
+    for (long long i = lo; i <= hi; ++i)
+      sum += i;
+    return sum;
+  }
+  long long mid = (lo + hi) / 2, left = 0, right = 0;
+  TaskGroup tasks(pool);
+  tasks.run([&] { left = nested_sum(pool, lo, mid); });
+  tasks.run([&] { right = nested_sum(pool, mid + 1, hi); });
+  tasks.wait();
+  return left + right;
+}
+
+void test_pool(int threads)
+{
+  for (int workers : {threads, 0})
+  {
+    ThreadPool pool(workers);
+    check(pool.size() == workers, "pool size differs");
+    const long long n = 100000;
+    check(nested_sum(pool, 1, n) == n * (n + 1) / 2, "nested task sum differs");
+
+    // a task that throws: wait() rethrows it once the group is done
+    std::atomic<int> ran{0};
+    TaskGroup tasks(pool);
+    for (int i = 0; i < 50; ++i)
+      tasks.run([&ran, i] {
+        ran++;
+        if (i == 25)
+          throw std::runtime_error("task failed");
+      });
+    bool threw = false;
+    try
+    {
+      tasks.wait();
+    }
+    catch (std::runtime_error &)
+    {
+      threw = true;
+    }
+    check(threw, "task exception not rethrown by wait");
+    check(ran == 50, "not every task ran");
+  }
+}
+
+void test_parallel_paths(int threads)
+{
+  ThreadPool pool(threads);
+  BTreeMap<int, int> map;
+  std::mt19937 rng(7);
+  for (int i = 0; i < 200000; ++i)
+  {
+    int key = static_cast<int>(rng() % 1000000);
+    map.insert_or_assign(key, i);
+  }
+  check(map.height() > 9, "tree too short to reach the parallel paths");
+
+  BTreeMap<int, int> copy;
+  copy.insert(-1, -1);
+  copy.assign(map, pool);
+  copy.validate();
+  ArraySeq<std::pair<int, int>> expected = map.sorted_pairs(), actual = copy.sorted_pairs();
+  check(actual.size() == expected.size() and copy.size() == map.size(),
+        "parallel assign size differs");
+  for (int i = 0; i < expected.size() and i < actual.size(); ++i)
+    check(actual.unchecked(i).first == expected.unchecked(i).first and
+              actual.unchecked(i).second == expected.unchecked(i).second,
+          "parallel assign pair differs");
+
+  ArraySeq<int> keys = map.sorted_keys(), parallel_keys = map.sorted_keys(pool);
+  check(keys.size() == parallel_keys.size(), "parallel sorted_keys size differs");
+  for (int i = 0; i < keys.size() and i < parallel_keys.size(); ++i)
+    check(keys.unchecked(i) == parallel_keys.unchecked(i), "parallel sorted_keys differs");
+
+  for (int r = 0; r < 20; ++r)
+  {
+    int lo = static_cast<int>(rng() % 1000000);
+    int hi = lo + static_cast<int>(rng() % 400000);
+    ArraySeq<int> in_range = map.find_keys(lo, hi), parallel = map.find_keys(lo, hi, pool);
+    check(in_range.size() == parallel.size(), "parallel find_keys size differs");
+    for (int i = 0; i < in_range.size() and i < parallel.size(); ++i)
+      check(in_range.unchecked(i) == parallel.unchecked(i), "parallel find_keys differs");
+    std::atomic<long long> visited{0}, key_sum{0};
+    map.find_keys(lo, hi, pool, [&](const int &k) {
+      visited++;
+      key_sum += k;
+    });
+    long long sum = 0;
+    for (int i = 0; i < in_range.size(); ++i)
+      sum += in_range.unchecked(i);
+    check(visited == in_range.size() and key_sum == sum, "parallel find_keys callback differs");
+  }
+
+  copy.clear(pool);
+  copy.validate();
+  check(copy.empty() and copy.sorted_keys().empty(), "parallel clear left keys");
+  copy.insert(1, 1);
+  check(copy.size() == 1 and copy.contains(1), "map unusable after parallel clear");
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  int threads = 3, steps = 20000;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (std::strcmp(argv[i], "--threads") == 0)
+      threads = std::stoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--steps") == 0)
+      steps = std::stoi(argv[i + 1]);
+    else
+    {
+      std::fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  try
+  {
+    test_pool(threads);
+    test_sharded(threads, steps);
+    test_parallel_paths(threads);
+  }
+  catch (std::exception &e)
+  {
+    check(false, e.what());
+  }
+  if (failed)
+  {
+    std::printf("failed: %s\n", failure.c_str());
+    return 1;
+  }
+  std::printf("ok\n");
+  return 0;
+}
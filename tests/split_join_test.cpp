@@ -0,0 +1,275 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: split_join_test.cpp
+// DATE: Spring 2022
+// DESC: Randomized test of BTreeMap::split_at and join. Splits maps at
+//       random keys (below the smallest key, at the smallest and the
+//       largest, past the largest and in between), joins the pieces
+//       back in either direction, and joins maps of very different
+//       heights, some with a Bloom filter or a lookup cache turned on.
+//       Runs the same moves on std::maps and, after every step, calls
+//       validate() and checks that both maps hold the same pairs and
+//       report the same size(). Joining maps whose key ranges overlap
+//       must throw invalid_argument and leave both maps unchanged.
+//
+// BUILD: g++ -std=c++17 -O1 -g -fsanitize=address,undefined -o split_join_test split_join_test.cpp
+//
+// USAGE: split_join_test [--seeds N] [--steps N]
+//        --seeds sets the number of random seeds (default 10) and
+//        --steps the splits and joins per seed (default 100). Prints
+//        "ok" and exits 0 if every check passes; otherwise prints the
+//        seed and the check that failed and exits 1.
+//---------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "../btreemap.h"
+
+namespace
+{
+
+struct Failure : std::runtime_error
+{
+  using std::runtime_error::runtime_error;
+};
+
+void check(bool ok, const char *what)
+{
+  if (!ok)
+    throw Failure(what);
+}
+
+// map holds exactly the pairs of model, and finds each of them
+void compare(const BTreeMap<int, int> &map, const std::map<int, int> &model)
+{
+  map.validate();
+  check(map.size() == static_cast<int>(model.size()), "size differs");
+  check(map.empty() == model.empty(), "empty differs");
+  ArraySeq<std::pair<int, int>> pairs = map.sorted_pairs();
+  check(pairs.size() == static_cast<int>(model.size()), "sorted_pairs size differs");
+  int i = 0;
+  for (const auto &p : model)
+  {
+    check(pairs.unchecked(i).first == p.first and pairs.unchecked(i).second == p.second,
+          "pair differs");
+    const int *value = map.find(p.first);
+    check(value != nullptr and *value == p.second, "find differs");
+    ++i;
+  }
+  // a few keys around and between the present ones
+  for (int key : {-1, 0, 1})
+    check(map.contains(key) == (model.count(key) != 0), "contains differs");
+  if (!model.empty())
+  {
+    check(!map.contains(model.begin()->first - 1), "contains found a key below the smallest");
+    check(!map.contains(model.rbegin()->first + 1), "contains found a key above the largest");
+  }
+}
+
+// n random pairs with keys in [lo, lo + range)
+void fill(std::mt19937 &rng, int n, int lo, int range, BTreeMap<int, int> &map,
+          std::map<int, int> &model)
+{
+  for (int i = 0; i < n; ++i)
+  {
+    int key = lo + static_cast<int>(rng() % range);
+    int value = static_cast<int>(rng() % 1000);
+    map.insert_or_assign(key, value);
+    model[key] = value;
+  }
+}
+
+// a fresh map, sometimes with a filter or cache
+void configure(std::mt19937 &rng, BTreeMap<int, int> &map)
+{
+  switch (rng() % 4)
+  {
+  case 0:
+    map.enable_filter();
+    break;
+  case 1:
+    map.enable_cache(64);
+    break;
+  default:
+    break;
+  }
+}
+
+// the key to split at: below, at or past the ends, or inside
+int split_key(std::mt19937 &rng, const std::map<int, int> &model)
+{
+  if (model.empty())
+    return static_cast<int>(rng() % 100);
+  int lo = model.begin()->first, hi = model.rbegin()->first;
+  switch (rng() % 6)
+  {
+  case 0:
+    return lo - 1;
+  case 1:
+    return lo;
+  case 2:
+    return hi;
+  case 3:
+    return hi + 1;
+  default:
+    return lo + static_cast<int>(rng() % (hi - lo + 1));
+  }
+}
+
+// splits map at a random key, checks both halves and joins them back
+void split_and_rejoin(std::mt19937 &rng, BTreeMap<int, int> &map, std::map<int, int> &model)
+{
+  int key = split_key(rng, model);
+  BTreeMap<int, int> upper = map.split_at(key);
+  std::map<int, int> model_upper(model.lower_bound(key), model.end());
+  model.erase(model.lower_bound(key), model.end());
+  compare(map, model);
+  compare(upper, model_upper);
+
+  // both halves still take updates
+  if (rng() % 2 and !model_upper.empty())
+  {
+    int k = model_upper.rbegin()->first + 1;
+    upper.insert(k, k);
+    model_upper[k] = k;
+  }
+  if (rng() % 2 and !model.empty())
+  {
+    int k = model.begin()->first;
+    map.erase(k);
+    model.erase(k);
+  }
+  compare(map, model);
+  compare(upper, model_upper);
+
+  // join back into either side
+  if (rng() % 2)
+  {
+    map.join(upper);
+  }
+  else
+  {
+    upper.join(map);
+    map = std::move(upper);
+    compare(upper, {});
+  }
+  model.insert(model_upper.begin(), model_upper.end());
+  compare(map, model);
+}
+
+// joins a second map of random size above or below map, then checks
+// that a join with overlapping keys is refused
+void join_other(std::mt19937 &rng, BTreeMap<int, int> &map, std::map<int, int> &model)
+{
+  BTreeMap<int, int> other;
+  std::map<int, int> model_other;
+  configure(rng, other);
+  // from empty to much larger than map, so the heights differ
+  int n = rng() % 4 == 0 ? 0 : static_cast<int>(rng() % 2000);
+  bool above = rng() % 2;
+  int lo = model.empty() ? 0 : model.begin()->first, hi = model.empty() ? 0 : model.rbegin()->first;
+  if (above)
+    fill(rng, n, hi + 1, 1 + n * 2, other, model_other);
+  else
+    fill(rng, n, lo - 1 - n * 2, 1 + n * 2, other, model_other);
+  compare(other, model_other);
+
+  if (!model.empty() and !model_other.empty())
+  {
+    // a key inside map's range makes the ranges overlap
+    BTreeMap<int, int> overlap = other;
+    std::map<int, int> model_overlap = model_other;
+    overlap.insert_or_assign(lo, 7);
+    model_overlap[lo] = 7;
+    bool threw = false;
+    try
+    {
+      map.join(overlap);
+    }
+    catch (std::invalid_argument &)
+    {
+      threw = true;
+    }
+    check(threw, "join accepted overlapping keys");
+    compare(map, model);
+    compare(overlap, model_overlap);
+  }
+
+  if (rng() % 2)
+  {
+    map.join(other);
+  }
+  else
+  {
+    other.join(map);
+    compare(map, {});
+    map = std::move(other);
+  }
+  model.insert(model_other.begin(), model_other.end());
+  compare(map, model);
+}
+
+void run(unsigned seed, int steps)
+{
+  std::mt19937 rng(seed);
+  BTreeMap<int, int> map;
+  std::map<int, int> model;
+  configure(rng, map);
+  for (int step = 0; step < steps; ++step)
+  {
+    if (rng() % 3 == 0)
+      join_other(rng, map, model);
+    else
+      split_and_rejoin(rng, map, model);
+    // drop the top of the map now and then (and whenever it grows
+    // large) so small and empty maps keep coming up
+    if (rng() % 8 == 0 or model.size() > 3000)
+    {
+      int key = split_key(rng, model);
+      BTreeMap<int, int> upper = map.split_at(key);
+      check(upper.size() == static_cast<int>(std::distance(model.lower_bound(key), model.end())),
+            "split_at moved the wrong number of keys");
+      model.erase(model.lower_bound(key), model.end());
+      compare(map, model);
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  int seeds = 10, steps = 100;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (std::strcmp(argv[i], "--seeds") == 0)
+      seeds = std::stoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--steps") == 0)
+      steps = std::stoi(argv[i + 1]);
+    else
+    {
+      std::fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  for (int seed = 0; seed < seeds; ++seed)
+  {
+    try
+    {
+      run(seed, steps);
+    }
+    catch (std::exception &e)
+    {
+      std::printf("seed %d: %s\n", seed, e.what());
+      return 1;
+    }
+  }
+  std::printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,301 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: threadpool.h
+// DATE: Spring 2022
+// DESC: Work-stealing thread pool. Each worker keeps its own deque of
+//       tasks, running the newest task it pushed first and stealing
+//       the oldest task of another worker when it runs out. TaskGroup
+//       tracks a batch of tasks (which may spawn more tasks into the
+//       same group); waiting on a group runs pending tasks instead of
+//       blocking, so tasks may safely wait on groups themselves.
+//---------------------------------------------------------------------------
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+  // Starts the given number of workers (by default one per hardware
+  // thread). With zero workers tasks only run when a thread waits on a
+  // TaskGroup, which makes every parallel operation sequential.
+  explicit ThreadPool(int threads = default_threads())
+  {
+    for (int i = 0; i < threads; ++i)
+    {
+      queues.emplace_back(new Queue);
+    }
+    for (int i = 0; i < threads; ++i)
+    {
+      workers.emplace_back([this, i] { work(i); });
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Finishes the queued tasks and joins the workers
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : workers)
+    {
+      t.join();
+    }
+  }
+
+  // Number of worker threads
+  int size() const { return static_cast<int>(workers.size()); }
+
+  // Queues a task. A worker pushes onto its own deque; other threads
+  // spread their tasks over the workers round robin.
+  void submit(std::function<void()> task)
+  {
+    if (queues.empty())
+    {
+      // no workers: keep it for the next waiter
+      std::lock_guard<std::mutex> lock(orphan_mutex);
+      orphans.push_back(std::move(task));
+      return;
+    }
+    int i = local_index();
+    if (i < 0)
+    {
+      i = static_cast<int>(next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size());
+    }
+    {
+      std::lock_guard<std::mutex> lock(queues[i]->mutex);
+      queues[i]->tasks.push_back(std::move(task));
+    }
+    pending.fetch_add(1, std::memory_order_release);
+    {
+      // pairs with the predicate check in work(), so a worker that is
+      // about to sleep cannot miss this task
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+    }
+    wake.notify_one();
+  }
+
+  // Runs one queued task on the calling thread. Returns false if there
+  // was nothing to run.
+  bool run_one()
+  {
+    std::function<void()> task;
+    if (!take(local_index(), task))
+    {
+      return false;
+    }
+    task();
+    return true;
+  }
+
+  static int default_threads()
+  {
+    int n = static_cast<int>(std::thread::hardware_concurrency());
+    return n > 0 ? n : 1;
+  }
+
+private:
+  // one worker's tasks; the owner uses the back, thieves the front
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+
+  // tasks submitted to a pool without workers
+  std::mutex orphan_mutex;
+  std::deque<std::function<void()>> orphans;
+
+  // number of queued tasks (lets idle workers sleep)
+  std::atomic<long> pending{0};
+  std::atomic<unsigned> next_queue{0};
+
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  // index of the calling thread's queue, or -1 if it is not one of
+  // this pool's workers
+  int local_index() const
+  {
+    return current_pool() == this ? current_index() : -1;
+  }
+
+  static const ThreadPool *&current_pool()
+  {
+    thread_local const ThreadPool *pool = nullptr;
+    return pool;
+  }
+
+  static int &current_index()
+  {
+    thread_local int index = -1;
+    return index;
+  }
+
+  // pops the caller's newest task, or steals another queue's oldest
+  bool take(int self, std::function<void()> &task)
+  {
+    if (queues.empty())
+    {
+      std::lock_guard<std::mutex> lock(orphan_mutex);
+      if (orphans.empty())
+      {
+        return false;
+      }
+      task = std::move(orphans.back());
+      orphans.pop_back();
+      return true;
+    }
+    if (pending.load(std::memory_order_acquire) == 0)
+    {
+      return false;
+    }
+    if (self >= 0)
+    {
+      Queue &q = *queues[self];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (!q.tasks.empty())
+      {
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        pending.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    int n = static_cast<int>(queues.size());
+    int start = self >= 0 ? self + 1 : 0;
+    for (int k = 0; k < n; ++k)
+    {
+      Queue &q = *queues[(start + k) % n];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (!q.tasks.empty())
+      {
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        pending.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // worker loop
+  void work(int index)
+  {
+    current_pool() = this;
+    current_index() = index;
+    std::function<void()> task;
+    while (true)
+    {
+      if (take(index, task))
+      {
+        task();
+        task = nullptr;
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_mutex);
+      wake.wait(lock, [this] {
+        return stopping or pending.load(std::memory_order_acquire) > 0;
+      });
+      if (stopping and pending.load(std::memory_order_acquire) == 0)
+      {
+        return;
+      }
+    }
+  }
+};
+
+// A batch of tasks run on a pool. wait() returns once every task run
+// through the group (including tasks those tasks added) has finished,
+// and rethrows the first exception any of them threw.
+class TaskGroup
+{
+public:
+  explicit TaskGroup(ThreadPool &pool) : pool(pool) {}
+
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+  // The tasks must not outlive the data they use, so a group is always
+  // waited on before it goes away
+  ~TaskGroup()
+  {
+    try
+    {
+      wait();
+    }
+    catch (...)
+    {
+    }
+  }
+
+  // Adds a task to the group
+  template <typename F>
+  void run(F &&f)
+  {
+    outstanding.fetch_add(1, std::memory_order_relaxed);
+    pool.submit([this, f = std::forward<F>(f)]() mutable {
+      try
+      {
+        // destroy the task's captures before the group can finish
+        auto task = std::move(f);
+        task();
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error)
+          error = std::current_exception();
+      }
+      outstanding.fetch_sub(1, std::memory_order_acq_rel);
+    });
+  }
+
+  // Runs pool tasks until every task in the group has finished
+  void wait()
+  {
+    while (outstanding.load(std::memory_order_acquire) > 0)
+    {
+      if (!pool.run_one())
+      {
+        std::this_thread::yield();
+      }
+    }
+    std::exception_ptr e;
+    {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      std::swap(e, error);
+    }
+    if (e)
+    {
+      std::rethrow_exception(e);
+    }
+  }
+
+private:
+  ThreadPool &pool;
+  std::atomic<long> outstanding{0};
+  std::mutex error_mutex;
+  std::exception_ptr error;
+};
+
+#endif
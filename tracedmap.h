@@ -0,0 +1,352 @@
+//---------------------------------------------------------------------------
+// NAME: Joey Macauley
+// FILE: tracedmap.h
+// DATE: Spring 2022
+// DESC: Latency tracing for maps. TracedMap wraps any map and
+//       records how long each operation takes into a LatencyRecorder,
+//       which keeps per-thread log-linear (HDR style) histograms per
+//       operation type and reports percentiles from them.
+//---------------------------------------------------------------------------
+
+#ifndef TRACEDMAP_H
+#define TRACEDMAP_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+#include "map.h"
+#include "maptraits.h"
+
+// Operations timed by TracedMap
+enum class MapOp
+{
+  lookup,
+  insert,
+  erase,
+  contains,
+  find_keys,
+  sorted_keys,
+  next_key,
+  prev_key,
+  clear,
+  count_
+};
+
+inline const char *map_op_name(MapOp op)
+{
+  static const char *names[] = {"lookup", "insert", "erase", "contains", "find_keys",
+                                "sorted_keys", "next_key", "prev_key", "clear"};
+  return names[static_cast<int>(op)];
+}
+
+// Histogram of nanosecond latencies with 16 sub-buckets per power of
+// two (about 6% relative error). Only its owning thread records into
+// it, using relaxed loads and stores, so recording is wait-free and
+// other threads may read it at any time.
+class LatencyHistogram
+{
+public:
+  static const int buckets = 61 * 16;
+
+  // Records one latency
+  void record(std::uint64_t ns)
+  {
+    std::atomic<std::uint64_t> &b = counts[bucket(ns)];
+    b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (ns > max.load(std::memory_order_relaxed))
+      max.store(ns, std::memory_order_relaxed);
+  }
+
+  // Adds this histogram's counts into totals (and the max into max_ns)
+  void add_to(std::uint64_t *totals, std::uint64_t &max_ns) const
+  {
+    for (int i = 0; i < buckets; ++i)
+      totals[i] += counts[i].load(std::memory_order_relaxed);
+    std::uint64_t m = max.load(std::memory_order_relaxed);
+    if (m > max_ns)
+      max_ns = m;
+  }
+
+  // Clears the counts (only safe while no thread is recording)
+  void reset()
+  {
+    for (int i = 0; i < buckets; ++i)
+      counts[i].store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+  }
+
+  // Maps a latency to its bucket
+  static int bucket(std::uint64_t ns)
+  {
+    if (ns < 16)
+      return static_cast<int>(ns);
+    int msb = 63 - __builtin_clzll(ns);
+    return (msb - 3) * 16 + static_cast<int>((ns >> (msb - 4)) & 15);
+  }
+
+  // Returns a representative (midpoint) latency for a bucket
+  static std::uint64_t value(int b)
+  {
+    if (b < 16)
+      return static_cast<std::uint64_t>(b);
+    int msb = b / 16 + 3;
+    std::uint64_t lower = static_cast<std::uint64_t>(16 + b % 16) << (msb - 4);
+    return lower + (std::uint64_t(1) << (msb - 4)) / 2;
+  }
+
+private:
+  std::atomic<std::uint64_t> counts[buckets] = {};
+  std::atomic<std::uint64_t> max{0};
+};
+
+// Summary of the latencies recorded for one operation type
+struct LatencySummary
+{
+  std::uint64_t count = 0;
+  std::uint64_t p50 = 0;
+  std::uint64_t p99 = 0;
+  std::uint64_t p999 = 0;
+  std::uint64_t max = 0;
+};
+
+// Collects latencies from any number of threads. Each thread gets its
+// own set of histograms the first time it records (the only time a
+// lock is taken); after that recording touches only thread-local
+// data. Sampling records one in every sample_every operations per
+// thread.
+class LatencyRecorder
+{
+public:
+  explicit LatencyRecorder(int sample_every = 1)
+      : sample_every(sample_every > 0 ? sample_every : 1), id(next_id()) {}
+
+  LatencyRecorder(const LatencyRecorder &) = delete;
+  LatencyRecorder &operator=(const LatencyRecorder &) = delete;
+
+  // Returns true if the calling thread should time its next operation
+  bool sample()
+  {
+    if (sample_every == 1)
+      return true;
+    return local().tick++ % sample_every == 0;
+  }
+
+  // Records a latency for the operation on the calling thread
+  void record(MapOp op, std::uint64_t ns)
+  {
+    local().hist[static_cast<int>(op)].record(ns);
+  }
+
+  // Merges every thread's histograms for the operation
+  LatencySummary summary(MapOp op) const
+  {
+    std::vector<std::uint64_t> totals(LatencyHistogram::buckets, 0);
+    LatencySummary s;
+    {
+      std::lock_guard<std::mutex> lock(shards_mutex);
+      for (const auto &shard : shards)
+        shard->hist[static_cast<int>(op)].add_to(totals.data(), s.max);
+    }
+    for (int i = 0; i < LatencyHistogram::buckets; ++i)
+      s.count += totals[i];
+    s.p50 = percentile(totals, s.count, 0.50);
+    s.p99 = percentile(totals, s.count, 0.99);
+    s.p999 = percentile(totals, s.count, 0.999);
+    return s;
+  }
+
+  // Writes one line per operation type that has samples
+  void report(std::ostream &out) const
+  {
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-12s %12s %10s %10s %10s %10s\n", "op", "samples",
+                  "p50 ns", "p99 ns", "p999 ns", "max ns");
+    out << line;
+    for (int i = 0; i < static_cast<int>(MapOp::count_); ++i)
+    {
+      LatencySummary s = summary(static_cast<MapOp>(i));
+      if (s.count == 0)
+        continue;
+      std::snprintf(line, sizeof(line), "%-12s %12llu %10llu %10llu %10llu %10llu\n",
+                    map_op_name(static_cast<MapOp>(i)),
+                    static_cast<unsigned long long>(s.count),
+                    static_cast<unsigned long long>(s.p50),
+                    static_cast<unsigned long long>(s.p99),
+                    static_cast<unsigned long long>(s.p999),
+                    static_cast<unsigned long long>(s.max));
+      out << line;
+    }
+  }
+
+  // Clears all histograms (only safe while no thread is recording)
+  void reset()
+  {
+    std::lock_guard<std::mutex> lock(shards_mutex);
+    for (auto &shard : shards)
+      for (LatencyHistogram &h : shard->hist)
+        h.reset();
+  }
+
+private:
+  // one thread's histograms
+  struct Shard
+  {
+    LatencyHistogram hist[static_cast<int>(MapOp::count_)];
+    std::uint64_t tick = 0;
+  };
+
+  int sample_every;
+
+  // unique id, so a thread's cached shard is never confused with a
+  // later recorder allocated at the same address
+  std::uint64_t id;
+
+  mutable std::mutex shards_mutex;
+  std::vector<std::unique_ptr<Shard>> shards;
+
+  static std::uint64_t next_id()
+  {
+    static std::atomic<std::uint64_t> ids{0};
+    return ids.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // returns the calling thread's shard, creating it on first use
+  Shard &local()
+  {
+    thread_local std::unordered_map<std::uint64_t, Shard *> cache;
+    thread_local std::uint64_t last_id = ~std::uint64_t(0);
+    thread_local Shard *last = nullptr;
+    if (last_id == id)
+      return *last;
+    Shard *&shard = cache[id];
+    if (shard == nullptr)
+    {
+      std::lock_guard<std::mutex> lock(shards_mutex);
+      shards.emplace_back(new Shard);
+      shard = shards.back().get();
+    }
+    last_id = id;
+    last = shard;
+    return *shard;
+  }
+
+  static std::uint64_t percentile(const std::vector<std::uint64_t> &totals, std::uint64_t n,
+                                  double p)
+  {
+    if (n == 0)
+      return 0;
+    std::uint64_t rank = static_cast<std::uint64_t>(p * (n - 1)) + 1, seen = 0;
+    for (int i = 0; i < LatencyHistogram::buckets; ++i)
+    {
+      seen += totals[i];
+      if (seen >= rank)
+        return LatencyHistogram::value(i);
+    }
+    return 0;
+  }
+};
+
+// Map decorator that times every (or every sampled) operation of the
+// wrapped map. The wrapped map and the recorder must outlive it. By
+// default any Map<K,V> can be wrapped; naming the concrete map type as
+// M (e.g., TracedMap<int, int, BTreeMap<int, int>>) calls it directly
+// instead of through the virtual interface.
+template <typename K, typename V, typename M = Map<K, V>>
+class TracedMap final : public Map<K, V>
+{
+  static_assert(is_map<M, K, V>::value, "TracedMap needs a type with the Map<K,V> members");
+
+public:
+  TracedMap(M &inner, LatencyRecorder &recorder) : inner(inner), recorder(recorder) {}
+
+  int size() const { return inner.size(); }
+  bool empty() const { return inner.empty(); }
+
+  V &operator[](const K &key)
+  {
+    Timed t(recorder, MapOp::lookup);
+    return inner[key];
+  }
+  const V &operator[](const K &key) const
+  {
+    Timed t(recorder, MapOp::lookup);
+    return static_cast<const M &>(inner)[key];
+  }
+  void insert(const K &key, const V &value)
+  {
+    Timed t(recorder, MapOp::insert);
+    inner.insert(key, value);
+  }
+  void erase(const K &key)
+  {
+    Timed t(recorder, MapOp::erase);
+    inner.erase(key);
+  }
+  bool contains(const K &key) const
+  {
+    Timed t(recorder, MapOp::contains);
+    return inner.contains(key);
+  }
+  ArraySeq<K> find_keys(const K &k1, const K &k2) const
+  {
+    Timed t(recorder, MapOp::find_keys);
+    return inner.find_keys(k1, k2);
+  }
+  ArraySeq<K> sorted_keys() const
+  {
+    Timed t(recorder, MapOp::sorted_keys);
+    return inner.sorted_keys();
+  }
+  bool next_key(const K &key, K &next_key) const
+  {
+    Timed t(recorder, MapOp::next_key);
+    return inner.next_key(key, next_key);
+  }
+  bool prev_key(const K &key, K &next_key) const
+  {
+    Timed t(recorder, MapOp::prev_key);
+    return inner.prev_key(key, next_key);
+  }
+  void clear()
+  {
+    Timed t(recorder, MapOp::clear);
+    inner.clear();
+  }
+
+private:
+  M &inner;
+  LatencyRecorder &recorder;
+
+  // times its own lifetime (so operations that throw are recorded too)
+  struct Timed
+  {
+    LatencyRecorder &recorder;
+    MapOp op;
+    bool sampled;
+    std::chrono::steady_clock::time_point start;
+    Timed(LatencyRecorder &recorder, MapOp op)
+        : recorder(recorder), op(op), sampled(recorder.sample())
+    {
+      if (sampled)
+        start = std::chrono::steady_clock::now();
+    }
+    ~Timed()
+    {
+      if (sampled)
+      {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+        recorder.record(op, static_cast<std::uint64_t>(ns));
+      }
+    }
+  };
+};
+
+#endif